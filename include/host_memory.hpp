@@ -0,0 +1,165 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+
+namespace ipu_utils {
+
+/// Fixed size host buffer allocated directly with mmap so that it is always page
+/// aligned. Optionally the buffer can be backed by huge pages: if none are
+/// available (e.g. none have been reserved in /proc/sys/vm/nr_hugepages)
+/// the allocation falls back to normal pages and asks for transparent huge
+/// pages instead. Streams can be connected directly to these buffers (see
+/// StreamableTensor and connectStream()) which avoids the extra host copy that
+/// a stream callback needs. Memory is zero initialised.
+template <class T>
+class HostBuffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "HostBuffer elements must be trivially copyable.");
+public:
+  static constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+  HostBuffer() : ptr(nullptr), count(0), bytes(0), huge(false) {}
+
+  HostBuffer(std::size_t numElements, bool useHugePages = false)
+    : ptr(nullptr), count(numElements), bytes(0), huge(false) {
+    if (numElements == 0) {
+      return;
+    }
+    const std::size_t requested = numElements * sizeof(T);
+    void* p = MAP_FAILED;
+
+    if (useHugePages) {
+      bytes = roundUp(requested, hugePageSize);
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      huge = p != MAP_FAILED;
+      if (!huge) {
+        logger()->warn("No huge pages available for {} byte host buffer: "
+                       "falling back to transparent huge pages.", requested);
+      }
+    }
+
+    if (p == MAP_FAILED) {
+      bytes = roundUp(requested, sysconf(_SC_PAGESIZE));
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      if (useHugePages) {
+        madvise(p, bytes, MADV_HUGEPAGE);
+      }
+    }
+
+    ptr = static_cast<T*>(p);
+  }
+
+  HostBuffer(const HostBuffer&) = delete;
+  HostBuffer& operator = (const HostBuffer&) = delete;
+
+  HostBuffer(HostBuffer&& other) : HostBuffer() { swap(other); }
+  HostBuffer& operator = (HostBuffer&& other) {
+    HostBuffer tmp(std::move(other));
+    swap(tmp);
+    return *this;
+  }
+
+  ~HostBuffer() {
+    if (ptr) {
+      munmap(ptr, bytes);
+    }
+  }
+
+  T* data() { return ptr; }
+  const T* data() const { return ptr; }
+  std::size_t size() const { return count; }
+  T* begin() { return ptr; }
+  T* end() { return ptr + count; }
+  const T* begin() const { return ptr; }
+  const T* end() const { return ptr + count; }
+  T& operator[](std::size_t i) { return ptr[i]; }
+  const T& operator[](std::size_t i) const { return ptr[i]; }
+
+  /// True if the buffer is backed by explicitly reserved huge pages.
+  bool usesHugePages() const { return huge; }
+
+private:
+  static std::size_t roundUp(std::size_t n, std::size_t multiple) {
+    return ((n + multiple - 1) / multiple) * multiple;
+  }
+
+  void swap(HostBuffer& other) {
+    std::swap(ptr, other.ptr);
+    std::swap(count, other.count);
+    std::swap(bytes, other.bytes);
+    std::swap(huge, other.huge);
+  }
+
+  T* ptr;
+  std::size_t count;
+  std::size_t bytes;
+  bool huge;
+};
+
+/// Read only memory mapping of a whole file. Pages are loaded on demand
+/// so large files (e.g. embedding tables) can be streamed to the device
+/// without first being read into host memory.
+class MappedFile {
+public:
+  MappedFile(const std::string& fileName) : ptr(nullptr), bytes(0) {
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open file for mapping: '" + fileName + "'");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      throw std::runtime_error("Could not get size of file: '" + fileName + "'");
+    }
+    bytes = info.st_size;
+    if (bytes > 0) {
+      void* p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Could not map file: '" + fileName + "'");
+      }
+      madvise(p, bytes, MADV_SEQUENTIAL);
+      ptr = p;
+    }
+    close(fd); // The mapping stays valid after the file is closed.
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator = (const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (ptr) {
+      munmap(ptr, bytes);
+    }
+  }
+
+  const void* data() const { return ptr; }
+  std::size_t size() const { return bytes; }
+
+private:
+  void* ptr;
+  std::size_t bytes;
+};
+
+template <class T>
+void connectStream(poplar::Engine& e, const std::string& handle, HostBuffer<T>& b) {
+  e.connectStream(handle, b.begin(), b.end());
+}
+
+} // end namespace ipu_utils
@@ -6,6 +6,17 @@
 #include <fstream>
 #include <string>
 #include <functional>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
 
 #include <poplar/Graph.hpp>
 #include <poplar/Engine.hpp>
@@ -68,6 +79,39 @@ inline void saveExe(const poplar::Executable& exe, const std::string& name) {
   logger()->info("Saved Poplar executable as: '{}'", fileName);
 }
 
+/// 64-bit FNV-1a hash. Used where we need a hash that is stable
+/// across runs and platforms (std::hash gives no such guarantee).
+inline std::uint64_t stableHash(const std::string& s) {
+  std::uint64_t h = 14695981039346656037ull;
+  for (const unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+/// Return the path prefix of an executable cache entry. The key combines the
+/// description of the tool config with the Poplar version and details of the
+/// target, so a different SDK or device never picks up a stale executable.
+inline std::string makeExeCacheName(const std::string& cacheDir, const std::string& configKey,
+                                    std::size_t numReplicas, const poplar::Target& target) {
+  std::stringstream key;
+  key << configKey
+      << "poplar-version=" << poplar::versionString() << "\n"
+      << "target-arch=" << target.getTargetArchString() << "\n"
+      << "target-ipus=" << target.getNumIPUs() << "\n"
+      << "target-tiles-per-ipu=" << target.getTilesPerIPU() << "\n"
+      << "replicas=" << numReplicas << "\n";
+  std::stringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << stableHash(key.str());
+  return (std::filesystem::path(cacheDir) / name.str()).string();
+}
+
+inline bool exeCacheEntryExists(const std::string& name) {
+  return std::filesystem::exists(makeExeFileName(name)) &&
+         std::filesystem::exists(makeProgramsFileName(name));
+}
+
 /// Abstract Interface for a device within the builder framework.
 class DeviceInterface {
 public:
@@ -164,6 +208,33 @@ private:
   bool deferredAttach;
 };
 
+/// Device that only provides a target. This is used to compile executables
+/// on hosts that have no IPU hardware attached: any attempt to attach or run
+/// on it throws.
+class OfflineDevice : public DeviceInterface {
+public:
+  OfflineDevice(std::size_t numIpus, const std::string& arch)
+    : target(poplar::Target::createIPUTarget(numIpus, arch)) {
+    logger()->info("Using offline {} target with {} IPUs (compile only)", arch, numIpus);
+  }
+  virtual ~OfflineDevice() {}
+
+  const poplar::Target& getTarget() override { return target; }
+
+  const poplar::Device& getPoplarDevice() override {
+    throw std::runtime_error("Offline targets can not be used to run programs.");
+  }
+
+  void attach() override {
+    throw std::runtime_error("Offline targets can not be attached.");
+  }
+
+  void detach() override {}
+
+private:
+  poplar::Target target;
+};
+
 struct RuntimeConfig {
   std::size_t numIpus;
   std::size_t numReplicas;
@@ -173,12 +244,23 @@ struct RuntimeConfig {
   bool loadExe;
   bool compileOnly;
   bool deferredAttach;
+  std::size_t warmupIterations;
+  std::size_t trials;
+  std::string exeCacheDir; // Executable cache is disabled if empty.
+  std::string exeCacheKey; // Describes the tool and options that produced the graph.
+  std::string compileTarget; // If set, compile for this IPU arch without hardware.
 };
 
 /// Determine whether to acquire a HW device or IPU model, and number of IPUs
 /// for either, from the relevant command line options.
 inline
 std::unique_ptr<DeviceInterface> getDeviceFromConfig(RuntimeConfig config) {
+    if (!config.compileTarget.empty()) {
+      if (!config.compileOnly) {
+        throw std::logic_error("An offline compile target can only be used in compile only mode.");
+      }
+      return std::make_unique<OfflineDevice>(config.numIpus, config.compileTarget);
+    }
     std::unique_ptr<DeferredDevice> device(new DeferredDevice(config.deferredAttach));
     if(config.useIpuModel) {
       device->getIpuModel(config.numIpus);
@@ -266,6 +348,115 @@ public:
   }
 };
 
+/// Summary statistics over a number of repeated timing trials.
+/// Times are in whatever unit the samples were given in (seconds
+/// for the helpers below).
+struct TimingStats {
+  std::size_t trials = 0;
+  double min = 0.0;
+  double max = 0.0;
+  double mean = 0.0;
+  double median = 0.0;
+  double p99 = 0.0;
+  double stddev = 0.0;
+};
+
+/// Compute TimingStats from a set of samples. Percentiles use the
+/// nearest-rank method so the p99 of fewer than 100 samples is the max.
+inline TimingStats computeTimingStats(std::vector<double> samples) {
+  TimingStats stats;
+  stats.trials = samples.size();
+  if (samples.empty()) {
+    return stats;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  const auto n = samples.size();
+  auto percentile = [&](double p) {
+    std::size_t rank = std::ceil(p * n);
+    return samples[std::max<std::size_t>(rank, 1) - 1];
+  };
+
+  stats.min = samples.front();
+  stats.max = samples.back();
+  stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+  stats.median = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+  stats.p99 = percentile(0.99);
+  double sumSq = 0.0;
+  for (const auto s : samples) {
+    sumSq += (s - stats.mean) * (s - stats.mean);
+  }
+  stats.stddev = n > 1 ? std::sqrt(sumSq / (n - 1)) : 0.0;
+  return stats;
+}
+
+/// Call `fn` `warmup` times without timing it, then time `trials` further
+/// calls individually. Returns the statistics in seconds.
+template <class F>
+TimingStats timeTrials(F&& fn, std::size_t warmup, std::size_t trials) {
+  for (auto i = 0u; i < warmup; ++i) {
+    fn();
+  }
+  std::vector<double> samples;
+  samples.reserve(trials);
+  for (auto i = 0u; i < trials; ++i) {
+    auto startTime = std::chrono::steady_clock::now();
+    fn();
+    auto endTime = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double>(endTime - startTime).count());
+  }
+  return computeTimingStats(samples);
+}
+
+/// Time a named program from a ProgramManager using timeTrials().
+inline TimingStats timeProgram(const ProgramManager& progs, poplar::Engine& engine,
+                               const std::string& progName,
+                               std::size_t warmup, std::size_t trials) {
+  return timeTrials([&]() { progs.run(engine, progName); }, warmup, trials);
+}
+
+inline std::ostream& operator << (std::ostream& os, const TimingStats& t) {
+  os << "min: " << t.min << " median: " << t.median << " p99: " << t.p99
+     << " mean: " << t.mean << " stddev: " << t.stddev << " (" << t.trials << " trials)";
+  return os;
+}
+
+/// A single named measurement produced by a tool (e.g. a bandwidth or a cycle count).
+struct Result {
+  std::string name;
+  double value;
+  std::string unit;
+};
+
+/// Class which collects machine readable results from a tool. Tools record
+/// their metrics here (in addition to logging them) and the launcher writes
+/// them out together with the tool's options so that downstream scripts do
+/// not need to scrape the log.
+class ResultsRecorder {
+  std::vector<Result> results;
+
+public:
+  /// Record a named result. Names should be unique within a run.
+  void add(const std::string& name, double value, const std::string& unit = "") {
+    results.push_back(Result{name, value, unit});
+  }
+
+  /// Record the summary statistics of repeated trials as a group of results
+  /// with suffixes `_min`, `_median`, `_p99`, `_mean` and `_stddev`.
+  void add(const std::string& name, const TimingStats& stats, const std::string& unit = "s") {
+    add(name + "_min", stats.min, unit);
+    add(name + "_median", stats.median, unit);
+    add(name + "_p99", stats.p99, unit);
+    add(name + "_mean", stats.mean, unit);
+    add(name + "_stddev", stats.stddev, unit);
+    add(name + "_trials", stats.trials);
+  }
+
+  const std::vector<Result>& get() const { return results; }
+  bool empty() const { return results.empty(); }
+  void clear() { results.clear(); }
+};
+
 /// Helper functions for device IO with std::vector and scalars.
 template <class T>
 void connectStream(poplar::Engine& e, const std::string& handle, std::vector<T>& v) {
@@ -292,6 +483,9 @@ void readScalar(poplar::Engine& e, const std::string& handle, T& s) {
   e.readTensor(handle, &s, &s + 1);
 }
 
+template <class T>
+class HostBuffer; // Defined in host_memory.hpp
+
 /// Utility for managing a tensor and its IO streams. We need to retain the handle
 /// name to use when we come to execute the graph (and rebuild it when loading an
 /// exe) so this encapsulates the necessary string management, which otherwise
@@ -356,6 +550,17 @@ struct StreamableTensor {
     connectStream(e, getReadHandle(), v);
   }
 
+  // Connect directly to page aligned host memory (include host_memory.hpp to use these):
+  template <class T>
+  void connectWriteStream(poplar::Engine& e, HostBuffer<T>& b) const {
+    e.connectStream(getWriteHandle(), b.begin(), b.end());
+  }
+
+  template <class T>
+  void connectReadStream(poplar::Engine& e, HostBuffer<T>& b) const {
+    e.connectStream(getReadHandle(), b.begin(), b.end());
+  }
+
   std::size_t numElements() const { return get().numElements(); }
   poplar::Type elementType() const { return get().elementType(); }
   std::vector<std::size_t> shape() const { return get().shape(); }
@@ -403,6 +608,12 @@ struct BuilderInterface {
     return programs;
   }
 
+  // Tools should record any metrics they measure here. If the launcher
+  // was asked for a results file these get written out after execution.
+  virtual ipu_utils::ResultsRecorder& getResults() {
+    return resultsRecorder;
+  }
+
   /// Methods below are private as they should only be called by the GraphManager.
 private:
   friend class GraphManager;
@@ -419,6 +630,7 @@ private:
 private:
   ipu_utils::RuntimeConfig runConfig;
   ipu_utils::ProgramManager programs;
+  ipu_utils::ResultsRecorder resultsRecorder;
 };
 
 /// Utility class that can be used to wrap a poplar::Engine::ProgressFunc
@@ -479,14 +691,46 @@ public:
   /// builder object completely describes the Poplar program to build and run.
   /// Returns the exit code for the host program.
   int run(BuilderInterface& builder) {
+    std::unique_ptr<DeviceInterface> device;
+    try {
+      device = getDevice(builder);
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->error("Exception: {}", e.what());
+      return EXIT_FAILURE;
+    }
+    return run(builder, *device);
+  }
+
+  /// Same as run() above but uses a device that is owned by the caller. This
+  /// allows multiple builders to be run one after another without releasing
+  /// (and re-attaching to) the hardware in between. The device is left
+  /// attached when this returns.
+  int run(BuilderInterface& builder, DeviceInterface& device) {
     try {
       pvti::TraceChannel traceChannel = {"ipu_utils::GraphManager"};
 
       logger()->info("Poplar version: {}", poplar::versionString());
       auto config = builder.getRuntimeConfig();
-      auto device = builder.getDevice();
+
+      std::string cacheName;
+      if (!config.exeCacheDir.empty() && !config.loadExe) {
+        cacheName = makeExeCacheName(config.exeCacheDir, config.exeCacheKey,
+                                     config.numReplicas, device.getTarget());
+        if (exeCacheEntryExists(cacheName)) {
+          logger()->info("Executable cache hit: '{}'", cacheName);
+          if (config.compileOnly) {
+            logger()->info("Compile only mode selected: nothing to do.");
+            return EXIT_SUCCESS;
+          }
+          config.loadExe = true;
+          config.exeName = cacheName;
+        } else {
+          logger()->info("Executable cache miss: '{}'", cacheName);
+        }
+      }
+
       logger()->info("Creating graph with {} replicas", config.numReplicas);
-      poplar::Graph graph(device->getTarget(), poplar::replication_factor(config.numReplicas));
+      poplar::Graph graph(device.getTarget(), poplar::replication_factor(config.numReplicas));
 
       if (config.loadExe) {
         // When loading, we simply load-construct the executable and run it:
@@ -502,12 +746,12 @@ public:
           throw;
         }
         pvti::Tracepoint::end(&traceChannel, "loading_graph");
-        executeGraphProgram(exe, *device, builder);
+        executeGraphProgram(exe, device, builder);
       } else {
         // Otherwise we must build and compile the graph:
         logger()->info("Graph construction started");
         pvti::Tracepoint::begin(&traceChannel, "constructing_graph");
-        builder.build(graph, device->getTarget());
+        builder.build(graph, device.getTarget());
         pvti::Tracepoint::end(&traceChannel, "constructing_graph");
         logger()->info("Graph construction finished");
 
@@ -528,13 +772,17 @@ public:
           builder.getPrograms().serialise(fs);
         }
 
+        if (!cacheName.empty()) {
+          saveToExeCache(exe, builder.getPrograms(), cacheName);
+        }
+
         if (config.compileOnly) {
             ipu_utils::logger()->info("Compile only mode selected: finished.");
             return EXIT_SUCCESS;
         }
 
         // Run the graph we just built and compiled.
-        executeGraphProgram(exe, *device, builder);
+        executeGraphProgram(exe, device, builder);
       }
 
     } catch (const std::exception& e) {
@@ -545,7 +793,35 @@ public:
     return EXIT_SUCCESS;
   }
 
+  /// Acquire the device the builder asks for (see BuilderInterface::getDevice()).
+  static std::unique_ptr<DeviceInterface> getDevice(BuilderInterface& builder) {
+    return builder.getDevice();
+  }
+
 private:
+  /// Write the executable and program list under temporary names then rename
+  /// them into place. The exe is renamed last so a concurrent reader never
+  /// sees an exe without its program list.
+  void saveToExeCache(const poplar::Executable& exe, const ProgramManager& progs,
+                      const std::string& name) {
+    std::filesystem::create_directories(std::filesystem::path(name).parent_path());
+    // Sweeps compile several points at once in one process so the temporary name is
+    // unique to the thread as well as the process:
+    std::stringstream tmpName;
+    tmpName << name << ".tmp" << ::getpid() << "." << std::this_thread::get_id();
+    {
+      std::ofstream fs(makeExeFileName(tmpName.str()));
+      exe.serialize(fs);
+    }
+    {
+      std::ofstream fs(makeProgramsFileName(tmpName.str()));
+      progs.serialise(fs);
+    }
+    std::filesystem::rename(makeProgramsFileName(tmpName.str()), makeProgramsFileName(name));
+    std::filesystem::rename(makeExeFileName(tmpName.str()), makeExeFileName(name));
+    logger()->info("Saved executable to cache: '{}'", name);
+  }
+
   void executeGraphProgram(poplar::Executable& exe,
                            DeviceInterface& device,
                            BuilderInterface& builder) {
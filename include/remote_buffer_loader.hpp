@@ -0,0 +1,114 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+#include "host_memory.hpp"
+
+#include <poplar/Engine.hpp>
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ipu_utils {
+
+/// Returns a pointer to the data for one row of a remote buffer. Sources
+/// that already hold the row in memory return a pointer to it, generated rows
+/// can instead be written to the scratch memory (rowBytes in size, private to
+/// the calling thread) and a pointer to that returned.
+using RemoteBufferRowSource = std::function<const void*(std::size_t row, void* scratch)>;
+
+struct RemoteBufferFillOptions {
+  std::size_t threads = 1;      // Number of host threads issuing copies.
+  std::size_t rowsPerTask = 0;  // Rows copied by each task: 0 divides the rows evenly between threads.
+  unsigned replica = 0;         // Replica whose remote buffer is filled.
+};
+
+/// Fill rows [0, numRows) of a remote buffer from multiple host threads.
+/// Each thread repeatedly takes the next task (a contiguous range of rows)
+/// until all rows have been copied. The threads prepare rows (call the row
+/// source) in parallel but Poplar does not document Engine::copyToRemoteBuffer()
+/// as thread safe so the copies themselves are serialised by a lock. Extra threads
+/// therefore only help when the source is expensive (e.g. generated or page faulted
+/// rows). With one thread this is equivalent to a simple loop over
+/// copyToRemoteBuffer(). Exceptions thrown by the row source or the copies are
+/// re-thrown on the calling thread once all threads have stopped.
+inline void fillRemoteBuffer(poplar::Engine& engine, const std::string& handle,
+                             std::size_t numRows, std::size_t rowBytes,
+                             const RemoteBufferRowSource& source,
+                             RemoteBufferFillOptions options = {}) {
+  const auto threads = std::max<std::size_t>(1, std::min(options.threads, numRows));
+  const auto rowsPerTask = options.rowsPerTask ? options.rowsPerTask : (numRows + threads - 1) / threads;
+  const auto numTasks = rowsPerTask ? (numRows + rowsPerTask - 1) / rowsPerTask : 0;
+
+  std::atomic<std::size_t> nextTask(0);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  std::mutex engineMutex;
+
+  auto worker = [&]() {
+    try {
+      HostBuffer<std::uint8_t> scratch(rowBytes);
+      for (auto task = nextTask++; task < numTasks; task = nextTask++) {
+        const auto end = std::min(numRows, (task + 1) * rowsPerTask);
+        for (auto row = task * rowsPerTask; row < end; ++row) {
+          const auto rowData = source(row, scratch.data());
+          std::lock_guard<std::mutex> lock(engineMutex);
+          engine.copyToRemoteBuffer(rowData, handle, row, options.replica);
+        }
+      }
+    } catch (...) {
+      // Stop the other threads from starting new tasks:
+      nextTask = numTasks;
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  if (threads == 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (auto t = 0u; t < threads; ++t) {
+      pool.emplace_back(worker);
+    }
+    for (auto& t : pool) {
+      t.join();
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/// Fill a remote buffer from rows stored contiguously in host memory.
+inline void fillRemoteBuffer(poplar::Engine& engine, const std::string& handle,
+                             const void* data, std::size_t numRows, std::size_t rowBytes,
+                             RemoteBufferFillOptions options = {}) {
+  auto bytes = static_cast<const std::uint8_t*>(data);
+  fillRemoteBuffer(engine, handle, numRows, rowBytes,
+                   [&](std::size_t row, void*) { return bytes + row * rowBytes; }, options);
+}
+
+/// Fill a remote buffer directly from a memory mapped file that contains
+/// the rows stored contiguously (with no header).
+inline void fillRemoteBufferFromFile(poplar::Engine& engine, const std::string& handle,
+                                     const std::string& fileName, std::size_t numRows,
+                                     std::size_t rowBytes, RemoteBufferFillOptions options = {}) {
+  MappedFile file(fileName);
+  if (file.size() < numRows * rowBytes) {
+    throw std::runtime_error("File '" + fileName + "' is too small to fill remote buffer '" + handle +
+                             "': need " + std::to_string(numRows * rowBytes) + " bytes but it only has " +
+                             std::to_string(file.size()) + ".");
+  }
+  fillRemoteBuffer(engine, handle, file.data(), numRows, rowBytes, options);
+}
+
+} // end namespace ipu_utils
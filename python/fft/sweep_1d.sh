@@ -2,6 +2,10 @@
 
 # Copyright (c) 2022 Graphcore Ltd. All rights reserved.
 
+# The resulting CSV file can be passed to `multi-tool FourierTransform --plan-table`
+# so that the FFT planner uses these measurements instead of its cost model
+# (leave --radix-size at 0 to use the planner).
+
 TYPE="1d"
 RUN_DIR="profiles_${TYPE}"
 mkdir -p $RUN_DIR
@@ -0,0 +1,215 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include <poplar/HalfFloat.hpp>
+#include <poplar/Vertex.hpp>
+
+#ifdef __IPU__
+#include <ipu_vector_math>
+#endif
+
+// Fused element-wise complex arithmetic on planar (separate real and
+// imaginary) operands for the FFT twiddles and butterflies. Each vertex
+// reads both planes of all its operands in a single pass so a whole
+// butterfly is one compute set with no intermediate tensors (the popops
+// equivalents need a compute set and a temporary for every real op).
+//
+// On IPU the loops work on packets of float2/half4 (64-bit loads, stores
+// and arithmetic). The fields are 8-byte aligned so every packet is too.
+// On other targets a packet is a single element.
+
+template <class T>
+struct Packet {
+  using Type = T;
+  static constexpr unsigned size = 1;
+};
+
+#ifdef __IPU__
+template <>
+struct Packet<float> {
+  using Type = float2;
+  static constexpr unsigned size = 2;
+};
+
+template <>
+struct Packet<half> {
+  using Type = half4;
+  static constexpr unsigned size = 4;
+};
+#endif
+
+template <class T>
+using InputPlane = poplar::Input<poplar::Vector<T, poplar::VectorLayout::SPAN, 8>>;
+template <class T>
+using OutputPlane = poplar::Output<poplar::Vector<T, poplar::VectorLayout::SPAN, 8>>;
+template <class T>
+using InOutPlane = poplar::InOut<poplar::Vector<T, poplar::VectorLayout::SPAN, 8>>;
+
+// Access element i of a field as type U (either the element type or its packet type):
+template <class U, class Field>
+inline U& at(Field& field, unsigned i) { return reinterpret_cast<U*>(&field[0])[i]; }
+
+template <class U, class Field>
+inline U in(const Field& field, unsigned i) { return reinterpret_cast<const U*>(&field[0])[i]; }
+
+// Workers take packets in turn. The elements left over after the
+// last whole packet are processed one at a time by worker 0:
+template <class T, class Body>
+inline void forEachPacket(unsigned workerId, unsigned workers, unsigned n, Body&& body) {
+  using V = typename Packet<T>::Type;
+  constexpr auto size = Packet<T>::size;
+  const unsigned packets = n / size;
+  for (unsigned i = workerId; i < packets; i += workers) {
+    body(V(), i);
+  }
+  if (workerId == 0) {
+    for (unsigned i = packets * size; i < n; ++i) {
+      body(T(), i);
+    }
+  }
+}
+
+// x = x * w
+template <class T>
+class ComplexMultiply : public poplar::MultiVertex {
+public:
+  InOutPlane<T> xRe;
+  InOutPlane<T> xIm;
+  InputPlane<T> wRe;
+  InputPlane<T> wIm;
+
+  bool compute(unsigned workerId) {
+    forEachPacket<T>(workerId, numWorkers(), xRe.size(), [&](auto packet, unsigned i) {
+      using U = decltype(packet);
+      const U a = in<U>(xRe, i);
+      const U b = in<U>(xIm, i);
+      const U c = in<U>(wRe, i);
+      const U s = in<U>(wIm, i);
+      at<U>(xRe, i) = a * c - b * s;
+      at<U>(xIm, i) = a * s + b * c;
+    });
+    return true;
+  }
+};
+
+template class ComplexMultiply<float>;
+template class ComplexMultiply<half>;
+
+// y = a + w * b
+template <class T>
+class ComplexMultiplyAdd : public poplar::MultiVertex {
+public:
+  InputPlane<T> aRe;
+  InputPlane<T> aIm;
+  InputPlane<T> bRe;
+  InputPlane<T> bIm;
+  InputPlane<T> wRe;
+  InputPlane<T> wIm;
+  OutputPlane<T> yRe;
+  OutputPlane<T> yIm;
+
+  bool compute(unsigned workerId) {
+    forEachPacket<T>(workerId, numWorkers(), yRe.size(), [&](auto packet, unsigned i) {
+      using U = decltype(packet);
+      const U br = in<U>(bRe, i);
+      const U bi = in<U>(bIm, i);
+      const U c = in<U>(wRe, i);
+      const U s = in<U>(wIm, i);
+      at<U>(yRe, i) = in<U>(aRe, i) + (br * c - bi * s);
+      at<U>(yIm, i) = in<U>(aIm, i) + (br * s + bi * c);
+    });
+    return true;
+  }
+};
+
+template class ComplexMultiplyAdd<float>;
+template class ComplexMultiplyAdd<half>;
+
+// Radix-2 butterfly with the twiddle folded in:
+// y0 = a + w * b, y1 = a - w * b
+template <class T>
+class ComplexButterfly2 : public poplar::MultiVertex {
+public:
+  InputPlane<T> aRe;
+  InputPlane<T> aIm;
+  InputPlane<T> bRe;
+  InputPlane<T> bIm;
+  InputPlane<T> wRe;
+  InputPlane<T> wIm;
+  OutputPlane<T> y0Re;
+  OutputPlane<T> y0Im;
+  OutputPlane<T> y1Re;
+  OutputPlane<T> y1Im;
+
+  bool compute(unsigned workerId) {
+    forEachPacket<T>(workerId, numWorkers(), y0Re.size(), [&](auto packet, unsigned i) {
+      using U = decltype(packet);
+      const U br = in<U>(bRe, i);
+      const U bi = in<U>(bIm, i);
+      const U c = in<U>(wRe, i);
+      const U s = in<U>(wIm, i);
+      const U tr = br * c - bi * s;
+      const U ti = br * s + bi * c;
+      const U ar = in<U>(aRe, i);
+      const U ai = in<U>(aIm, i);
+      at<U>(y0Re, i) = ar + tr;
+      at<U>(y0Im, i) = ai + ti;
+      at<U>(y1Re, i) = ar - tr;
+      at<U>(y1Im, i) = ai - ti;
+    });
+    return true;
+  }
+};
+
+template class ComplexButterfly2<float>;
+template class ComplexButterfly2<half>;
+
+// Radix-4 butterfly (twiddles already applied). The
+// coefficients are +/-1 and +/-i so only additions are needed:
+// y_q = sum_j x_j exp(-2 pi i j q / 4)
+template <class T>
+class ComplexButterfly4 : public poplar::MultiVertex {
+public:
+  InputPlane<T> x0Re;
+  InputPlane<T> x0Im;
+  InputPlane<T> x1Re;
+  InputPlane<T> x1Im;
+  InputPlane<T> x2Re;
+  InputPlane<T> x2Im;
+  InputPlane<T> x3Re;
+  InputPlane<T> x3Im;
+  OutputPlane<T> y0Re;
+  OutputPlane<T> y0Im;
+  OutputPlane<T> y1Re;
+  OutputPlane<T> y1Im;
+  OutputPlane<T> y2Re;
+  OutputPlane<T> y2Im;
+  OutputPlane<T> y3Re;
+  OutputPlane<T> y3Im;
+
+  bool compute(unsigned workerId) {
+    forEachPacket<T>(workerId, numWorkers(), y0Re.size(), [&](auto packet, unsigned i) {
+      using U = decltype(packet);
+      const U t0r = in<U>(x0Re, i) + in<U>(x2Re, i);
+      const U t0i = in<U>(x0Im, i) + in<U>(x2Im, i);
+      const U t1r = in<U>(x0Re, i) - in<U>(x2Re, i);
+      const U t1i = in<U>(x0Im, i) - in<U>(x2Im, i);
+      const U t2r = in<U>(x1Re, i) + in<U>(x3Re, i);
+      const U t2i = in<U>(x1Im, i) + in<U>(x3Im, i);
+      const U t3r = in<U>(x1Re, i) - in<U>(x3Re, i);
+      const U t3i = in<U>(x1Im, i) - in<U>(x3Im, i);
+      at<U>(y0Re, i) = t0r + t2r;
+      at<U>(y0Im, i) = t0i + t2i;
+      // y1 = t1 - i * t3 and y3 = t1 + i * t3:
+      at<U>(y1Re, i) = t1r + t3i;
+      at<U>(y1Im, i) = t1i - t3r;
+      at<U>(y2Re, i) = t0r - t2r;
+      at<U>(y2Im, i) = t0i - t2i;
+      at<U>(y3Re, i) = t1r - t3i;
+      at<U>(y3Im, i) = t1i + t3r;
+    });
+    return true;
+  }
+};
+
+template class ComplexButterfly4<float>;
+template class ComplexButterfly4<half>;
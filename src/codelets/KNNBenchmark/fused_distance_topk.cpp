@@ -0,0 +1,142 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include <poplar/HalfFloat.hpp>
+#include <poplar/Vertex.hpp>
+
+#include <cmath>
+
+// Values of the metric field:
+static constexpr unsigned dotProductMetric = 0; // Score is q.v
+static constexpr unsigned l2Metric = 1;         // Score is |v|^2 - 2 q.v (rank equivalent to |q - v|^2)
+static constexpr unsigned cosineMetric = 2;     // Score is -q.v / |v| (rank equivalent to -cos(q, v))
+
+static float metricScore(unsigned metric, float dot, float norm2) {
+    if (metric == l2Metric) {
+        return norm2 - 2.f * dot;
+    }
+    if (metric == cosineMetric) {
+        return norm2 > 0.f ? -dot / std::sqrt(norm2) : 0.f;
+    }
+    return dot;
+}
+
+static void initBest(poplar::Output<poplar::Vector<float>>& scores,
+                     poplar::Output<poplar::Vector<unsigned>>& indices, unsigned index) {
+    for (unsigned i = 0; i < scores.size(); ++i) {
+        scores[i] = 3.4e38f;
+        indices[i] = index;
+    }
+}
+
+// Insert into a query's list of the best k (sorted smallest first):
+static void insertBest(float* scores, unsigned* indices, unsigned k, float score, unsigned index) {
+    if (score < scores[k - 1]) {
+        unsigned j = k - 1;
+        while (j > 0 && scores[j - 1] > score) {
+            scores[j] = scores[j - 1];
+            indices[j] = indices[j - 1];
+            --j;
+        }
+        scores[j] = score;
+        indices[j] = index;
+    }
+}
+
+// Computes the distance from every query to every vector in a block of
+// the database and keeps only the k smallest scores (and their indices)
+// for each query. This avoids ever storing the full [queries, vectors]
+// distance matrix. Queries and vectors are stored row major with dim
+// elements per row. Outputs are [queries, k] sorted from smallest to largest.
+class FusedDistanceTopK : public poplar::Vertex {
+public:
+    FusedDistanceTopK();
+
+    poplar::Input<poplar::Vector<half>> queries;
+    poplar::Input<poplar::Vector<half>> vectors;
+    poplar::Output<poplar::Vector<float>> bestScores;
+    poplar::Output<poplar::Vector<unsigned>> bestIndices;
+    unsigned dim;
+    unsigned k;
+    unsigned metric;
+    unsigned baseIndex; // Index of the first vector in the block.
+
+    bool compute() {
+        const unsigned numQueries = queries.size() / dim;
+        const unsigned numVectors = vectors.size() / dim;
+        initBest(bestScores, bestIndices, baseIndex);
+
+        for (unsigned v = 0; v < numVectors; ++v) {
+            const half* vec = &vectors[v * dim];
+            float norm2 = 0.f;
+            for (unsigned d = 0; d < dim; ++d) {
+                const float x = vec[d];
+                norm2 += x * x;
+            }
+
+            for (unsigned q = 0; q < numQueries; ++q) {
+                const half* query = &queries[q * dim];
+                float dot = 0.f;
+                for (unsigned d = 0; d < dim; ++d) {
+                    dot += float(query[d]) * float(vec[d]);
+                }
+                insertBest(&bestScores[q * k], &bestIndices[q * k], k,
+                           metricScore(metric, dot, norm2), baseIndex + v);
+            }
+        }
+        return true;
+    }
+};
+
+// The same as FusedDistanceTopK but the vectors are quantised to int8. Each
+// vector is divided into blocks of scaleBlock elements which each have their
+// own scale (so a vector's element d is vectors[d] * scales[d / scaleBlock]).
+class QuantisedDistanceTopK : public poplar::Vertex {
+public:
+    QuantisedDistanceTopK();
+
+    poplar::Input<poplar::Vector<half>> queries;
+    poplar::Input<poplar::Vector<signed char>> vectors;
+    poplar::Input<poplar::Vector<float>> scales;
+    poplar::Output<poplar::Vector<float>> bestScores;
+    poplar::Output<poplar::Vector<unsigned>> bestIndices;
+    unsigned dim;
+    unsigned k;
+    unsigned metric;
+    unsigned baseIndex; // Index of the first vector in the block.
+    unsigned scaleBlock;
+
+    bool compute() {
+        const unsigned numQueries = queries.size() / dim;
+        const unsigned numVectors = vectors.size() / dim;
+        const unsigned blocksPerVector = dim / scaleBlock;
+        initBest(bestScores, bestIndices, baseIndex);
+
+        for (unsigned v = 0; v < numVectors; ++v) {
+            const signed char* vec = &vectors[v * dim];
+            const float* vecScales = &scales[v * blocksPerVector];
+            float norm2 = 0.f;
+            for (unsigned b = 0; b < blocksPerVector; ++b) {
+                int blockNorm2 = 0;
+                for (unsigned d = b * scaleBlock; d < (b + 1) * scaleBlock; ++d) {
+                    blockNorm2 += int(vec[d]) * int(vec[d]);
+                }
+                norm2 += vecScales[b] * vecScales[b] * float(blockNorm2);
+            }
+
+            for (unsigned q = 0; q < numQueries; ++q) {
+                const half* query = &queries[q * dim];
+                float dot = 0.f;
+                for (unsigned b = 0; b < blocksPerVector; ++b) {
+                    float blockDot = 0.f;
+                    for (unsigned d = b * scaleBlock; d < (b + 1) * scaleBlock; ++d) {
+                        blockDot += float(query[d]) * float(vec[d]);
+                    }
+                    dot += vecScales[b] * blockDot;
+                }
+                insertBest(&bestScores[q * k], &bestIndices[q * k], k,
+                           metricScore(metric, dot, norm2), baseIndex + v);
+            }
+        }
+        return true;
+    }
+};
@@ -8,6 +8,7 @@ public:
 
     poplar::Input<poplar::Vector<float>> in;
     poplar::Output<float> out;
+    unsigned dummyLoops;
 
     bool compute() {
         // Simple sum to test I/O.
@@ -17,7 +18,39 @@ public:
         }
         *out = sum;
         // Additional dummy cycles to demonstrate increased compute.
-        for (int i = 0; i < 512; ++i) {
+        for (unsigned i = 0; i < dummyLoops; ++i) {
+        #pragma unroll
+          for (int j = 0; j < 1024; ++j) {
+            __asm__ volatile(
+                R"(
+                nop
+                )"
+                :
+                :
+                :"memory");
+          }
+        }
+        return true;
+    }
+};
+
+// Copies its input to its output with the same amount of dummy
+// compute as ComputeVertex. Used for the intermediate stages of a
+// multi-stage compute pipeline.
+class PassThroughVertex : public poplar::Vertex {
+public:
+    PassThroughVertex();
+
+    poplar::Input<poplar::Vector<float>> in;
+    poplar::Output<poplar::Vector<float>> out;
+    unsigned dummyLoops;
+
+    bool compute() {
+        for (unsigned i = 0; i < in.size(); ++i) {
+          out[i] = in[i];
+        }
+        // Additional dummy cycles to demonstrate increased compute.
+        for (unsigned i = 0; i < dummyLoops; ++i) {
         #pragma unroll
           for (int j = 0; j < 1024; ++j) {
             __asm__ volatile(
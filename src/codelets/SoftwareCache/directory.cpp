@@ -0,0 +1,109 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include <poplar/Vertex.hpp>
+
+static constexpr unsigned invalidEntry = 0xffffffff;
+
+// Maintains the tag directory of a set associative software cache with
+// least recently used (LRU) replacement. Each request is a line index into
+// the remote buffer. Lines map to set (line % numSets) and a resident line
+// occupies slot (set * ways + way) of the cache.
+//
+// For every request the vertex outputs the cache slot that will hold the line
+// once the fetch has completed (or invalidEntry if the request could not be
+// serviced) and it builds the list of (line, slot) pairs that need fetching.
+// Requests that miss after the fetch list is full, or that map to a set where
+// every way is already in use by the current batch, are dropped.
+//
+// Unused entries in the fetch list are padded with a copy of a valid entry
+// so that the fetch program can always transfer a fixed number of lines.
+class CacheDirectoryUpdate : public poplar::Vertex {
+public:
+    CacheDirectoryUpdate();
+
+    poplar::Input<poplar::Vector<unsigned>> requests;
+    poplar::InOut<poplar::Vector<unsigned>> tags;      // Line held in each slot (or invalidEntry).
+    poplar::InOut<poplar::Vector<unsigned>> lastUsed;  // Batch in which each slot was last used.
+    poplar::InOut<unsigned> batch;                     // Number of batches processed so far.
+    poplar::InOut<poplar::Vector<unsigned>> counts;    // Running totals of [hits, misses, dropped].
+    poplar::Output<poplar::Vector<unsigned>> slots;
+    poplar::Output<poplar::Vector<unsigned>> fetchLines;
+    poplar::Output<poplar::Vector<unsigned>> fetchSlots;
+    unsigned ways;
+
+    bool compute() {
+        const unsigned stamp = *batch + 1;
+        *batch = stamp;
+        const unsigned numSets = tags.size() / ways;
+        unsigned hits = 0;
+        unsigned misses = 0;
+        unsigned dropped = 0;
+        unsigned fetched = 0;
+
+        for (unsigned r = 0; r < requests.size(); ++r) {
+            const unsigned line = requests[r];
+            const unsigned base = (line % numSets) * ways;
+
+            unsigned slot = invalidEntry;
+            for (unsigned w = 0; w < ways; ++w) {
+                if (tags[base + w] == line) {
+                    slot = base + w;
+                    break;
+                }
+            }
+
+            if (slot != invalidEntry) {
+                hits += 1;
+                lastUsed[slot] = stamp;
+                slots[r] = slot;
+                continue;
+            }
+
+            misses += 1;
+            if (fetched == fetchLines.size()) {
+                dropped += 1;
+                slots[r] = invalidEntry;
+                continue;
+            }
+
+            // Evict the least recently used way that this batch has not touched.
+            // Empty slots have lastUsed == 0 so they are always filled first:
+            unsigned victim = invalidEntry;
+            unsigned oldest = stamp;
+            for (unsigned w = 0; w < ways; ++w) {
+                const unsigned s = base + w;
+                if (lastUsed[s] < oldest) {
+                    oldest = lastUsed[s];
+                    victim = s;
+                }
+            }
+
+            if (victim == invalidEntry) {
+                dropped += 1;
+                slots[r] = invalidEntry;
+                continue;
+            }
+
+            tags[victim] = line;
+            lastUsed[victim] = stamp;
+            fetchLines[fetched] = line;
+            fetchSlots[fetched] = victim;
+            fetched += 1;
+            slots[r] = victim;
+        }
+
+        // Pad the fetch list. With no misses re-fetch whatever slot 0 holds
+        // (if it is empty the data written there is never referenced):
+        const unsigned padLine = fetched ? fetchLines[0] : (tags[0] == invalidEntry ? 0 : tags[0]);
+        const unsigned padSlot = fetched ? fetchSlots[0] : 0;
+        for (unsigned i = fetched; i < fetchLines.size(); ++i) {
+            fetchLines[i] = padLine;
+            fetchSlots[i] = padSlot;
+        }
+
+        counts[0] += hits;
+        counts[1] += misses;
+        counts[2] += dropped;
+        return true;
+    }
+};
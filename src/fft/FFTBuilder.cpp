@@ -2,9 +2,14 @@
 
 #include "FFTBuilder.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <map>
+#include <memory>
 
+#include <gcl/Collectives.hpp>
+#include <poplar/CycleCount.hpp>
 #include <poplin/MatMul.hpp>
 #include <popops/ElementWise.hpp>
 #include <popops/Zero.hpp>
@@ -17,7 +22,7 @@ using namespace complex;
 
 ComplexTensor FFTBuilder::multiplyMatrixByVectorBatch(
     poplar::program::Sequence& fftSeq,
-    const ComplexTensor matrix, ComplexTensor vectors) {
+    std::size_t dftSize, ComplexTensor vectors) {
   // The intended use of this function is to do the matmuls for all the base FFT
   // radixes in two real matmuls by batching all the components and multiplying
   // by the FFT matrix's real and imaginary parts separately, then recombining
@@ -33,7 +38,8 @@ ComplexTensor FFTBuilder::multiplyMatrixByVectorBatch(
   auto elemType = vectors.real.elementType();
   auto numVectors = vectors.real.dim(1);
   auto debugStr = debugPrefix + "/complex_mul_mat_vec";
-  auto negIm = popops::neg(graph, vectors.imag, fftSeq, debugStr);
+  poplar::program::Sequence matmulSeq;
+  auto negIm = popops::neg(graph, vectors.imag, matmulSeq, debugStr);
 
   // Batch together all vectors that are multiplied
   // by the real part of the matrix:
@@ -43,27 +49,25 @@ ComplexTensor FFTBuilder::multiplyMatrixByVectorBatch(
   // by the imaginary part of the matrix:
   auto imagBatch = poplar::concat(negIm, vectors.real, 1);
 
-  // Build the matmuls:
-  ipu_utils::logger()->debug("DFT Re-Matmul shape: {} x {}", matrix.real.shape(), realBatch.shape());
-  ipu_utils::logger()->debug("DFT Im-Matmul shape: {} x {}", matrix.imag.shape(), imagBatch.shape());
-
   poplar::OptionFlags matmulOptions;
   if (availableMemoryProportion > 0.f) {
     matmulOptions.set("availableMemoryProportion", std::to_string(availableMemoryProportion));
   }
 
-  // Re-map the Fourier matrices here:
-  auto matmulMapping = poplin::createMatMulInputLHS(graph, elemType, matrix.shape(), realBatch.shape(),
-                                                    debugStr + "/fourier_matrix_mapping", matmulOptions);
-  graph.setTileMapping(matrix.real, graph.getTileMapping(matmulMapping));
-  graph.setTileMapping(matrix.imag, graph.getTileMapping(matmulMapping));
+  // Fourier matrices laid out for this matmul:
+  auto matrix = inverseFourierMatrices(matmulSeq, dftSize, elemType, realBatch.shape(), matmulOptions);
+
+  // Build the matmuls:
+  ipu_utils::logger()->debug("DFT Re-Matmul shape: {} x {}", matrix.real.shape(), realBatch.shape());
+  ipu_utils::logger()->debug("DFT Im-Matmul shape: {} x {}", matrix.imag.shape(), imagBatch.shape());
 
   poplar::Tensor partial =
-    poplin::matMul(graph, matrix.real, realBatch, fftSeq,
+    poplin::matMul(graph, matrix.real, realBatch, matmulSeq,
                     elemType, debugStr + "/real_matmul", matmulOptions);
 
-  poplin::matMulAcc(graph, partial, 1.f, matrix.imag, imagBatch, fftSeq,
+  poplin::matMulAcc(graph, partial, 1.f, matrix.imag, imagBatch, matmulSeq,
                     debugStr + "/imag_matmul", matmulOptions);
+  addStage(fftSeq, FFTStage::DftMatmul, matmulSeq);
 
   // FLOP estimates for matrix multiplies:
   flopEstimate += 2 * matrix.dim(0) * matrix.dim(1) * realBatch.dim(1) * 2;
@@ -72,130 +76,535 @@ ComplexTensor FFTBuilder::multiplyMatrixByVectorBatch(
 }
 
 ComplexTensor FFTBuilder::dft1d(poplar::program::Sequence& fftSeq,
-                                ComplexTensor fourierMatrix,
-                                ComplexTensor even, ComplexTensor odd) {
-  // Combine the odd and even chunks into real and imaginary batches:
-  auto real = hstack({even.real, odd.real});
-  auto imag = hstack({even.imag, odd.imag});
-  return multiplyMatrixByVectorBatch(fftSeq, fourierMatrix, ComplexTensor(real, imag));
+                                std::size_t dftSize,
+                                const std::vector<ComplexTensor>& parts) {
+  // Combine the sub-sequence chunks into real and imaginary batches:
+  std::vector<poplar::Tensor> reals, imags;
+  for (const auto& p : parts) {
+    reals.push_back(p.real);
+    imags.push_back(p.imag);
+  }
+  return multiplyMatrixByVectorBatch(fftSeq, dftSize, ComplexTensor(hstack(reals), hstack(imags)));
+}
+
+std::size_t FFTBuilder::defaultRadix(std::size_t fftSize) {
+  for (auto p : {2u, 3u, 5u}) {
+    if (fftSize % p == 0) {
+      return fftSize / p;
+    }
+  }
+  return fftSize;
+}
+
+std::vector<std::size_t> FFTBuilder::factorise(std::size_t fftSize, std::size_t radix) {
+  if (radix == 0) {
+    radix = defaultRadix(fftSize);
+  }
+  if (fftSize == 0 || fftSize % radix) {
+    throw std::runtime_error("FFT size (" + std::to_string(fftSize) +
+                             ") must be a multiple of the radix size (" + std::to_string(radix) + ").");
+  }
+
+  std::vector<std::size_t> factors;
+  auto remaining = fftSize / radix;
+  while (remaining > 1) {
+    std::size_t factor = 0;
+    for (auto p : {4u, 2u, 3u, 5u}) {
+      if (remaining % p == 0) {
+        factor = p;
+        break;
+      }
+    }
+    if (factor == 0) {
+      throw std::runtime_error("FFT size (" + std::to_string(fftSize) + ") divided by the radix size (" +
+                               std::to_string(radix) + ") must be a product of 2, 3, 4 and 5.");
+    }
+    factors.push_back(factor);
+    remaining /= factor;
+  }
+  return factors;
+}
+
+void FFTBuilder::enableStageCycleCounts(poplar::program::Sequence& initProg) {
+  if (!stageCycleCounting) {
+    stageCycles = graph.addVariable(poplar::UNSIGNED_INT, {std::size_t(FFTStage::NumStages)},
+                                    debugPrefix + "/stage_cycles");
+    graph.setTileMapping(stageCycles, 0);
+    stageCycleCounting = true;
+  }
+  popops::zero(graph, stageCycles, initProg, debugPrefix + "/zero_stage_cycles");
+}
+
+std::string FFTBuilder::stageName(FFTStage stage) {
+  switch (stage) {
+    case FFTStage::DftMatmul: return "dft_matmul";
+    case FFTStage::Twiddle: return "twiddle";
+    case FFTStage::Butterfly: return "butterfly";
+    case FFTStage::Transpose: return "transpose";
+    default: break;
+  }
+  throw std::logic_error("Invalid FFT stage.");
+}
+
+void FFTBuilder::addStage(poplar::program::Sequence& prog, FFTStage stage,
+                          const poplar::program::Program& stageProg) {
+  if (!stageCycleCounting) {
+    prog.add(stageProg);
+    return;
+  }
+
+  const auto name = debugPrefix + "/" + stageName(stage) + "_cycles";
+  poplar::program::Sequence timed{stageProg};
+  auto cycles = poplar::cycleCount(graph, timed, 0, poplar::SyncType::INTERNAL, name);
+  prog.add(timed);
+  // Accumulate the lower 32-bits of the count (stages are much shorter than 2^32 cycles):
+  const auto index = unsigned(stage);
+  popops::addInPlace(graph, stageCycles.slice(index, index + 1), cycles.slice(0, 1), prog, name + "/accumulate");
+}
+
+FFTPlan FFTBuilder::plan(const FFTPlanParams& params, FFTPlanningCache* cache) const {
+  return cache ? cache->getPlan(graph.getTarget(), params) : planFFT(graph.getTarget(), params);
 }
 
 ComplexTensor FFTBuilder::fft1d(poplar::program::Sequence& fftSeq, ComplexTensor input, std::size_t radix) {
-  // Compute the 1D-FFT by decomposing the
-  // Fourier matrix into an FFT of half the size
-  // then compute final result using Cooley-Tukey
-  // algorithm. To get the half size FT problem extract
-  // odd and even, real and imaginary, coefficients:
+  // Compute the 1D-FFT by decomposing the Fourier matrix
+  // into p FFTs of 1/p the size then compute the final
+  // result using the (mixed-radix) Cooley-Tukey algorithm.
+  // To get the smaller FT problems extract every p-th
+  // real and imaginary coefficient (for p = 2 these are
+  // the even and odd coefficients):
   const auto elemType = input.real.elementType();
 
   // This is a 1D FFT on a batch of vectors so choose
   // the correct axis for the vector length:
-  const auto batchSize = input.rank() == 1 ? 1 : input.dim(0);
-  const auto fftSize = input.rank() == 1 ? input.dim(0) : input.dim(1);
+  if (input.rank() == 1) {
+    input = ComplexTensor(input.real.expand({0}), input.imag.expand({0}));
+  }
+  const auto batchSize = input.dim(0);
+  const auto fftSize = input.dim(1);
 
   ipu_utils::logger()->debug("FFT-1D input shape: {}", input.shape());
 
-  if (fftSize % 2) {
-    throw std::logic_error("FFT size must be a multiple of 2.");
+  // Decide whether to execute a DFT or recursively apply Cooley-Tukey-FFT:
+  const auto factors = factorise(fftSize, radix);
+  if (factors.empty()) {
+    // Radix is the whole input so this is just a DFT:
+    auto result = multiplyMatrixByVectorBatch(fftSeq, fftSize, input.transpose());
+    ipu_utils::logger()->debug("DFT-1D result shape: {}", result.shape());
+    return result.transpose();
   }
-  const auto splitPoint = fftSize / 2;
 
-  complex::ComplexTensor even, odd;
-  std::tie(even, odd) = input.splitEvenOdd();
-  complex::ComplexTensor fftSubResult;
-
-  // Decide whether to execute a DFT or recursiuvely apply Cooley-Tukey-FFT:
-  if (radix == 0 || radix > splitPoint) {
-    // Radix of zero means automatically choose radix as half size of input:
-    radix = splitPoint;
+  const auto factor = factors.front();
+  const auto splitPoint = fftSize / factor;
+  radix = fftSize;
+  for (auto f : factors) {
+    radix /= f;
   }
 
+  auto parts = input.splitStrided(factor);
+  complex::ComplexTensor fftSubResult;
+
   if (splitPoint == radix) {
     // We have reached the specified radix size so
     // can finish by applying the DFT matrices (ending any
     // recursion):
-    auto invF = inverseFourierMatrices(splitPoint, elemType);
-    fftSubResult = dft1d(fftSeq, invF, even, odd);
+    fftSubResult = dft1d(fftSeq, splitPoint, parts);
     ipu_utils::logger()->debug("DFT-1D result shape: {}", fftSubResult.shape());
   } else {
-    // Recursively construct two FFTs of half the size
+    // Recursively construct FFTs of 1/factor the size
     // but fold them into a single batched call to fft1d:
-    auto recursiveInput = complex::ComplexTensor(
-      vstack({even.real, odd.real}),
-      vstack({even.imag, odd.imag})
-    );
+    std::vector<poplar::Tensor> reals, imags;
+    for (const auto& p : parts) {
+      reals.push_back(p.real);
+      imags.push_back(p.imag);
+    }
+    auto recursiveInput = complex::ComplexTensor(vstack(reals), vstack(imags));
     ipu_utils::logger()->debug("Recursive FFT-1D. Sub-problem input shape: {}", recursiveInput.shape());
     auto fftResult = fft1d(fftSeq, recursiveInput, radix);
     fftSubResult = fftResult.transpose();
     ipu_utils::logger()->debug("Sub-FFT-1D result shape: {}", fftResult.shape());
   }
 
-  // Now apply the remaining part of factorised
-  // inverse Fourier matrix to get the final
-  // result. First get the coefficients:
-  auto w = twiddleCoefficients(fftSize, elemType);
-  poputil::mapTensorLinearly(graph, w.real);
-  poputil::mapTensorLinearly(graph, w.imag);
-
   // Reconstruct the result by slicing from columns:
-  // results come out in the same even/odd order that
-  // we packed the input vectors:
-  auto result_even = fftSubResult.transpose().slice(0, batchSize, 0);
-  auto result_odd = fftSubResult.transpose().slice(batchSize, 2*batchSize, 0);
-  ipu_utils::logger()->debug("Twiddle coeff shape: {} and multiply shape: {}", w.shape(), result_odd.shape());
+  // results come out in the same order that we
+  // packed the input vectors:
+  std::vector<ComplexTensor> results;
+  for (auto j = 0u; j < factor; ++j) {
+    results.push_back(fftSubResult.transpose().slice(j * batchSize, (j + 1) * batchSize, 0));
+  }
 
   // Copy the DFT results to a linear layout if there are enough
   // elements for this to make sense (this heuristic is very approximate):
-  if (result_even.real.numElements() > graph.getTarget().getNumTiles()) {
+  if (results.front().real.numElements() > graph.getTarget().getNumTiles()) {
     ipu_utils::logger()->debug("Re-mapping DFT result ({} > {}).",
-                                result_even.real.numElements(), graph.getTarget().getNumTiles());
-    auto result_even_remapped = ComplexTensor(graph, result_even.elementType(), result_even.shape(), "dft_even_remapped");
-    result_even_remapped.mapLinearly(graph);
-    fftSeq.add(copy(result_even, result_even_remapped));
-    result_even = result_even_remapped;
+                                results.front().real.numElements(), graph.getTarget().getNumTiles());
+    poplar::program::Sequence remapSeq;
+    for (auto j = 0u; j < factor; ++j) {
+      auto remapped = ComplexTensor(graph, elemType, results[j].shape(), "dft_" + std::to_string(j) + "_remapped");
+      remapped.mapLinearly(graph);
+      remapSeq.add(copy(results[j], remapped));
+      results[j] = remapped;
+    }
+    addStage(fftSeq, FFTStage::Transpose, remapSeq);
+  }
 
-    auto result_odd_remapped = ComplexTensor(graph, result_even.elementType(), result_even.shape(), "dft_even_remapped");
-    result_odd_remapped.mapLinearly(graph);
-    fftSeq.add(copy(result_odd, result_odd_remapped));
-    result_odd = result_odd_remapped;
+  // Now apply the remaining part of factorised
+  // inverse Fourier matrix to get the final result.
+  // Element-wise multiply all but the first sub-result
+  // by their twiddle coefficients:
+  auto twiddlePrefix = debugPrefix + "/twiddle";
+  if (fusedComplexVertices && factor == 2) {
+    // The twiddle multiply and the butterfly are a single vertex:
+    poplar::program::Sequence butterflySeq;
+    auto w = twiddleCoefficients(butterflySeq, fftSize, 1, splitPoint, elemType);
+    auto y = complex::butterfly2Fused(graph, results[0], results[1], w, butterflySeq, twiddlePrefix);
+    addStage(fftSeq, FFTStage::Butterfly, butterflySeq);
+    // FLOP estimate for the complex multiply and element-wise ops:
+    flopEstimate += 6 * results[1].real.numElements() + 4 * results[0].real.numElements();
+    return ComplexTensor(
+      poplar::concat(y.first.real, y.second.real, 1),
+      poplar::concat(y.first.imag, y.second.imag, 1)
+    );
   }
 
-  // Element-wise multiply odd components by coefficients:
+  poplar::program::Sequence twiddleSeq;
+  for (auto j = 1u; j < factor; ++j) {
+    auto w = twiddleCoefficients(twiddleSeq, fftSize, j, splitPoint, elemType);
+    ipu_utils::logger()->debug("Twiddle coeff shape: {} and multiply shape: {}", w.shape(), results[j].shape());
+    if (fusedComplexVertices) {
+      complex::multiplyInPlaceFused(graph, results[j], w, twiddleSeq, twiddlePrefix);
+    } else {
+      results[j].multiplyInPlace(graph, w, twiddleSeq, twiddlePrefix);
+    }
+    // FLOP estimate for complex multiply:
+    flopEstimate += 6 * results[j].real.numElements();
+  }
+  addStage(fftSeq, FFTStage::Twiddle, twiddleSeq);
+
+  poplar::program::Sequence butterflySeq;
+  auto result = butterflies(butterflySeq, results);
+  addStage(fftSeq, FFTStage::Butterfly, butterflySeq);
+  return result;
+}
+
+ComplexTensor FFTBuilder::butterflies(poplar::program::Sequence& fftSeq,
+                                      const std::vector<ComplexTensor>& parts) {
+  // Combine the twiddled sub-results X_j with a DFT of size p across
+  // the parts: output chunk q is Y_q = sum_j(X_j * exp(-2 pi i j q / p)).
+  // The output chunks are concatenated to form the result.
   auto twiddlePrefix = debugPrefix + "/twiddle";
-  result_odd.multiplyInPlace(graph, w, fftSeq, twiddlePrefix);
-  auto tmp = result_odd;
-  // FLOP estimate for complex multiply:
-  flopEstimate += 6 * tmp.real.numElements();
-
-  // Elementwise add for the twiddles (butterflies):
-  poplar::Tensor lowerRe =
-    popops::add(graph, result_even.real, tmp.real,
-                fftSeq, twiddlePrefix + "/lower_real");
-  poplar::Tensor lowerIm =
-    popops::add(graph, result_even.imag, tmp.imag,
-                fftSeq, twiddlePrefix + "/lower_imag");
-  poplar::Tensor upperRe =
-    popops::sub(graph, result_even.real, tmp.real,
-                fftSeq, twiddlePrefix + "/upper_real");
-  poplar::Tensor upperIm =
-    popops::sub(graph, result_even.imag, tmp.imag,
-                fftSeq, twiddlePrefix + "/upper_imag");
-
-  // FLOP estimate for element-wise ops:
-  flopEstimate += 4 * tmp.real.numElements();
-
-  return ComplexTensor(
-    poplar::concat(lowerRe, upperRe, 1),
-    poplar::concat(lowerIm, upperIm, 1)
+  const auto numElements = parts.front().real.numElements();
+
+  if (parts.size() == 2) {
+    const auto& even = parts[0];
+    const auto& odd = parts[1];
+    // Elementwise add for the twiddles (butterflies):
+    poplar::Tensor lowerRe =
+      popops::add(graph, even.real, odd.real,
+                  fftSeq, twiddlePrefix + "/lower_real");
+    poplar::Tensor lowerIm =
+      popops::add(graph, even.imag, odd.imag,
+                  fftSeq, twiddlePrefix + "/lower_imag");
+    poplar::Tensor upperRe =
+      popops::sub(graph, even.real, odd.real,
+                  fftSeq, twiddlePrefix + "/upper_real");
+    poplar::Tensor upperIm =
+      popops::sub(graph, even.imag, odd.imag,
+                  fftSeq, twiddlePrefix + "/upper_imag");
+
+    // FLOP estimate for element-wise ops:
+    flopEstimate += 4 * numElements;
+
+    return ComplexTensor(
+      poplar::concat(lowerRe, upperRe, 1),
+      poplar::concat(lowerIm, upperIm, 1)
+    );
+  }
+
+  if (parts.size() == 4 && fusedComplexVertices) {
+    auto y = complex::butterfly4Fused(graph, parts, fftSeq, twiddlePrefix + "/radix4");
+    flopEstimate += 16 * numElements;
+    return ComplexTensor(
+      poplar::concat({y[0].real, y[1].real, y[2].real, y[3].real}, 1),
+      poplar::concat({y[0].imag, y[1].imag, y[2].imag, y[3].imag}, 1)
+    );
+  }
+
+  if (parts.size() == 4) {
+    // Radix-4 butterflies only need additions because the
+    // coefficients are all +/-1 or +/-i:
+    auto add = [&](const poplar::Tensor& a, const poplar::Tensor& b, const std::string& name) {
+      return popops::add(graph, a, b, fftSeq, twiddlePrefix + "/" + name);
+    };
+    auto sub = [&](const poplar::Tensor& a, const poplar::Tensor& b, const std::string& name) {
+      return popops::sub(graph, a, b, fftSeq, twiddlePrefix + "/" + name);
+    };
+    auto t0Re = add(parts[0].real, parts[2].real, "t0_real");
+    auto t0Im = add(parts[0].imag, parts[2].imag, "t0_imag");
+    auto t1Re = sub(parts[0].real, parts[2].real, "t1_real");
+    auto t1Im = sub(parts[0].imag, parts[2].imag, "t1_imag");
+    auto t2Re = add(parts[1].real, parts[3].real, "t2_real");
+    auto t2Im = add(parts[1].imag, parts[3].imag, "t2_imag");
+    auto t3Re = sub(parts[1].real, parts[3].real, "t3_real");
+    auto t3Im = sub(parts[1].imag, parts[3].imag, "t3_imag");
+
+    // Y1 = t1 - i * t3 and Y3 = t1 + i * t3:
+    std::vector<poplar::Tensor> outRe = {
+      add(t0Re, t2Re, "y0_real"), add(t1Re, t3Im, "y1_real"),
+      sub(t0Re, t2Re, "y2_real"), sub(t1Re, t3Im, "y3_real")
+    };
+    std::vector<poplar::Tensor> outIm = {
+      add(t0Im, t2Im, "y0_imag"), sub(t1Im, t3Re, "y1_imag"),
+      sub(t0Im, t2Im, "y2_imag"), add(t1Im, t3Re, "y3_imag")
+    };
+
+    // FLOP estimate for element-wise ops:
+    flopEstimate += 16 * numElements;
+
+    return ComplexTensor(poplar::concat(outRe, 1), poplar::concat(outIm, 1));
+  }
+
+  // General radix: each output is a single element-wise expression over the
+  // real and imaginary parts of all the sub-results (placeholders 1..p hold
+  // the real parts and p+1..2p the imaginary parts):
+  namespace pe = popops::expr;
+  const auto p = parts.size();
+  std::vector<poplar::Tensor> args;
+  for (const auto& x : parts) { args.push_back(x.real); }
+  for (const auto& x : parts) { args.push_back(x.imag); }
+
+  const double twoPi_over_p = (2.0L / p) * 3.141592653589793238462643383279502884L;
+  std::vector<poplar::Tensor> outRe, outIm;
+  for (auto q = 0u; q < p; ++q) {
+    std::unique_ptr<pe::Expr> re = pe::PlaceHolder(1).clone();
+    std::unique_ptr<pe::Expr> im = pe::PlaceHolder(p + 1).clone();
+    for (auto j = 1u; j < p; ++j) {
+      // (a + ib)(c + is) = (ac - bs) + i(as + bc):
+      const float c = std::cos(twoPi_over_p * ((j * q) % p));
+      const float s = -std::sin(twoPi_over_p * ((j * q) % p));
+      const auto a = pe::PlaceHolder(j + 1);
+      const auto b = pe::PlaceHolder(p + j + 1);
+      re = pe::Add(*re, pe::Sub(pe::Mul(pe::Const(c), a), pe::Mul(pe::Const(s), b))).clone();
+      im = pe::Add(*im, pe::Add(pe::Mul(pe::Const(s), a), pe::Mul(pe::Const(c), b))).clone();
+    }
+    const auto name = twiddlePrefix + "/radix" + std::to_string(p) + "_y" + std::to_string(q);
+    outRe.push_back(popops::map(graph, *re, args, fftSeq, name + "_real"));
+    outIm.push_back(popops::map(graph, *im, args, fftSeq, name + "_imag"));
+  }
+
+  // FLOP estimate: each output element needs p - 1 complex multiply-adds
+  // by constants (4 multiplies and 4 additions each):
+  flopEstimate += 8 * (p - 1) * p * numElements;
+
+  return ComplexTensor(poplar::concat(outRe, 1), poplar::concat(outIm, 1));
+}
+
+std::size_t FFTBuilder::nextFastSize(std::size_t n) {
+  for (auto size = std::max<std::size_t>(n, 1); ; ++size) {
+    auto remaining = size;
+    for (auto p : {2u, 3u, 5u}) {
+      while (remaining % p == 0) {
+        remaining /= p;
+      }
+    }
+    if (remaining == 1) {
+      return size;
+    }
+  }
+}
+
+void FFTBuilder::scaleInPlace(poplar::program::Sequence& prog, ComplexTensor& t, float scale) {
+  namespace pe = popops::expr;
+  auto expr = pe::Mul(pe::_1, pe::Const(scale));
+  popops::mapInPlace(graph, expr, {t.real}, prog, debugPrefix + "/scale_real");
+  popops::mapInPlace(graph, expr, {t.imag}, prog, debugPrefix + "/scale_imag");
+  flopEstimate += 2 * t.real.numElements();
+}
+
+ComplexTensor FFTBuilder::ifft1d(poplar::program::Sequence& fftSeq, ComplexTensor input,
+                                 std::size_t radix, bool normalise) {
+  auto result = swapParts(fft1d(fftSeq, swapParts(input), radix));
+  if (normalise) {
+    scaleInPlace(fftSeq, result, 1.f / result.dim(1));
+  }
+  return result;
+}
+
+ComplexTensor FFTBuilder::convolve1d(poplar::program::Sequence& prog,
+                                     ComplexTensor signal, ComplexTensor kernel,
+                                     bool correlate, std::size_t fftSize, std::size_t radix) {
+  if (signal.rank() == 1) {
+    signal = ComplexTensor(signal.real.expand({0}), signal.imag.expand({0}));
+  }
+  if (kernel.rank() == 1) {
+    kernel = ComplexTensor(kernel.real.expand({0}), kernel.imag.expand({0}));
+  }
+  if (signal.rank() != 2 || kernel.rank() != 2) {
+    throw std::runtime_error("convolve1d only supports vectors and batches of vectors.");
+  }
+
+  const auto elemType = signal.elementType();
+  const auto batchSize = signal.dim(0);
+  const auto kernelBatchSize = kernel.dim(0);
+  if (kernelBatchSize != 1 && kernelBatchSize != batchSize) {
+    throw std::runtime_error("The kernel batch-size must be 1 or match the signal batch-size.");
+  }
+
+  const auto signalSize = signal.dim(1);
+  const auto kernelSize = kernel.dim(1);
+  const auto linearSize = signalSize + kernelSize - 1;
+  if (fftSize == 0) {
+    fftSize = nextFastSize(linearSize);
+  }
+  if (fftSize < std::max(signalSize, kernelSize)) {
+    throw std::runtime_error("The FFT size (" + std::to_string(fftSize) +
+                             ") must be at least the signal and kernel sizes.");
+  }
+  if (fftSize < linearSize) {
+    ipu_utils::logger()->warn("FFT size {} is less than {}: result will be a circular {}.",
+                              fftSize, linearSize, correlate ? "correlation" : "convolution");
+  }
+  ipu_utils::logger()->info("Building FFT {} of signal shape {} with kernel shape {} (FFT size {}).",
+                            correlate ? "correlation" : "convolution", signal.shape(), kernel.shape(), fftSize);
+
+  // Zero pad with a broadcast of a single constant:
+  auto zero = graph.addConstant(elemType, {1, 1}, 0.f, debugPrefix + "/conv_zero");
+  graph.setTileMapping(zero, 0);
+  auto pad = [&](const ComplexTensor& t) {
+    if (t.dim(1) == fftSize) {
+      return t;
+    }
+    auto zeros = zero.broadcast(t.dim(0), 0).broadcast(fftSize - t.dim(1), 1);
+    return ComplexTensor(poplar::concat(t.real, zeros, 1), poplar::concat(t.imag, zeros, 1));
+  };
+
+  // FLOPs counted while building a graph function are for a single call:
+  const auto flopsBefore = flopEstimate;
+  auto fftFunc = fft1dMakeGraphFunction(radix, elemType, {batchSize, fftSize});
+  const auto callFlops = flopEstimate - flopsBefore;
+  auto signalSpectrum = ComplexTensor(graph, elemType, {batchSize, fftSize}, debugPrefix + "/signal_spectrum");
+  signalSpectrum.mapLinearly(graph);
+  auto paddedSignal = pad(signal);
+  prog.add(fftFunc(paddedSignal, signalSpectrum));
+  // Forward transform of the signals and inverse of the products:
+  std::size_t fftCalls = 2;
+
+  auto kernelSpectrum = ComplexTensor(graph, elemType, {kernelBatchSize, fftSize}, debugPrefix + "/kernel_spectrum");
+  kernelSpectrum.mapLinearly(graph);
+  auto paddedKernel = pad(kernel);
+  std::size_t kernelFlops = 0;
+  if (kernelBatchSize == batchSize) {
+    prog.add(fftFunc(paddedKernel, kernelSpectrum));
+    fftCalls += 1;
+  } else {
+    const auto before = flopEstimate;
+    auto kernelFunc = fft1dMakeGraphFunction(radix, elemType, {1, fftSize});
+    kernelFlops = flopEstimate - before;
+    prog.add(kernelFunc(paddedKernel, kernelSpectrum));
+    kernelSpectrum = ComplexTensor(kernelSpectrum.real.broadcast(batchSize, 0),
+                                   kernelSpectrum.imag.broadcast(batchSize, 0));
+  }
+
+  // Pointwise product of the spectra with the inverse FFT's 1/N folded in:
+  auto product = multiply(graph, signalSpectrum, kernelSpectrum, 1.f / fftSize, correlate,
+                          prog, debugPrefix + (correlate ? "/correlate" : "/convolve"));
+
+  // Inverse transform in-place (see ifft1d()): after the call the swapped
+  // view holds fft(swap(product)) so product itself holds the inverse:
+  auto swapped = swapParts(product);
+  prog.add(fftFunc(swapped, swapped));
+
+  // FLOP estimate for the complex multiply and scale:
+  flopEstimate = flopsBefore + fftCalls * callFlops + kernelFlops + 8 * product.real.numElements();
+
+  if (fftSize < linearSize) {
+    return product;
+  }
+
+  if (!correlate) {
+    return product.slice(0, linearSize, 1);
+  }
+
+  // Move the negative lags (which wrap around to the end) to the front:
+  auto lags = [&](const poplar::Tensor& t) {
+    return poplar::concat(t.slice(fftSize - (kernelSize - 1), fftSize, 1), t.slice(0, signalSize, 1), 1);
+  };
+  return ComplexTensor(lags(product.real), lags(product.imag));
+}
+
+ComplexTensor FFTBuilder::rfft1d(poplar::program::Sequence& fftSeq, poplar::Tensor input, std::size_t radix) {
+  if (input.rank() == 1) {
+    input = input.expand({0});
+  }
+  if (input.rank() != 2) {
+    throw std::logic_error("rfft1d only supports vectors and batches of vectors.");
+  }
+  const auto elemType = input.elementType();
+  const auto fftSize = input.dim(1);
+  if (fftSize % 2) {
+    throw std::runtime_error("Real FFT size must be a multiple of 2.");
+  }
+  const auto halfSize = fftSize / 2;
+
+  // Pack the real signal x into z[n] = x[2n] + i x[2n+1] (these
+  // are just views of the input so no copies are needed) and
+  // compute the half size complex FFT Z:
+  auto packed = ComplexTensor(input.subSample(2, 1), input.slice(1, fftSize, 1).subSample(2, 1));
+  ipu_utils::logger()->debug("Real FFT-1D input shape: {} packed shape: {}", input.shape(), packed.shape());
+  auto z = fft1d(fftSeq, packed, radix);
+
+  // Separate the transforms of the even and odd samples:
+  //   E[k] = (Z[k] + conj(Z[M-k])) / 2
+  //   O[k] = (Z[k] - conj(Z[M-k])) / 2i
+  // then combine them: X[k] = E[k] + exp(-2 pi i k / N) O[k]
+  // for k in [0, M] (where M = N/2 and Z[M] = Z[0]):
+  auto extended = [&](const poplar::Tensor& t) {
+    return poplar::concat(t, t.slice(0, 1, 1), 1);
+  };
+  auto reversed = [&](const poplar::Tensor& t) {
+    std::vector<poplar::Tensor> parts = {t.slice(0, 1, 1)};
+    if (halfSize > 1) {
+      parts.push_back(t.slice(1, halfSize, 1).reverse(1));
+    }
+    parts.push_back(t.slice(0, 1, 1));
+    return poplar::concat(parts, 1);
+  };
+
+  poplar::program::Sequence twiddleSeq;
+  auto w = twiddleCoefficients(twiddleSeq, fftSize, 1, halfSize + 1, elemType);
+
+  // Placeholders: Z[k] = _1 + i _2, Z[M-k] = _3 + i _4, twiddle = _5 + i _6:
+  namespace pe = popops::expr;
+  const auto half = pe::Const(0.5f);
+  const auto sumRe = pe::Add(pe::_1, pe::_3);
+  const auto sumIm = pe::Add(pe::_2, pe::_4);
+  const auto diffRe = pe::Sub(pe::_3, pe::_1);
+  const auto diffIm = pe::Sub(pe::_2, pe::_4);
+  const auto exprRe = pe::Mul(half, pe::Sub(pe::Add(sumRe, pe::Mul(pe::_5, sumIm)), pe::Mul(pe::_6, diffRe)));
+  const auto exprIm = pe::Mul(half, pe::Add(pe::Add(diffIm, pe::Mul(pe::_5, diffRe)), pe::Mul(pe::_6, sumIm)));
+
+  const std::vector<poplar::Tensor> args = {
+    extended(z.real), extended(z.imag), reversed(z.real), reversed(z.imag), w.real, w.imag
+  };
+  auto prefix = debugPrefix + "/real_fft_twiddle";
+  auto result = ComplexTensor(
+    popops::map(graph, exprRe, args, twiddleSeq, prefix + "/real"),
+    popops::map(graph, exprIm, args, twiddleSeq, prefix + "/imag")
   );
+  addStage(fftSeq, FFTStage::Twiddle, twiddleSeq);
+
+  // FLOP estimate for the element-wise ops (8 per output component):
+  flopEstimate += 16 * result.real.numElements();
+
+  return result;
 }
 
 poplar::program::Program
 FFTBuilder::FunctionClosure::operator () (ComplexTensor& argIn,ComplexTensor& argOut) {
   poplar::program::Sequence seq;
-  seq.add(copy(argIn, input));
+  builder->addStage(seq, FFTStage::Transpose, copy(argIn, input));
   seq.add(poplar::program::Call(function));
-  seq.add(copy(output, argOut));
+  builder->addStage(seq, FFTStage::Transpose, copy(output, argOut));
   return seq;
 }
 
@@ -209,13 +618,39 @@ FFTBuilder::fft1dMakeGraphFunction(std::size_t radix,
   functionInput.mapLinearly(graph);
   auto functionOutput = fft1d(fft1dSeq, functionInput, radix);
   auto fft1dFunc = graph.addFunction(fft1dSeq);
-  return FunctionClosure{fft1dFunc, functionInput, functionOutput};
+  return FunctionClosure{fft1dFunc, functionInput, functionOutput, this};
+}
+
+poplar::program::Program
+FFTBuilder::RealFunctionClosure::operator () (poplar::Tensor& argIn, ComplexTensor& argOut) {
+  poplar::program::Sequence seq;
+  builder->addStage(seq, FFTStage::Transpose, poplar::program::Copy(argIn, input));
+  seq.add(poplar::program::Call(function));
+  builder->addStage(seq, FFTStage::Transpose, copy(output, argOut));
+  return seq;
+}
+
+FFTBuilder::RealFunctionClosure
+FFTBuilder::rfft1dMakeGraphFunction(std::size_t radix,
+                                     poplar::Type elementType,
+                                     const std::vector<std::size_t>& shape) {
+  poplar::program::Sequence rfft1dSeq;
+  auto functionInput = graph.addVariable(elementType, shape, debugPrefix + "/rfft1d_fn_input");
+  poputil::mapTensorLinearly(graph, functionInput);
+  auto functionOutput = rfft1d(rfft1dSeq, functionInput, radix);
+  auto rfft1dFunc = graph.addFunction(rfft1dSeq);
+  return RealFunctionClosure{rfft1dFunc, functionInput, functionOutput, this};
 }
 
 ComplexTensor FFTBuilder::fft2d(poplar::program::Sequence& prog, ComplexTensor input, std::size_t radix, std::size_t serialisationFactor) {
 
+  if (input.rank() == 3) {
+    // Batch of matrices:
+    return fftnd(prog, input, 2, radix, serialisationFactor);
+  }
+
   if (input.rank() != 2) {
-    throw std::runtime_error("fft2d only supports inputs with rank 2 and batch-size 1 (i.e. a single matrix).");
+    throw std::runtime_error("fft2d only supports inputs with rank 2 (a single matrix) or rank 3 (a batch of matrices).");
   }
 
   if (input.dim(0) != input.dim(1)) {
@@ -234,13 +669,19 @@ ComplexTensor FFTBuilder::fft2d(poplar::program::Sequence& prog, ComplexTensor i
   std::size_t rowsPerCall = input.dim(0) / serialisationFactor;
 
   // Make a graph function that can be called to process each slice of the input with a 1D-FFT:
+  const auto flopsBefore = flopEstimate;
   auto fft1dFunc = fft1dMakeGraphFunction(radix, input.elementType(), {rowsPerCall, input.dim(1)});
-  ipu_utils::logger()->info("FFT-2D input shape: {}", input.shape());
+  ipu_utils::logger()->info("FFT-2D input shape: {}{}", input.shape(), overlappedSerialisation ? " (overlapped chunks)" : "");
   ipu_utils::logger()->debug("Serialised FFT input shape: {} serialisation-factor: {}", fft1dFunc.input.shape(), serialisationFactor);
-  ipu_utils::logger()->debug("Serialised FFT FLOPS per call: {}", flopEstimate);
+  const auto callFlops = flopEstimate - flopsBefore;
+  ipu_utils::logger()->debug("Serialised FFT FLOPS per call: {}", callFlops);
 
   // FLOP estimates have been accumulated by the fft1d: account for the number of calls:
-  flopEstimate *= 2 * serialisationFactor;
+  flopEstimate = flopsBefore + callFlops * 2 * serialisationFactor;
+
+  if (overlappedSerialisation) {
+    return fft2dOverlapped(prog, input, fft1dFunc, rowsPerCall, serialisationFactor);
+  }
 
   // 2D FFT is done in-place in two passes:
 
@@ -265,45 +706,346 @@ ComplexTensor FFTBuilder::fft2d(poplar::program::Sequence& prog, ComplexTensor i
   return input.transpose();
 }
 
-ComplexTensor FFTBuilder::inverseFourierMatrices(
-    std::size_t length, poplar::Type elemType) {
-  const double twoPi_over_length = (2.0L / length) * 3.141592653589793238462643383279502884L;
-  std::vector<float> real(length * length, 0.f);
-  std::vector<float> imag(length * length, 0.f);
-  for (std::size_t row = 0; row < length; ++row) {
-    for (std::size_t col = 0; col < length; ++col) {
-      real[row * length + col] = std::cos(twoPi_over_length * col * row);
-      imag[row * length + col] = -std::sin(twoPi_over_length * col * row);
+ComplexTensor FFTBuilder::fft2dOverlapped(poplar::program::Sequence& prog, ComplexTensor input,
+                                          FunctionClosure& fft1dFunc, std::size_t rowsPerCall,
+                                          std::size_t serialisationFactor) {
+  // Chunk t of the schedule: the row chunks followed by the column
+  // chunks (transposed views so no rearrangement is needed). Each
+  // chunk's result overwrites its input:
+  auto columns = input.transpose();
+  std::vector<ComplexTensor> chunks;
+  for (auto i = 0u; i < serialisationFactor; ++i) {
+    chunks.push_back(input.slice(i * rowsPerCall, (i + 1) * rowsPerCall, 0));
+  }
+  for (auto i = 0u; i < serialisationFactor; ++i) {
+    chunks.push_back(columns.slice(i * rowsPerCall, (i + 1) * rowsPerCall, 0));
+  }
+
+  // Between calls the result of chunk t is copied out and the input of chunk
+  // t+1 copied in by a single copy program, so the two transfers share one
+  // exchange phase. The function's output tensor holds chunk t's result while
+  // its input tensor receives chunk t+1 (so together they double buffer the
+  // chunks):
+  auto& fnIn = fft1dFunc.input;
+  auto& fnOut = fft1dFunc.output;
+  addStage(prog, FFTStage::Transpose, copy(chunks.front(), fnIn));
+  for (auto t = 0u; t < chunks.size(); ++t) {
+    prog.add(poplar::program::Call(fft1dFunc.function));
+    if (t + 1 == chunks.size()) {
+      addStage(prog, FFTStage::Transpose, copy(fnOut, chunks[t]));
+      break;
+    }
+
+    auto next = chunks[t + 1];
+    if (t + 1 == serialisationFactor) {
+      // The first column chunk depends on the last row chunk which is still in
+      // the function's output: read that part of the columns (transposed)
+      // directly from the output instead of waiting for it to be copied back:
+      auto fromOutput = fnOut.transpose().slice(0, rowsPerCall, 0);
+      const auto rowsInInput = t * rowsPerCall;
+      if (rowsInInput == 0) {
+        next = fromOutput;
+      } else {
+        next = ComplexTensor(poplar::concat(next.real.slice(0, rowsInInput, 1), fromOutput.real, 1),
+                             poplar::concat(next.imag.slice(0, rowsInInput, 1), fromOutput.imag, 1));
+      }
     }
+    addStage(prog, FFTStage::Transpose, copy({fnOut, next}, {chunks[t], fnIn}));
   }
 
-  auto reInvF =
-    graph.addConstant<float>(elemType, {length, length}, real);
-  auto imInvF =
-    graph.addConstant<float>(elemType, {length, length}, imag);
+  return input;
+}
+
+ComplexTensor FFTBuilder::fftnd(poplar::program::Sequence& prog, ComplexTensor input,
+                                std::size_t dimensions, std::size_t radix, std::size_t serialisationFactor) {
+  const auto rank = input.rank();
+  if (dimensions == 0 || rank < dimensions) {
+    throw std::runtime_error("Can not compute a " + std::to_string(dimensions) +
+                             "D-FFT of an input of rank " + std::to_string(rank) + ".");
+  }
+  ipu_utils::logger()->info("FFT-{}D input shape: {} serialisation-factor: {}",
+                            dimensions, input.shape(), serialisationFactor);
+
+  // Graph functions (and the FLOPs counted for one call) by chunk shape:
+  std::map<std::pair<std::size_t, std::size_t>, std::pair<FunctionClosure, std::size_t>> functions;
+  const auto flopsBefore = flopEstimate;
+  std::size_t totalFlops = 0;
+
+  for (auto axis = unsigned(rank - dimensions); axis < rank; ++axis) {
+    // Move the axis to the end and flatten the others into a batch of vectors
+    // (these are all views so the transpose happens in the chunk copies):
+    std::vector<unsigned> permutation;
+    for (auto d = 0u; d < rank; ++d) {
+      if (d != axis) {
+        permutation.push_back(d);
+      }
+    }
+    permutation.push_back(axis);
+    const auto length = input.dim(axis);
+    const auto numVectors = input.real.numElements() / length;
+    if (numVectors % serialisationFactor) {
+      std::stringstream ss;
+      ss << "The number of vectors along axis " << axis << " (" << numVectors
+         << ") must be divisible by the serialisation factor (" << serialisationFactor << ")";
+      ipu_utils::logger()->error(ss.str());
+      throw std::runtime_error(ss.str());
+    }
+    auto vectors = ComplexTensor(input.real.dimShuffle(permutation).reshape({numVectors, length}),
+                                 input.imag.dimShuffle(permutation).reshape({numVectors, length}));
 
-  return ComplexTensor(reInvF, imInvF);
+    const auto perCall = numVectors / serialisationFactor;
+    const auto key = std::make_pair(perCall, length);
+    auto found = functions.find(key);
+    if (found == functions.end()) {
+      const auto before = flopEstimate;
+      auto function = fft1dMakeGraphFunction(radix, input.elementType(), {perCall, length});
+      found = functions.insert(std::make_pair(key, std::make_pair(function, flopEstimate - before))).first;
+    }
+
+    auto& fft1dFunc = found->second.first;
+    for (auto i = 0u; i < serialisationFactor; ++i) {
+      auto chunk = vectors.slice(i * perCall, (i + 1) * perCall, 0);
+      prog.add(fft1dFunc(chunk, chunk));
+    }
+    totalFlops += found->second.second * serialisationFactor;
+  }
+
+  flopEstimate = flopsBefore + totalFlops;
+  return input;
 }
 
-ComplexTensor FFTBuilder::twiddleCoefficients(std::size_t N, poplar::Type elemType) {
-  // Return the complex coeeficients that recombine the partial results
-  // of the FFT (I.e. coefficients that appear in left hand side of the
-  // inverse Fourier matrix's FFT factorization).
-  if (N % 2) {
-    throw std::logic_error("FFT size must be a multiple of 2.");
+ComplexTensor FFTBuilder::distributedTranspose(poplar::program::Sequence& prog, ComplexTensor local) {
+  const auto replicas = graph.getReplicationFactor();
+  const auto blockSize = local.dim(0);
+  const auto size = local.dim(1);
+  if (blockSize * replicas != size) {
+    throw std::runtime_error("Distributed FFT: each replica must hold size / replicas rows.");
   }
-  auto baseSize = N / 2;
-  const double s = ((2.0L * (N-1)) / N) * 3.141592653589793238462643383279502884L;
-  std::vector<float> real(baseSize, 0.f);
-  std::vector<float> imag(baseSize, 0.f);
 
-  for (auto n = 0u; n < baseSize; ++n) {
-    real[n] = std::cos(s * n);
-    imag[n] = std::sin(s * n);
+  // Split the local rows into one square block per replica: block j holds
+  // columns [j * b, (j + 1) * b) and is sent to replica j. Real and imaginary
+  // parts are exchanged together in a single all-to-all of shape [R, 2, b, b]:
+  auto blocks = [&](const poplar::Tensor& t) {
+    return t.reshape({blockSize, replicas, blockSize}).dimShuffle({1, 0, 2}).expand({1});
+  };
+  auto send = poplar::concat(blocks(local.real), blocks(local.imag), 1);
+  poplar::program::Sequence transposeSeq;
+  auto received = gcl::allToAllCrossReplica(graph, send, transposeSeq, gcl::CommGroup(),
+                                            debugPrefix + "/distributed_transpose");
+  addStage(prog, FFTStage::Transpose, transposeSeq);
+
+  // Block i came from replica i so holds rows [i * b, (i + 1) * b) of this
+  // replica's columns. Stacking them gives the columns as [N, b]:
+  auto columns = [&](unsigned part) {
+    return received.slice(part, part + 1, 1).reshape({size, blockSize}).transpose();
+  };
+  return ComplexTensor(columns(0), columns(1));
+}
+
+ComplexTensor FFTBuilder::fft2dDistributed(poplar::program::Sequence& prog, ComplexTensor input,
+                                           std::size_t radix, bool transposedOutput) {
+  if (input.rank() != 2) {
+    throw std::runtime_error("fft2dDistributed needs a rank 2 input (each replica's block of rows).");
   }
+  ipu_utils::logger()->info("Distributed FFT-2D of size {} over {} replicas (local shape: {})",
+                            input.dim(1), graph.getReplicationFactor(), input.shape());
 
-  return ComplexTensor(
-    graph.addConstant<float>(elemType, {baseSize}, real),
-    graph.addConstant<float>(elemType, {baseSize}, imag)
-  );
+  // Rows, then columns after the distributed transpose:
+  auto rows = fft1d(prog, input, radix);
+  auto columns = fft1d(prog, distributedTranspose(prog, rows), radix);
+  return transposedOutput ? columns : distributedTranspose(prog, columns);
+}
+
+ComplexTensor FFTBuilder::ifft2d(poplar::program::Sequence& prog, ComplexTensor input, std::size_t radix,
+                                 std::size_t serialisationFactor, bool normalise) {
+  auto result = swapParts(fft2d(prog, swapParts(input), radix, serialisationFactor));
+  if (normalise) {
+    scaleInPlace(prog, result, 1.f / result.real.numElements());
+  }
+  return result;
+}
+
+ComplexTensor FFTBuilder::rfft2d(poplar::program::Sequence& prog, poplar::Tensor input, std::size_t radix, std::size_t serialisationFactor) {
+  if (input.rank() != 2) {
+    throw std::runtime_error("rfft2d only supports inputs with rank 2 and batch-size 1 (i.e. a single matrix).");
+  }
+
+  if (input.dim(1) % 2) {
+    throw std::runtime_error("rfft2d only supports matrices with an even number of columns.");
+  }
+
+  if (input.dim(0) % serialisationFactor) {
+    std::stringstream ss;
+    ss << "The number of rows in the input (" << input.dim(0)
+        << ") must be divisible by the serialisation factor (" << serialisationFactor << ")";
+    ipu_utils::logger()->error(ss.str());
+    throw std::runtime_error(ss.str());
+  }
+
+  const auto rows = input.dim(0);
+  const auto bins = input.dim(1) / 2 + 1;
+  const auto rowsPerCall = rows / serialisationFactor;
+  ipu_utils::logger()->info("Real FFT-2D input shape: {}", input.shape());
+
+  // FLOPs counted while building each graph function are for a single call:
+  const auto flopsBefore = flopEstimate;
+  auto rfft1dFunc = rfft1dMakeGraphFunction(radix, input.elementType(), {rowsPerCall, input.dim(1)});
+  const auto rowFlops = flopEstimate - flopsBefore;
+
+  auto output = ComplexTensor(graph, input.elementType(), {rows, bins}, debugPrefix + "/rfft2d_output");
+  output.mapLinearly(graph);
+
+  // First pass: real 1D FFT of each row written to the output:
+  for (auto i = 0u; i < serialisationFactor; ++i) {
+    auto inRows = input.slice(i * rowsPerCall, (i + 1) * rowsPerCall, 0);
+    auto outRows = output.slice(i * rowsPerCall, (i + 1) * rowsPerCall, 0);
+    prog.add(rfft1dFunc(inRows, outRows));
+  }
+
+  // Second pass: complex 1D FFT (in-place) of each column of non-redundant
+  // bins. The number of bins is odd so the last chunk can be smaller than the
+  // others, in which case it needs its own function:
+  const auto colsPerCall = (bins + serialisationFactor - 1) / serialisationFactor;
+  const auto lastCols = bins - (bins - 1) / colsPerCall * colsPerCall;
+  auto columns = output.transpose();
+  flopEstimate = 0;
+  auto fft1dFunc = fft1dMakeGraphFunction(radix, input.elementType(), {colsPerCall, rows});
+  const auto colFlops = flopEstimate;
+  std::size_t totalColFlops = 0;
+  FunctionClosure lastFunc = fft1dFunc;
+  if (lastCols != colsPerCall) {
+    flopEstimate = 0;
+    lastFunc = fft1dMakeGraphFunction(radix, input.elementType(), {lastCols, rows});
+    totalColFlops += flopEstimate;
+  }
+  for (auto begin = 0u; begin < bins; begin += colsPerCall) {
+    const auto end = std::min(bins, begin + colsPerCall);
+    auto slicedCols = columns.slice(begin, end, 0);
+    if (end - begin == colsPerCall) {
+      prog.add(fft1dFunc(slicedCols, slicedCols));
+      totalColFlops += colFlops;
+    } else {
+      prog.add(lastFunc(slicedCols, slicedCols));
+    }
+  }
+
+  flopEstimate = flopsBefore + rowFlops * serialisationFactor + totalColFlops;
+  return output;
+}
+
+ComplexTensor FFTBuilder::getConstant(poplar::program::Sequence& prog, const ConstantKey& key,
+                                      poplar::Type elemType, const std::vector<std::size_t>& shape,
+                                      const std::function<void(std::vector<float>&, std::vector<float>&)>& values,
+                                      const std::function<void(ComplexTensor&)>& map) {
+  auto found = constantCache.find(key);
+  if (found != constantCache.end()) {
+    constantCacheHits += 1;
+    if (found->second.remote) {
+      prog.add(found->second.fetch);
+    }
+    return found->second.tensor;
+  }
+
+  std::size_t numElements = 1;
+  for (auto d : shape) {
+    numElements *= d;
+  }
+  std::vector<float> real(numElements, 0.f);
+  std::vector<float> imag(numElements, 0.f);
+  values(real, imag);
+
+  CachedConstant constant;
+  const auto bytes = 2 * numElements * graph.getTarget().getTypeSize(elemType);
+  const auto name = debugPrefix + "/" + std::get<0>(key) + "_constant_" + std::to_string(constantCache.size());
+  if (remoteConstantThreshold && bytes >= remoteConstantThreshold) {
+    // The tensor is only live from each fetch to its last use:
+    constant.remote = true;
+    constant.tensor = ComplexTensor(graph, elemType, shape, name);
+    map(constant.tensor);
+    auto buffer = graph.addRemoteBuffer(name, elemType, 2 * numElements, 1, true);
+    constant.fetch = poplar::program::Copy(
+      buffer, poplar::concat(constant.tensor.real.flatten(), constant.tensor.imag.flatten()), name + "/fetch");
+    real.insert(real.end(), imag.begin(), imag.end());
+    remoteConstants.push_back(RemoteConstant{name, elemType, std::move(real)});
+    ipu_utils::logger()->debug("FFT constant '{}' ({} bytes) is held in a remote buffer.", name, bytes);
+    prog.add(constant.fetch);
+  } else {
+    constant.tensor = ComplexTensor(graph.addConstant<float>(elemType, shape, real, name + "/real"),
+                                    graph.addConstant<float>(elemType, shape, imag, name + "/imag"));
+    map(constant.tensor);
+    constants.push_back(constant.tensor.real);
+    constants.push_back(constant.tensor.imag);
+  }
+
+  constantCache.insert(std::make_pair(key, constant));
+  return constant.tensor;
+}
+
+void FFTBuilder::writeRemoteConstants(poplar::Engine& engine, const poplar::Target& target,
+                                      const std::vector<RemoteConstant>& constants, unsigned replicas) {
+  for (const auto& c : constants) {
+    std::vector<std::uint8_t> bytes(c.data.size() * target.getTypeSize(c.type));
+    if (c.type == poplar::HALF) {
+      poplar::copyFloatToDeviceHalf(target, c.data.data(), bytes.data(), c.data.size());
+    } else if (c.type == poplar::FLOAT) {
+      std::memcpy(bytes.data(), c.data.data(), bytes.size());
+    } else {
+      throw std::runtime_error("FFT remote constants must be half or float.");
+    }
+    for (auto r = 0u; r < replicas; ++r) {
+      engine.copyToRemoteBuffer(bytes.data(), c.handle, 0, r);
+    }
+  }
+}
+
+ComplexTensor FFTBuilder::inverseFourierMatrices(
+    poplar::program::Sequence& prog, std::size_t length, poplar::Type elemType,
+    const std::vector<std::size_t>& rhsShape, const poplar::OptionFlags& matmulOptions) {
+  // The layout of the matrices is chosen by the matmul planner so they
+  // can only be shared by matmuls of the same shape and options:
+  std::string layout = "matmul_lhs_for_rhs";
+  for (auto d : rhsShape) {
+    layout += "_" + std::to_string(d);
+  }
+  layout += "_amp_" + std::to_string(availableMemoryProportion);
+
+  auto values = [&](std::vector<float>& real, std::vector<float>& imag) {
+    const double twoPi_over_length = (2.0L / length) * 3.141592653589793238462643383279502884L;
+    for (std::size_t row = 0; row < length; ++row) {
+      for (std::size_t col = 0; col < length; ++col) {
+        real[row * length + col] = std::cos(twoPi_over_length * col * row);
+        imag[row * length + col] = -std::sin(twoPi_over_length * col * row);
+      }
+    }
+  };
+
+  auto map = [&](ComplexTensor& matrix) {
+    auto matmulMapping = poplin::createMatMulInputLHS(graph, elemType, matrix.shape(), rhsShape,
+                                                      debugPrefix + "/fourier_matrix_mapping", matmulOptions);
+    graph.setTileMapping(matrix.real, graph.getTileMapping(matmulMapping));
+    graph.setTileMapping(matrix.imag, graph.getTileMapping(matmulMapping));
+  };
+
+  return getConstant(prog, ConstantKey{"dft", {length}, elemType.toString(), layout},
+                     elemType, {length, length}, values, map);
+}
+
+ComplexTensor FFTBuilder::twiddleCoefficients(poplar::program::Sequence& prog, std::size_t N, std::size_t part,
+                                              std::size_t count, poplar::Type elemType) {
+  // Return the complex coefficients that recombine the partial results
+  // of the FFT (I.e. coefficients that appear in left hand side of the
+  // inverse Fourier matrix's FFT factorization). Sub-result /p part
+  // of a size N FFT is multiplied by exp(-2 pi i part n / N) for n in [0, count):
+  auto values = [&](std::vector<float>& real, std::vector<float>& imag) {
+    const double twoPi_over_N = (2.0L / N) * 3.141592653589793238462643383279502884L;
+    for (auto n = 0u; n < count; ++n) {
+      // Reduce the angle modulo 2 pi exactly before converting to floating point:
+      const auto k = (part * n) % N;
+      real[n] = std::cos(twoPi_over_N * k);
+      imag[n] = -std::sin(twoPi_over_N * k);
+    }
+  };
+
+  return getConstant(prog, ConstantKey{"twiddle", {N, part, count}, elemType.toString(), "linear"},
+                     elemType, {count}, values, [&](ComplexTensor& w) { w.mapLinearly(graph); });
 }
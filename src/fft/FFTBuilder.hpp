@@ -3,6 +3,23 @@
 #pragma once
 
 #include "complex.hpp"
+#include "FFTPlanner.hpp"
+#include "utils.hpp"
+
+#include <poplar/Engine.hpp>
+
+#include <functional>
+#include <map>
+#include <tuple>
+
+/// Stages of the FFT programs that can be timed (see FFTBuilder::enableStageCycleCounts()).
+enum class FFTStage {
+  DftMatmul, // Base DFT matrix-multiplies.
+  Twiddle,   // Element-wise multiplies by the twiddle coefficients.
+  Butterfly, // Radix-p butterflies that recombine the sub-results.
+  Transpose, // Data movement: re-mapping copies, graph function argument copies and all-to-all transposes.
+  NumStages
+};
 
 /// Class to aid graph construction of a 1D Fast-Fourier-Transform.
 class FFTBuilder {
@@ -13,14 +30,77 @@ public:
   /// Make an fft builder object.
   FFTBuilder(poplar::Graph &graph, const std::string debugName)
     : graph(graph), debugPrefix(debugName),
-      availableMemoryProportion(-1.f), flopEstimate(0) {}
+      availableMemoryProportion(-1.f), overlappedSerialisation(false), flopEstimate(0),
+      stageCycleCounting(false), remoteConstantThreshold(0), constantCacheHits(0),
+      fusedComplexVertices(false) {}
 
   /// Set the proportion of memory available for the inner DFT matrix-multiplies.
   void setAvailableMemoryProportion(float proportion) { availableMemoryProportion = proportion; }
 
+  /// In overlapped mode serialised 2D-FFTs copy each chunk's result out and the next
+  /// chunk's input in with a single copy program (one exchange instead of two). The
+  /// transpose between the row and column passes is folded into those copies: the
+  /// first column chunk reads the last row chunk's results from the function's output.
+  void setOverlappedSerialisation(bool enable) { overlappedSerialisation = enable; }
+
+  /// Use the fused complex arithmetic vertices (see complex::addCodelets(), which must
+  /// have been called on the graph) for the twiddles and the radix-2 and radix-4
+  /// butterflies. Radix-2 steps fold the twiddle multiply into the butterfly vertex.
+  void setFusedComplexVertices(bool enable) { fusedComplexVertices = enable; }
+
+  /// Time each stage (see FFTStage) of the FFT programs built after this call. The cycle
+  /// counts are accumulated over every execution of the stage (including every call of a
+  /// serialised FFT's graph function) into the tensor returned by getStageCycleCounts(),
+  /// which is zeroed by a program appended to /p initProg. The counters sync the tiles
+  /// around each stage so an instrumented FFT is slower than an uninstrumented one: use
+  /// the counts to compare the stages, not as the total.
+  void enableStageCycleCounts(poplar::program::Sequence& initProg);
+
+  /// Accumulated cycles (lower 32-bits) for each stage: an UNSIGNED_INT tensor of
+  /// shape [FFTStage::NumStages] (only valid after enableStageCycleCounts()).
+  poplar::Tensor getStageCycleCounts() const { return stageCycles; }
+
+  /// Name of the stage for reporting (e.g. "dft_matmul").
+  static std::string stageName(FFTStage stage);
+
+  /// Tile memory used by the on-chip constants (Fourier matrices and twiddle
+  /// coefficients) of all the FFTs built by this object so far.
+  TileMemoryStats getConstantMemoryStats() { return tileMemoryStats(graph, constants); }
+
+  /// Host data of a constant held in a remote buffer (see setRemoteConstantThreshold()).
+  struct RemoteConstant {
+    std::string handle;
+    poplar::Type type;
+    std::vector<float> data; // Real parts followed by the imaginary parts.
+  };
+
+  /// Fourier matrices and twiddle coefficients are shared by every FFT built by this
+  /// object that needs the same values with the same tile layout. Constants of at least
+  /// /p bytes are held in remote buffers instead and copied onto the tiles before each use
+  /// (rather than being always live on chip) so that their tile memory can be reused
+  /// between uses. The default (0) keeps all constants on chip. The remote buffers must be
+  /// written with writeRemoteConstants() before the FFT programs are run.
+  void setRemoteConstantThreshold(std::size_t bytes) { remoteConstantThreshold = bytes; }
+
+  /// The remote buffer constants of all the FFTs built by this object so far. Their handles
+  /// and data only depend on the FFTs built (and the order they are built in) so building the
+  /// same FFTs again, e.g. on a graph that is never compiled, recovers them for a loaded executable.
+  const std::vector<RemoteConstant>& getRemoteConstants() const { return remoteConstants; }
+
+  /// Write the remote buffer constants (for every replica) to a loaded engine.
+  static void writeRemoteConstants(poplar::Engine& engine, const poplar::Target& target,
+                                   const std::vector<RemoteConstant>& constants, unsigned replicas = 1);
+
+  /// Number of times a Fourier matrix or twiddle constant was shared instead of created.
+  std::size_t getConstantCacheHits() const { return constantCacheHits; }
+
   /// Build the compute graph that applies FFT to the given complex vector.
   /// The program will be appended to the sequence specified in construction
   /// of this object. The FFT program will be appended to the sequence /p prog.
+  ///
+  /// The FFT size must be the radix size multiplied by factors of 2, 3, 4
+  /// and 5 (see factorise()). A radix equal to the FFT size computes a
+  /// single DFT matrix-multiply, which supports any length.
   complex::ComplexTensor fft1d(poplar::program::Sequence& prog, complex::ComplexTensor input, std::size_t radix = 0);
 
   /// Build a compute graph that applies a 2D-FFT to a complex matrix.
@@ -34,20 +114,157 @@ public:
   /// The program will be appended to the sequence /p prog.
   complex::ComplexTensor fft2d(poplar::program::Sequence& prog, complex::ComplexTensor input, std::size_t radix, std::size_t serialisationFactor=1);
 
+  /// Build a compute graph that applies an FFT in-place over the last /p dimensions
+  /// axes of the input. Any leading axes are batch axes (e.g. a rank 3 input with
+  /// dimensions = 2 is a batch of 2D-FFTs) and the axes do not need to have the same
+  /// length. Each axis is transformed by 1D-FFTs of every vector along it: these are
+  /// serialised into serialisationFactor chunks that call the same graph function
+  /// (one function per distinct chunk shape). The radix must be valid for every
+  /// axis length (0 chooses the default radix per axis).
+  ///
+  /// The program will be appended to the sequence /p prog.
+  complex::ComplexTensor fftnd(poplar::program::Sequence& prog, complex::ComplexTensor input,
+                               std::size_t dimensions, std::size_t radix, std::size_t serialisationFactor=1);
+
+  /// Build a compute graph that applies a 3D-FFT (in-place) to a volume of shape
+  /// [depth, rows, cols] or a batch of volumes [batch, depth, rows, cols]. See fftnd().
+  complex::ComplexTensor fft3d(poplar::program::Sequence& prog, complex::ComplexTensor input,
+                               std::size_t radix, std::size_t serialisationFactor=1) {
+    return fftnd(prog, input, 3, radix, serialisationFactor);
+  }
+
+  /// Build a compute graph that applies a 2D-FFT to an N x N matrix distributed over the
+  /// replicas of the graph: each replica's input is its block of N / R consecutive rows
+  /// (shape [N / R, N], the host streams the rows of the matrix to the replicas in order).
+  /// The rows are transformed locally, the matrix is transposed with a gcl all-to-all so
+  /// that each replica holds N / R columns, and the columns are transformed locally.
+  /// A second all-to-all then returns the result to the row distribution of the input
+  /// unless /p transposedOutput is true, in which case each replica's result holds
+  /// rows of the transposed output (saving one all-to-all when the consumer accepts that).
+  /// FLOP estimates are per replica. The program will be appended to the sequence /p prog.
+  complex::ComplexTensor fft2dDistributed(poplar::program::Sequence& prog, complex::ComplexTensor input,
+                                          std::size_t radix, bool transposedOutput = false);
+
+  /// Build the compute graph that applies an inverse FFT to the given complex
+  /// vector (or batch of vectors). The inverse is computed with the forward
+  /// FFT using ifft(X) = swap(fft(swap(X))) / N where swap exchanges the real
+  /// and imaginary parts (which costs nothing as it only swaps tensor views).
+  /// If /p normalise is false the 1/N scaling is left to the caller (e.g.
+  /// so that it can be folded into a preceding element-wise operation).
+  /// The program will be appended to the sequence /p prog.
+  complex::ComplexTensor ifft1d(poplar::program::Sequence& prog, complex::ComplexTensor input,
+                                std::size_t radix = 0, bool normalise = true);
+
+  /// Build a compute graph that applies an inverse 2D-FFT to a complex matrix.
+  /// Like fft2d the transform is computed in-place and /p normalise has
+  /// the same meaning as in ifft1d (the scale is 1 / (rows * cols)).
+  /// The program will be appended to the sequence /p prog.
+  complex::ComplexTensor ifft2d(poplar::program::Sequence& prog, complex::ComplexTensor input, std::size_t radix,
+                                std::size_t serialisationFactor=1, bool normalise = true);
+
+  /// Build a compute graph that computes the linear convolution (or cross-correlation
+  /// if /p correlate is true) of a batch of signals of shape [batch, L] with a kernel of
+  /// shape [batch, K] or [1, K] (the same kernel for every signal). Both are zero padded
+  /// to the FFT size, transformed, multiplied element-wise and transformed back without
+  /// leaving the device. All transforms of the signal batch shape (the forward transform
+  /// of the signals and the inverse transform of the products) call the same graph function.
+  ///
+  /// The default FFT size (0) is the smallest size >= L + K - 1 that only has factors of
+  /// 2, 3 and 5 (see nextFastSize()). The result has shape [batch, L + K - 1] where for
+  /// correlation element m holds lag m - (K - 1) (as numpy.correlate in 'full' mode).
+  /// If a smaller FFT size is given the result is the circular convolution/correlation
+  /// of that size (lags in FFT order). The program will be appended to the sequence /p prog.
+  complex::ComplexTensor convolve1d(poplar::program::Sequence& prog,
+                                    complex::ComplexTensor signal, complex::ComplexTensor kernel,
+                                    bool correlate = false, std::size_t fftSize = 0, std::size_t radix = 0);
+
+  /// Build the compute graph that applies an FFT to a batch of real signals
+  /// (shape [batch, N] or [N] with N even). The signal is packed into a complex
+  /// vector of length N/2 (even samples in the real part, odd samples in the
+  /// imaginary part) which is transformed by fft1d() and then separated by a
+  /// twiddle stage. Only the N/2 + 1 non-redundant bins are returned (the
+  /// rest are their complex conjugates). The radix applies to the inner FFT
+  /// of size N/2. The program will be appended to the sequence /p prog.
+  complex::ComplexTensor rfft1d(poplar::program::Sequence& prog, poplar::Tensor input, std::size_t radix = 0);
+
+  /// Build a compute graph that applies a 2D-FFT to a real matrix of shape
+  /// [rows, cols] (cols must be even). The rows are transformed by rfft1d()
+  /// and then the N/2 + 1 non-redundant columns by complex 1D-FFTs, so the
+  /// returned tensor has shape [rows, cols/2 + 1]. The matrix does not need to be
+  /// square: the radix (0 for automatic) must be valid for FFTs of size
+  /// cols/2 and rows. Both passes are serialised into serialisationFactor
+  /// chunks (the number of rows must be divisible by it).
+  ///
+  /// The program will be appended to the sequence /p prog.
+  complex::ComplexTensor rfft2d(poplar::program::Sequence& prog, poplar::Tensor input, std::size_t radix, std::size_t serialisationFactor=1);
+
+  /// Choose the radix and serialisation factor for an FFT on this builder's target
+  /// (see planFFT()). If a planning cache is given the plan is looked up in (or added
+  /// to) it, and any measurements it holds are used.
+  FFTPlan plan(const FFTPlanParams& params, FFTPlanningCache* cache = nullptr) const;
+
   /// Return the sum of FLOPs counted during all FFT building performed by this object.
   /// The counts are coarse estimates, not the exact number of FLOPs executed by the hardware.
   std::size_t getFlopEstimate() const { return flopEstimate; }
 
+  /// Return the radix used when none is specified: the FFT size divided by its
+  /// smallest factor from {2, 3, 5} (i.e. a single Cooley-Tukey step), or the
+  /// FFT size itself (a single DFT) if it has none of those factors.
+  static std::size_t defaultRadix(std::size_t fftSize);
+
+  /// Return the Cooley-Tukey factors that decompose an FFT of fftSize down to DFTs
+  /// of the radix size (outermost step first). Radix-4 steps are preferred to
+  /// pairs of radix-2 steps. A radix of 0 selects defaultRadix(). An empty
+  /// result means the radix is the FFT size. Throws if the FFT size divided
+  /// by the radix is not a product of 2, 3, 4 and 5.
+  static std::vector<std::size_t> factorise(std::size_t fftSize, std::size_t radix);
+
+  /// Return the smallest size >= n that only has factors of 2, 3 and 5 (so
+  /// that an FFT of that size decomposes into radix-2/3/4/5 steps).
+  static std::size_t nextFastSize(std::size_t n);
+
 private:
   float availableMemoryProportion;
+  bool overlappedSerialisation;
   std::size_t flopEstimate;
+  bool stageCycleCounting;
+  poplar::Tensor stageCycles;
+  std::vector<poplar::Tensor> constants;
+
+  // Constants by (kind, sizes, element type, tile layout):
+  using ConstantKey = std::tuple<std::string, std::vector<std::size_t>, std::string, std::string>;
+  struct CachedConstant {
+    complex::ComplexTensor tensor;
+    bool remote = false;
+    poplar::program::Program fetch; // Copies a remote constant onto the tiles.
+  };
+  std::map<ConstantKey, CachedConstant> constantCache;
+  std::vector<RemoteConstant> remoteConstants;
+  std::size_t remoteConstantThreshold;
+  std::size_t constantCacheHits;
+  bool fusedComplexVertices;
+
+  /// Return the constant for the key, adding it to the cache on first use. /p values fills
+  /// in the real and imaginary parts and /p map sets the tile mapping of a new constant.
+  /// If the constant is held in a remote buffer the copy onto the tiles is appended to /p prog.
+  complex::ComplexTensor getConstant(poplar::program::Sequence& prog, const ConstantKey& key,
+                                     poplar::Type elemType, const std::vector<std::size_t>& shape,
+                                     const std::function<void(std::vector<float>&, std::vector<float>&)>& values,
+                                     const std::function<void(complex::ComplexTensor&)>& map);
+
+  /// Append /p stageProg to /p prog and time it if stage cycle counts are enabled.
+  void addStage(poplar::program::Sequence& prog, FFTStage stage, const poplar::program::Program& stageProg);
 
   // Utility functions used in construction of the FFT graph program.
-  complex::ComplexTensor multiplyMatrixByVectorBatch(poplar::program::Sequence& fftSeq, const complex::ComplexTensor matrix, complex::ComplexTensor vectors);
-  complex::ComplexTensor dft1d(poplar::program::Sequence& fftSeq, complex::ComplexTensor fourierMatrix, complex::ComplexTensor even, complex::ComplexTensor odd);
+  complex::ComplexTensor multiplyMatrixByVectorBatch(poplar::program::Sequence& fftSeq, std::size_t dftSize, complex::ComplexTensor vectors);
+  complex::ComplexTensor dft1d(poplar::program::Sequence& fftSeq, std::size_t dftSize, const std::vector<complex::ComplexTensor>& parts);
+  void scaleInPlace(poplar::program::Sequence& prog, complex::ComplexTensor& t, float scale);
+  complex::ComplexTensor butterflies(poplar::program::Sequence& fftSeq, const std::vector<complex::ComplexTensor>& parts);
   std::pair<complex::ComplexTensor, complex::ComplexTensor> splitEvenOdd(complex::ComplexTensor input);
-  complex::ComplexTensor inverseFourierMatrices(std::size_t length, poplar::Type elemType);
-  complex::ComplexTensor twiddleCoefficients(std::size_t N, poplar::Type elemType);
+  complex::ComplexTensor inverseFourierMatrices(poplar::program::Sequence& prog, std::size_t length, poplar::Type elemType,
+                                                const std::vector<std::size_t>& rhsShape, const poplar::OptionFlags& matmulOptions);
+  complex::ComplexTensor twiddleCoefficients(poplar::program::Sequence& prog, std::size_t N, std::size_t part,
+                                             std::size_t count, poplar::Type elemType);
 
   /// Internal utility that holds a graph function together with
   // input and output tensors and implements a callable interface.
@@ -55,6 +272,7 @@ private:
     poplar::Function function;
     complex::ComplexTensor input;
     complex::ComplexTensor output;
+    FFTBuilder* builder; // Times the argument copies.
 
     /// Apply the graph function to the specified arguments. argIn is copied into the input tensors
     /// and the result is copied to argOut. (The graph function input and output tensors are captured
@@ -62,7 +280,26 @@ private:
     poplar::program::Program operator () (complex::ComplexTensor& argIn, complex::ComplexTensor& argOut);
   };
 
+  /// As FunctionClosure but for graph functions that take a real input.
+  struct RealFunctionClosure {
+    poplar::Function function;
+    poplar::Tensor input;
+    complex::ComplexTensor output;
+    FFTBuilder* builder;
+    poplar::program::Program operator () (poplar::Tensor& argIn, complex::ComplexTensor& argOut);
+  };
+
+  RealFunctionClosure rfft1dMakeGraphFunction(std::size_t radix,
+                                              poplar::Type elementType,
+                                              const std::vector<std::size_t>& shape);
+
   FunctionClosure fft1dMakeGraphFunction(std::size_t radix,
                                          poplar::Type elementType,
                                          const std::vector<std::size_t>& shape);
+
+  complex::ComplexTensor distributedTranspose(poplar::program::Sequence& prog, complex::ComplexTensor local);
+
+  complex::ComplexTensor fft2dOverlapped(poplar::program::Sequence& prog, complex::ComplexTensor input,
+                                         FunctionClosure& fft1dFunc, std::size_t rowsPerCall,
+                                         std::size_t serialisationFactor);
 };
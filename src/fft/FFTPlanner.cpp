@@ -0,0 +1,289 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "FFTPlanner.hpp"
+#include "FFTBuilder.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <ipu_utils.hpp>
+
+namespace {
+
+// Approximate machine parameters used by the cost model. These only need
+// to rank candidates correctly, not predict absolute cycle counts.
+constexpr double syncCycles = 150.0;            // Per compute set (sync and vertex launch).
+constexpr double matmulOverheadCycles = 2500.0; // Per matmul (planning overheads, reductions etc).
+constexpr double ampInnerDimension = 16.0;      // Matmul inner dimension needed to keep the AMP busy.
+constexpr double liveCopies = 6.0;              // Live copies of the data during a 1D FFT.
+
+double ampFlopsPerCycle(const poplar::Type& type) {
+  return type == poplar::HALF ? 128.0 : 32.0;
+}
+
+bool isSmooth(std::size_t n) {
+  for (auto p : {2u, 3u, 5u}) {
+    while (n % p == 0) {
+      n /= p;
+    }
+  }
+  return n == 1;
+}
+
+std::vector<std::size_t> divisors(std::size_t n) {
+  std::vector<std::size_t> result;
+  for (std::size_t d = 1; d <= n; ++d) {
+    if (n % d == 0) {
+      result.push_back(d);
+    }
+  }
+  return result;
+}
+
+std::vector<std::string> splitCsvLine(const std::string& line) {
+  std::vector<std::string> fields;
+  std::stringstream ss(line);
+  std::string field;
+  while (std::getline(ss, field, ',')) {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+} // end anonymous namespace
+
+std::size_t FFTMeasurements::load(const std::string& csvFile) {
+  std::ifstream file(csvFile);
+  if (!file) {
+    throw std::runtime_error("Could not open FFT measurement table: '" + csvFile + "'");
+  }
+
+  std::string line;
+  if (!std::getline(file, line)) {
+    throw std::runtime_error("FFT measurement table '" + csvFile + "' is empty.");
+  }
+  const auto header = splitCsvLine(line);
+  auto column = [&](const std::string& name) {
+    auto found = std::find(header.begin(), header.end(), name);
+    if (found == header.end()) {
+      throw std::runtime_error("FFT measurement table '" + csvFile + "' has no '" + name + "' column.");
+    }
+    return std::size_t(found - header.begin());
+  };
+  const auto typeCol = column("FFT-Type");
+  const auto sizeCol = column("Input-size");
+  const auto batchCol = column("Batch-size");
+  const auto radixCol = column("Radix-size");
+  const auto cyclesCol = column("Cycles");
+  const auto serialCol = column("Serial-steps");
+  const auto numCols = std::max({typeCol, sizeCol, batchCol, radixCol, cyclesCol, serialCol}) + 1;
+  const auto dataTypeCol = std::find(header.begin(), header.end(), "Data-type") - header.begin();
+  const bool hasDataType = std::size_t(dataTypeCol) < header.size();
+
+  std::size_t rows = 0;
+  while (std::getline(file, line)) {
+    const auto fields = splitCsvLine(line);
+    if (fields.size() < numCols) {
+      continue;
+    }
+    try {
+      // Types are written as e.g. "1D":
+      const auto dims = std::stoul(fields[typeCol]);
+      const auto dataType = hasDataType && std::size_t(dataTypeCol) < fields.size() ? fields[dataTypeCol] : "float";
+      Key key{dims, std::stoul(fields[sizeCol]), std::stoul(fields[batchCol]), dataType,
+              std::stoul(fields[radixCol]), std::stoul(fields[serialCol])};
+      // Failed runs have no cycle count (written as None):
+      const bool succeeded = fields[cyclesCol] != "None";
+      add(key, succeeded, succeeded ? std::stod(fields[cyclesCol]) : 0.0);
+      rows += 1;
+    } catch (const std::logic_error&) {
+      ipu_utils::logger()->warn("Skipping malformed row in FFT measurement table: '{}'", line);
+    }
+  }
+  ipu_utils::logger()->info("Read {} FFT measurements from '{}'", rows, csvFile);
+  return rows;
+}
+
+void FFTMeasurements::add(const Key& key, bool succeeded, double cycles) {
+  entries[key] = std::make_pair(succeeded, cycles);
+}
+
+bool FFTMeasurements::find(const Key& key, bool& succeeded, double& cycles) const {
+  auto found = entries.find(key);
+  if (found == entries.end()) {
+    return false;
+  }
+  succeeded = found->second.first;
+  cycles = found->second.second;
+  return true;
+}
+
+std::size_t FFTPlanningCache::loadMeasurements(const std::string& csvFile) {
+  std::lock_guard<std::mutex> lock(mutex);
+  plans.clear();
+  return measurements.load(csvFile);
+}
+
+FFTPlan FFTPlanningCache::getPlan(const poplar::Target& target, const FFTPlanParams& params) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Key key{params.dimensions, params.size, params.batchSize, params.type.toString(), params.memoryProportion,
+          params.radix, params.serialisationFactor, params.overlappedSerialisation,
+          target.getNumTiles(), target.getBytesPerTile()};
+  auto found = plans.find(key);
+  if (found == plans.end()) {
+    found = plans.insert(std::make_pair(key, planFFT(target, params, &measurements))).first;
+  }
+  return found->second;
+}
+
+std::size_t FFTPlanningCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return plans.size();
+}
+
+void FFTPlanningCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  plans.clear();
+}
+
+FFTPlan estimateFFTCost(const poplar::Target& target, const FFTPlanParams& params,
+                        std::size_t radix, std::size_t serialisationFactor) {
+  const double tiles = std::max(1u, target.getNumTiles());
+  const double typeBytes = target.getTypeSize(params.type);
+  const double vectorWidth = std::max(1u, target.getVectorWidth(params.type));
+  const double exchangeRate = tiles * std::max(1u, target.getExchangeBytesPerCycle());
+
+  // Each call of the 1D FFT processes this many vectors:
+  const auto batchPerCall = params.dimensions == 2 ? params.size / serialisationFactor : params.batchSize;
+  const double elements = double(batchPerCall) * params.size;
+  const double complexBytes = 2.0 * typeBytes * elements;
+  const auto factors = FFTBuilder::factorise(params.size, radix);
+
+  // DFT matrix-multiplies (two real matmuls) and their operand exchange. Small
+  // radices under-utilise the AMP because of its minimum inner dimension:
+  const double efficiency = std::min(1.0, radix / ampInnerDimension);
+  double cycles = 8.0 * radix * elements / (tiles * ampFlopsPerCycle(params.type) * efficiency);
+  cycles += 2.0 * matmulOverheadCycles + 3.0 * complexBytes / exchangeRate;
+
+  // Twiddles and butterflies for each Cooley-Tukey step (matching
+  // the element-wise FLOPs and compute sets that FFTBuilder emits):
+  double constantBytes = 2.0 * typeBytes * radix * radix;
+  auto levelSize = params.size;
+  for (auto p : factors) {
+    const double twiddleFlops = 6.0 * elements * (p - 1) / p;
+    const double butterflyFlops = p == 2 ? 2.0 * elements : p == 4 ? 4.0 * elements : 8.0 * (p - 1) * elements;
+    const double computeSets = 2.0 * (p - 1) + (p == 2 ? 4.0 : p == 4 ? 16.0 : 2.0 * p);
+    cycles += (twiddleFlops + butterflyFlops) / (tiles * vectorWidth) + computeSets * syncCycles;
+    if (elements / p > tiles) {
+      cycles += complexBytes / exchangeRate; // Re-mapping of the sub-results.
+    }
+    constantBytes += 2.0 * typeBytes * (p - 1) * (levelSize / p);
+    levelSize /= p;
+  }
+
+  double bytes = liveCopies * complexBytes + constantBytes;
+  if (params.dimensions == 2) {
+    // Every call copies its input and output through the graph function's tensors,
+    // there are two passes, and the whole matrix stays live throughout. Overlapped
+    // serialisation merges each copy-out with the next copy-in (one exchange):
+    const double copyPhases = params.overlappedSerialisation ? 1.0 : 2.0;
+    cycles = 2.0 * serialisationFactor * (cycles + copyPhases * (complexBytes / exchangeRate + syncCycles));
+    bytes += 2.0 * typeBytes * double(params.size) * params.size;
+  }
+
+  FFTPlan plan;
+  plan.radix = radix;
+  plan.serialisationFactor = serialisationFactor;
+  plan.cycles = cycles;
+  plan.bytesPerTile = bytes / tiles;
+  plan.fitsMemory = plan.bytesPerTile <= params.memoryProportion * target.getBytesPerTile();
+  return plan;
+}
+
+FFTPlan planFFT(const poplar::Target& target, const FFTPlanParams& params,
+                const FFTMeasurements* measurements) {
+  if (params.size < 2) {
+    throw std::runtime_error("FFT planner needs a size of at least 2.");
+  }
+  if (params.dimensions != 1 && params.dimensions != 2) {
+    throw std::runtime_error("FFT planner only supports 1D and 2D FFTs.");
+  }
+  if (params.dimensions == 2 && params.batchSize != params.size) {
+    throw std::runtime_error("FFT planner only supports square 2D FFTs.");
+  }
+
+  if (params.serialisationFactor > 1 && params.dimensions == 1) {
+    throw std::runtime_error("FFT planner: 1D FFTs are not serialised.");
+  }
+  const auto serialisationFactors =
+    params.serialisationFactor ? std::vector<std::size_t>{params.serialisationFactor} :
+    params.dimensions == 2 ? divisors(params.size) : std::vector<std::size_t>{1};
+  const auto radices = params.radix ? std::vector<std::size_t>{params.radix} : divisors(params.size);
+  // The best measured and best estimated candidates are tracked separately
+  // because the cost model's cycles are not comparable with measured cycles:
+  FFTPlan best, bestMeasured, smallest;
+  best.cycles = std::numeric_limits<double>::infinity();
+  bestMeasured.cycles = std::numeric_limits<double>::infinity();
+  smallest.bytesPerTile = std::numeric_limits<std::size_t>::max();
+  std::size_t candidates = 0;
+
+  for (const auto radix : radices) {
+    if (radix < 2 || params.size % radix || !isSmooth(params.size / radix)) {
+      continue;
+    }
+    for (const auto serialisation : serialisationFactors) {
+      if (params.size % serialisation) {
+        continue;
+      }
+      auto plan = estimateFFTCost(target, params, radix, serialisation);
+      bool succeeded = true;
+      double measuredCycles = 0.0;
+      if (measurements &&
+          measurements->find(FFTMeasurements::Key{params.dimensions, params.size, params.batchSize,
+                                                  params.type.toString(), radix, serialisation},
+                             succeeded, measuredCycles)) {
+        if (!succeeded) {
+          continue; // It has been tried and did not compile or run.
+        }
+        // Keep the memory estimate: the measurement may have used more memory than this plan allows.
+        plan.cycles = measuredCycles;
+        plan.measured = true;
+      }
+      candidates += 1;
+      ipu_utils::logger()->trace("FFT plan candidate radix {} serialisation {}: {} cycles ({}) {} bytes per tile",
+                                 radix, serialisation, plan.cycles, plan.measured ? "measured" : "estimated",
+                                 plan.bytesPerTile);
+      auto& bestOfKind = plan.measured ? bestMeasured : best;
+      if (plan.fitsMemory && plan.cycles < bestOfKind.cycles) {
+        bestOfKind = plan;
+      }
+      if (plan.bytesPerTile < smallest.bytesPerTile) {
+        smallest = plan;
+      }
+    }
+  }
+
+  if (candidates == 0) {
+    throw std::runtime_error("FFT planner found no valid radix for size " + std::to_string(params.size) + ".");
+  }
+
+  if (bestMeasured.radix != 0) {
+    best = bestMeasured;
+  }
+
+  if (best.radix == 0) {
+    ipu_utils::logger()->warn("No FFT plan fits in the memory budget: using the plan with the least memory.");
+    best = smallest;
+    best.fitsMemory = false;
+  }
+
+  ipu_utils::logger()->info("FFT plan for {}D size {} batch-size {}: radix {} serialisation-factor {} "
+                            "({} {} cycles, ~{} bytes per tile)",
+                            params.dimensions, params.size, params.batchSize, best.radix,
+                            best.serialisationFactor, best.measured ? "measured" : "estimated",
+                            std::size_t(best.cycles), best.bytesPerTile);
+  return best;
+}
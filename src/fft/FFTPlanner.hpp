@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <poplar/Target.hpp>
+#include <poplar/Type.hpp>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/// Parameters of the FFT problem being planned.
+struct FFTPlanParams {
+  std::size_t dimensions;   // 1 for a batch of 1D FFTs, 2 for a (square) 2D FFT.
+  std::size_t size;         // Length of each FFT (rows and columns for 2D).
+  std::size_t batchSize;    // Number of 1D FFTs (must be equal to size for 2D).
+  poplar::Type type;
+  float memoryProportion;   // Proportion of each tile's memory the FFT may use.
+  std::size_t radix = 0;                // Fixed radix (0 lets the planner choose).
+  std::size_t serialisationFactor = 0;  // Fixed serialisation factor (0 lets the planner choose).
+  bool overlappedSerialisation = false; // See FFTBuilder::setOverlappedSerialisation().
+};
+
+/// Chosen parameters for FFTBuilder::fft1d/fft2d.
+struct FFTPlan {
+  std::size_t radix = 0;
+  std::size_t serialisationFactor = 1;
+  double cycles = 0.0;           // Estimated (or measured) cycle count.
+  std::size_t bytesPerTile = 0;  // Estimated peak memory per tile.
+  bool measured = false;         // True if cycles came from a measurement table.
+  bool fitsMemory = true;        // False if no candidate fits: the plan uses the least memory instead.
+};
+
+/// Cycle counts measured by previous runs, keyed on (dimensions, size, batch-size,
+/// element type name, radix, serialisation-factor).
+/// A failed run (e.g. out of memory) is recorded with no cycle count.
+class FFTMeasurements {
+public:
+  using Key = std::tuple<std::size_t, std::size_t, std::size_t, std::string, std::size_t, std::size_t>;
+
+  /// Load the CSV written by python/fft/perf_analysis.py (the columns are found by name
+  /// from the header line so extra columns are ignored). The element type is read from
+  /// an optional 'Data-type' column (e.g. "float" or "half"): tables without one hold
+  /// float measurements (FourierTransform's FFTs are float). Returns the number of rows read.
+  std::size_t load(const std::string& csvFile);
+
+  void add(const Key& key, bool succeeded, double cycles);
+
+  /// Return true if there is an entry for the key. If the entry is a failed run
+  /// succeeded is set false, otherwise succeeded is set true and cycles is set.
+  bool find(const Key& key, bool& succeeded, double& cycles) const;
+
+  std::size_t size() const { return entries.size(); }
+
+private:
+  std::map<Key, std::pair<bool, double>> entries;
+};
+
+/// Cache of FFT plans (and the measurement table used to make them) which can
+/// be shared between FFT builders so that repeated problems are only planned
+/// once (in the same way as poplin's matmul PlanningCache). Thread safe.
+class FFTPlanningCache {
+public:
+  FFTPlanningCache() {}
+
+  /// Load a persisted table of measured cycle counts (see FFTMeasurements::load).
+  /// Clears any cached plans as they may change.
+  std::size_t loadMeasurements(const std::string& csvFile);
+
+  /// Return the cached plan or make (and cache) a new one.
+  FFTPlan getPlan(const poplar::Target& target, const FFTPlanParams& params);
+
+  std::size_t size() const;
+  void clear();
+
+private:
+  using Key = std::tuple<std::size_t, std::size_t, std::size_t, std::string, float,
+                         std::size_t, std::size_t, bool, unsigned, unsigned>;
+  mutable std::mutex mutex;
+  FFTMeasurements measurements;
+  std::map<Key, FFTPlan> plans;
+};
+
+/// Choose the radix and serialisation factor for an FFT. Every radix that
+/// FFTBuilder can decompose the size down to (and for 2D every serialisation
+/// factor that divides the size) is scored by a cost model of the matmul, element-wise,
+/// exchange and sync cycles of the resulting program, or by the measured cycles if the
+/// table has an entry for it. Estimates only rank candidates so they are not compared with
+/// measurements: if any measured candidate's memory estimate fits in params.memoryProportion
+/// of a tile the fastest of those is returned, otherwise the fastest estimated candidate that
+/// fits. A non-zero radix or serialisation factor in the params restricts the search to that value.
+FFTPlan planFFT(const poplar::Target& target, const FFTPlanParams& params,
+                const FFTMeasurements* measurements = nullptr);
+
+/// Cost model estimate (cycles and peak bytes per tile) for one candidate.
+FFTPlan estimateFFTCost(const poplar::Target& target, const FFTPlanParams& params,
+                        std::size_t radix, std::size_t serialisationFactor);
@@ -1,14 +1,194 @@
 // Copyright (c) 2022 Graphcore Ltd. All rights reserved.
 
+#include <algorithm>
+
 #include <popops/ElementWise.hpp>
 #include <poputil/TileMapping.hpp>
+#include <poputil/VertexTemplates.hpp>
 
 #include "complex.hpp"
 #include "ipu_utils.hpp"
 #include "io_utils.hpp"
 
+namespace {
+
+using VertexFields = std::vector<std::pair<std::string, poplar::Tensor>>;
+
+/// Split flattened intervals of a tensor whose last dimension is /p rowLength at
+/// the row boundaries and return the corresponding intervals within a row:
+std::vector<poplar::Interval> rowIntervals(const std::vector<poplar::Interval>& regions, std::size_t rowLength) {
+  std::vector<poplar::Interval> result;
+  for (const auto& r : regions) {
+    for (auto begin = r.begin(); begin < r.end();) {
+      const auto end = std::min<std::size_t>(r.end(), (begin / rowLength + 1) * rowLength);
+      result.emplace_back(begin % rowLength, begin % rowLength + (end - begin));
+      begin = end;
+    }
+  }
+  return result;
+}
+
+/// Check the operands of a fused op and log any that are laid out differently to
+/// /p layout (their elements are exchanged to the vertices' tiles by the compute set).
+/// An operand whose shape is the last dimension of the layout is a row operand: the
+/// same row is used for every row of the layout.
+void checkOperands(poplar::Graph& graph, const poplar::Tensor& layout, const VertexFields& fields,
+                   const VertexFields& rowFields, const std::string& debugName) {
+  const auto mapping = graph.getTileMapping(layout);
+  for (const auto& f : fields) {
+    if (f.second.shape() != layout.shape()) {
+      throw std::logic_error("ComplexTensor: Operand '" + f.first + "' of " + debugName + " has the wrong shape.");
+    }
+    if (graph.getTileMapping(f.second) != mapping) {
+      ipu_utils::logger()->debug("{}: operand '{}' is not laid out like the output: its elements will be exchanged.",
+                                 debugName, f.first);
+    }
+  }
+  for (const auto& f : rowFields) {
+    if (f.second.rank() != 1 || f.second.dim(0) != layout.dim(layout.rank() - 1)) {
+      throw std::logic_error("ComplexTensor: Row operand '" + f.first + "' of " + debugName + " has the wrong shape.");
+    }
+  }
+}
+
+/// Add an element-wise vertex for each contiguous region of /p layout on each tile
+/// and connect every field to the same elements of its tensor (and every row field
+/// to the elements of its row at the same positions in the layout's rows). Operands
+/// are not copied: elements that are not on the vertex's tile are exchanged by the
+/// compute set in the same way as popops' element-wise inputs.
+void addElementwiseVertices(poplar::Graph& graph, poplar::ComputeSet cs, const std::string& vertexName,
+                            const poplar::Tensor& layout, const VertexFields& fields,
+                            const VertexFields& rowFields, std::size_t cyclesPerElement) {
+  const auto numWorkers = graph.getTarget().getNumWorkerContexts();
+  const auto rowLength = layout.dim(layout.rank() - 1);
+  const auto mapping = graph.getTileMapping(layout);
+  for (auto tile = 0u; tile < mapping.size(); ++tile) {
+    if (mapping[tile].empty()) {
+      continue;
+    }
+    for (const auto& regions : graph.getSortedContiguousRegions(layout, mapping[tile])) {
+      auto v = graph.addVertex(cs, vertexName);
+      std::size_t elements = 0;
+      for (const auto& r : regions) {
+        elements += r.size();
+      }
+      for (const auto& f : fields) {
+        graph.connect(v[f.first], poplar::concat(f.second.flatten().slices(regions)));
+      }
+      if (!rowFields.empty()) {
+        const auto rows = rowIntervals(regions, rowLength);
+        for (const auto& f : rowFields) {
+          graph.connect(v[f.first], poplar::concat(f.second.slices(rows)));
+        }
+      }
+      graph.setTileMapping(v, tile);
+      graph.setPerfEstimate(v, 20 + (elements * cyclesPerElement) / numWorkers);
+    }
+  }
+}
+
+/// Add the twiddle /p w to the fields: as row fields if it is one row of the operands.
+void addTwiddleFields(const complex::ComplexTensor& w, const poplar::Tensor& layout,
+                      VertexFields& fields, VertexFields& rowFields) {
+  auto& target = w.real.shape() == layout.shape() ? fields : rowFields;
+  target.emplace_back("wRe", w.real);
+  target.emplace_back("wIm", w.imag);
+}
+
+/// Build the compute set of fused vertices and add it to /p prog.
+void addFusedOp(poplar::Graph& graph, const std::string& vertexName, const poplar::Tensor& layout,
+                const VertexFields& fields, const VertexFields& rowFields, std::size_t cyclesPerElement,
+                poplar::program::Sequence& prog, const std::string& debugName) {
+  checkOperands(graph, layout, fields, rowFields, debugName);
+  auto cs = graph.addComputeSet(debugName);
+  addElementwiseVertices(graph, cs, poputil::templateVertex(vertexName, layout.elementType()),
+                         layout, fields, rowFields, cyclesPerElement);
+  prog.add(poplar::program::Execute(cs));
+}
+
+} // end anonymous namespace
+
 namespace complex {
 
+  void addCodelets(poplar::Graph& graph, const std::string& codeletDir) {
+    graph.addCodelets(codeletDir + "/FFT/complex_arithmetic.cpp", poplar::CodeletFileType::Auto, "-O3");
+  }
+
+  void multiplyInPlaceFused(poplar::Graph& graph, ComplexTensor& v1, const ComplexTensor& v2,
+                            poplar::program::Sequence& prog, const std::string& debugPrefix) {
+    const auto& layout = v1.real;
+    if (graph.getTileMapping(v1.imag) != graph.getTileMapping(layout)) {
+      ipu_utils::logger()->debug("{}: real and imaginary parts are laid out differently: "
+                                 "using the unfused complex multiply.", debugPrefix);
+      v1.multiplyInPlace(graph, v2, prog, debugPrefix);
+      return;
+    }
+    VertexFields fields = {{"xRe", v1.real}, {"xIm", v1.imag}};
+    VertexFields rowFields;
+    addTwiddleFields(v2, layout, fields, rowFields);
+    addFusedOp(graph, "ComplexMultiply", layout, fields, rowFields, 3, prog, debugPrefix + "/complex_mul_fused");
+  }
+
+  ComplexTensor multiplyAddFused(poplar::Graph& graph, const ComplexTensor& a, const ComplexTensor& b,
+                                 const ComplexTensor& w, poplar::program::Sequence& prog,
+                                 const std::string& debugPrefix) {
+    const auto& layout = a.real;
+    auto result = ComplexTensor(graph.clone(layout, debugPrefix + "/complex_mul_add_re"),
+                                graph.clone(layout, debugPrefix + "/complex_mul_add_im"));
+    VertexFields fields = {
+      {"aRe", a.real}, {"aIm", a.imag},
+      {"bRe", b.real}, {"bIm", b.imag},
+      {"yRe", result.real}, {"yIm", result.imag}
+    };
+    VertexFields rowFields;
+    addTwiddleFields(w, layout, fields, rowFields);
+    addFusedOp(graph, "ComplexMultiplyAdd", layout, fields, rowFields, 4, prog, debugPrefix + "/complex_mul_add_fused");
+    return result;
+  }
+
+  std::pair<ComplexTensor, ComplexTensor> butterfly2Fused(poplar::Graph& graph, const ComplexTensor& a,
+                                                          const ComplexTensor& b, const ComplexTensor& w,
+                                                          poplar::program::Sequence& prog,
+                                                          const std::string& debugPrefix) {
+    const auto& layout = a.real;
+    auto y0 = ComplexTensor(graph.clone(layout, debugPrefix + "/butterfly2_y0_re"),
+                            graph.clone(layout, debugPrefix + "/butterfly2_y0_im"));
+    auto y1 = ComplexTensor(graph.clone(layout, debugPrefix + "/butterfly2_y1_re"),
+                            graph.clone(layout, debugPrefix + "/butterfly2_y1_im"));
+    VertexFields fields = {
+      {"aRe", a.real}, {"aIm", a.imag},
+      {"bRe", b.real}, {"bIm", b.imag},
+      {"y0Re", y0.real}, {"y0Im", y0.imag},
+      {"y1Re", y1.real}, {"y1Im", y1.imag}
+    };
+    VertexFields rowFields;
+    addTwiddleFields(w, layout, fields, rowFields);
+    addFusedOp(graph, "ComplexButterfly2", layout, fields, rowFields, 5, prog, debugPrefix + "/butterfly2_fused");
+    return std::make_pair(y0, y1);
+  }
+
+  std::vector<ComplexTensor> butterfly4Fused(poplar::Graph& graph, const std::vector<ComplexTensor>& x,
+                                             poplar::program::Sequence& prog,
+                                             const std::string& debugPrefix) {
+    if (x.size() != 4) {
+      throw std::logic_error("ComplexTensor: A radix-4 butterfly needs four inputs.");
+    }
+    const auto& layout = x.front().real;
+    VertexFields fields;
+    std::vector<ComplexTensor> y;
+    for (auto j = 0u; j < 4; ++j) {
+      const auto name = std::to_string(j);
+      fields.emplace_back("x" + name + "Re", x[j].real);
+      fields.emplace_back("x" + name + "Im", x[j].imag);
+      y.emplace_back(graph.clone(layout, debugPrefix + "/butterfly4_y" + name + "_re"),
+                     graph.clone(layout, debugPrefix + "/butterfly4_y" + name + "_im"));
+      fields.emplace_back("y" + name + "Re", y.back().real);
+      fields.emplace_back("y" + name + "Im", y.back().imag);
+    }
+    addFusedOp(graph, "ComplexButterfly4", layout, fields, {}, 8, prog, debugPrefix + "/butterfly4_fused");
+    return y;
+  }
+
   poplar::Tensor ComplexTensor::asRowVectors() {
     if (real.rank() != 1) {
       throw std::logic_error("ComplexTensor: This function is only for vectors.");
@@ -38,6 +218,25 @@ namespace complex {
                           ComplexTensor(reOdd, imOdd));
   }
 
+  std::vector<ComplexTensor>
+  ComplexTensor::splitStrided(std::size_t factor) {
+    if (real.rank() != 1 && real.rank() != 2) {
+      throw std::logic_error("ComplexTensor: This function is only for vectors and batches of vectors.");
+    }
+    const auto subSampleDim = real.rank() == 1 ? 0 : 1;
+    const auto vectorLength = real.rank() == 1 ? real.dim(0) : real.dim(1);
+    if (factor == 0 || vectorLength % factor) {
+      throw std::logic_error("ComplexTensor: Vector length must be a multiple of the split factor.");
+    }
+    std::vector<ComplexTensor> parts;
+    parts.reserve(factor);
+    for (auto j = 0u; j < factor; ++j) {
+      parts.emplace_back(real.slice(j, vectorLength, subSampleDim).subSample(factor, subSampleDim),
+                         imag.slice(j, vectorLength, subSampleDim).subSample(factor, subSampleDim));
+    }
+    return parts;
+  }
+
   void ComplexTensor::multiplyInPlace(poplar::Graph& graph,
                                       const ComplexTensor v,
                                       poplar::program::Sequence& prog,
@@ -75,6 +274,35 @@ namespace complex {
     );
   }
 
+  ComplexTensor multiply(poplar::Graph& graph,
+                         const ComplexTensor v1,
+                         const ComplexTensor v2,
+                         float scale,
+                         bool conjugateSecond,
+                         poplar::program::Sequence& prog,
+                         const std::string& debugPrefix) {
+    namespace pe = popops::expr;
+    auto re_v1 = pe::_1;
+    auto im_v1 = pe::_2;
+    auto re_v2 = pe::_3;
+    auto im_v2 = pe::_4;
+    auto s = pe::Const(scale);
+    // Conjugating the second argument flips the sign of its imaginary terms:
+    auto complexMulExprRe = conjugateSecond ?
+      pe::Mul(s, pe::Add(pe::Mul(re_v1, re_v2), pe::Mul(im_v1, im_v2))).clone() :
+      pe::Mul(s, pe::Sub(pe::Mul(re_v1, re_v2), pe::Mul(im_v1, im_v2))).clone();
+    auto complexMulExprIm = conjugateSecond ?
+      pe::Mul(s, pe::Sub(pe::Mul(im_v1, re_v2), pe::Mul(re_v1, im_v2))).clone() :
+      pe::Mul(s, pe::Add(pe::Mul(re_v1, im_v2), pe::Mul(im_v1, re_v2))).clone();
+
+    return ComplexTensor(
+      popops::map(graph, *complexMulExprRe, {v1.real, v1.imag, v2.real, v2.imag},
+                  prog, debugPrefix + "/complex_mul_re"),
+      popops::map(graph, *complexMulExprIm, {v1.real, v1.imag, v2.real, v2.imag},
+                  prog, debugPrefix + "/complex_mul_im")
+    );
+  }
+
   poplar::program::Sequence copy(const ComplexTensor& src, const ComplexTensor& dst) {
     poplar::program::Sequence prog;
     prog.add(poplar::program::Copy(src.real, dst.real));
@@ -82,4 +310,18 @@ namespace complex {
     return prog;
   }
 
+  poplar::program::Sequence copy(const std::vector<ComplexTensor>& src, const std::vector<ComplexTensor>& dst) {
+    if (src.size() != dst.size()) {
+      throw std::logic_error("ComplexTensor: Copy needs the same number of sources and destinations.");
+    }
+    std::vector<poplar::Tensor> from, to;
+    for (const auto& t : src) { from.push_back(t.real.flatten()); }
+    for (const auto& t : src) { from.push_back(t.imag.flatten()); }
+    for (const auto& t : dst) { to.push_back(t.real.flatten()); }
+    for (const auto& t : dst) { to.push_back(t.imag.flatten()); }
+    poplar::program::Sequence prog;
+    prog.add(poplar::program::Copy(poplar::concat(from), poplar::concat(to)));
+    return prog;
+  }
+
 } // namespace complex
\ No newline at end of file
@@ -76,6 +76,12 @@ struct ComplexTensor {
   /// Excpets if this is not a vector.
   std::pair<ComplexTensor, ComplexTensor> splitEvenOdd();
 
+  /// Generalisation of splitEvenOdd(): split vectors into /p factor
+  /// sub-sequences where sub-sequence j holds elements j, j + factor,
+  /// j + 2 * factor etc. Excepts if this is not a vector or the vector
+  /// length is not a multiple of the factor.
+  std::vector<ComplexTensor> splitStrided(std::size_t factor);
+
   void multiplyInPlace(poplar::Graph& graph,
                        const ComplexTensor v,
                        poplar::program::Sequence& prog,
@@ -89,7 +95,59 @@ ComplexTensor multiply(poplar::Graph& graph,
                         poplar::program::Sequence& prog,
                         const std::string& debugPrefix="");
 
+/// Element-wise multiply of two complex tensors in a single pass that
+/// also scales the result by a real constant. If /p conjugateSecond is
+/// true the result is v1 * conj(v2) (e.g. for cross-correlation).
+ComplexTensor multiply(poplar::Graph& graph,
+                        const ComplexTensor v1,
+                        const ComplexTensor v2,
+                        float scale,
+                        bool conjugateSecond,
+                        poplar::program::Sequence& prog,
+                        const std::string& debugPrefix="");
+
+/// Return a view that swaps the real and imaginary parts (i.e. i * conj(v)).
+inline ComplexTensor swapParts(const ComplexTensor& v) { return ComplexTensor(v.imag, v.real); }
+
+/// Add the fused complex arithmetic vertices (FFT/complex_arithmetic.cpp
+/// in the codelet directory) to the graph. The *Fused functions need them.
+void addCodelets(poplar::Graph& graph, const std::string& codeletDir);
+
+// Fused versions of the element-wise ops: each is a single compute set of vectorised
+// vertices that read both planes of every operand in one pass (instead of a compute set
+// and a temporary per real op). The vertices are laid out like the real part of the first
+// operand. Operands laid out differently are not copied: their elements are exchanged to
+// the vertices by the compute set. The twiddle w may either have the operands' shape or
+// be a single row (the size of their last dimension) that is applied to every row without
+// being broadcast in memory. Element types must be half or float.
+
+/// Element-wise v1 *= v2 in-place. Falls back to ComplexTensor::multiplyInPlace()
+/// if the real and imaginary parts of v1 are laid out differently.
+void multiplyInPlaceFused(poplar::Graph& graph, ComplexTensor& v1, const ComplexTensor& v2,
+                          poplar::program::Sequence& prog, const std::string& debugPrefix="");
+
+/// Return a + w * b (element-wise).
+ComplexTensor multiplyAddFused(poplar::Graph& graph, const ComplexTensor& a, const ComplexTensor& b,
+                               const ComplexTensor& w, poplar::program::Sequence& prog,
+                               const std::string& debugPrefix="");
+
+/// Radix-2 butterfly with the twiddle folded in: return (a + w * b, a - w * b).
+std::pair<ComplexTensor, ComplexTensor> butterfly2Fused(poplar::Graph& graph, const ComplexTensor& a,
+                                                        const ComplexTensor& b, const ComplexTensor& w,
+                                                        poplar::program::Sequence& prog,
+                                                        const std::string& debugPrefix="");
+
+/// Radix-4 butterfly of the (already twiddled) x[0..3]: returns y[0..3]
+/// where y_q = sum_j x_j exp(-2 pi i j q / 4).
+std::vector<ComplexTensor> butterfly4Fused(poplar::Graph& graph, const std::vector<ComplexTensor>& x,
+                                           poplar::program::Sequence& prog,
+                                           const std::string& debugPrefix="");
+
 /// Create copy program for both real and imaginary parts:
 poplar::program::Sequence copy(const ComplexTensor& src, const ComplexTensor& dst);
 
+/// Copy several complex tensors (src[i] to dst[i]) with a single copy
+/// program so that all the transfers take place in one exchange.
+poplar::program::Sequence copy(const std::vector<ComplexTensor>& src, const std::vector<ComplexTensor>& dst);
+
 } // namespace complex
@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include "utils.hpp"
 
+#include <algorithm>
+
 poplar::Tensor vstack(const std::vector<poplar::Tensor>& vectors) {
   std::vector<poplar::Tensor> rowVectors;
   rowVectors.reserve(vectors.size());
@@ -36,3 +38,29 @@ poplar::Tensor hstack(const std::vector<poplar::Tensor>& vectors) {
 
   return poplar::concat(colVectors, 1);
 }
+
+TileMemoryStats tileMemoryStats(poplar::Graph& graph, const std::vector<poplar::Tensor>& tensors) {
+  const auto& target = graph.getTarget();
+  std::vector<std::size_t> tileBytes(target.getNumTiles(), 0);
+  for (const auto& t : tensors) {
+    const auto typeSize = target.getTypeSize(t.elementType());
+    const auto mapping = graph.getTileMapping(t);
+    for (auto tile = 0u; tile < mapping.size(); ++tile) {
+      for (const auto& interval : mapping[tile]) {
+        tileBytes[tile] += interval.size() * typeSize;
+      }
+    }
+  }
+
+  TileMemoryStats stats;
+  for (const auto bytes : tileBytes) {
+    stats.totalBytes += bytes;
+    stats.tilesUsed += bytes != 0;
+    stats.maxTileBytes = std::max(stats.maxTileBytes, bytes);
+  }
+  if (stats.tilesUsed) {
+    stats.meanTileBytes = double(stats.totalBytes) / stats.tilesUsed;
+    stats.imbalance = stats.maxTileBytes / stats.meanTileBytes;
+  }
+  return stats;
+}
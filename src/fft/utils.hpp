@@ -7,6 +7,18 @@
 poplar::Tensor vstack(const std::vector<poplar::Tensor>& vectors);
 poplar::Tensor hstack(const std::vector<poplar::Tensor>& vectors);
 
+/// Summary of how a set of tensors is spread over the tiles.
+struct TileMemoryStats {
+  std::size_t totalBytes = 0;
+  std::size_t tilesUsed = 0;
+  std::size_t maxTileBytes = 0;
+  double meanTileBytes = 0.0; // Mean over the tiles used.
+  double imbalance = 0.0;     // maxTileBytes / meanTileBytes (1 is perfectly balanced).
+};
+
+/// Return the per-tile memory statistics of the (already mapped) tensors.
+TileMemoryStats tileMemoryStats(poplar::Graph& graph, const std::vector<poplar::Tensor>& tensors);
+
 template <class T>
 std::vector<T> slice(const std::vector<T>& v, std::size_t start, std::size_t end) {
   return std::vector<T>(v.begin() + start, v.begin() + end);
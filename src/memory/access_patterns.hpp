@@ -0,0 +1,133 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace access_patterns {
+
+/// Distributions of indices into a table of lines (e.g. rows of a remote buffer).
+enum class Pattern {
+  Uniform,    // Every line is equally likely.
+  Zipf,       // Line of popularity rank k has probability proportional to 1 / (k + 1)^skew.
+  Sequential, // Scan through the lines in order (wrapping around at the end).
+  Trace       // Replay indices read from a file (wrapping around at the end).
+};
+
+inline Pattern parsePattern(const std::string& name) {
+  if (name == "uniform") { return Pattern::Uniform; }
+  if (name == "zipf") { return Pattern::Zipf; }
+  if (name == "sequential") { return Pattern::Sequential; }
+  if (name == "trace") { return Pattern::Trace; }
+  throw std::runtime_error("Unknown access pattern: '" + name + "' (choose uniform, zipf, sequential or trace).");
+}
+
+/// Read a trace of whitespace separated line indices from a text file.
+inline std::vector<std::uint32_t> readTrace(const std::string& fileName, std::size_t numLines) {
+  std::ifstream file(fileName);
+  if (!file) {
+    throw std::runtime_error("Could not open access trace file: '" + fileName + "'");
+  }
+  std::vector<std::uint32_t> trace;
+  std::uint64_t index;
+  while (file >> index) {
+    if (index >= numLines) {
+      throw std::runtime_error("Access trace index " + std::to_string(index) +
+                               " is out of range for a table of " + std::to_string(numLines) + " lines.");
+    }
+    trace.push_back(index);
+  }
+  if (!file.eof()) {
+    throw std::runtime_error("Access trace file '" + fileName + "' contains something that is not an index.");
+  }
+  if (trace.empty()) {
+    throw std::runtime_error("Access trace file '" + fileName + "' is empty.");
+  }
+  return trace;
+}
+
+/// Generates an endless stream of line indices with the chosen pattern.
+/// Not thread safe: use one generator per thread.
+class Generator {
+public:
+  Generator(Pattern p, std::size_t lines, std::uint64_t seed,
+            double zipfSkew = 1.0, const std::string& traceFile = "")
+  : pattern(p), numLines(lines), rng(seed), uniform(0, lines - 1), position(0)
+  {
+    if (numLines == 0) {
+      throw std::logic_error("Access pattern needs at least one line.");
+    }
+
+    if (pattern == Pattern::Zipf) {
+      if (zipfSkew < 0.0) {
+        throw std::runtime_error("Zipf skew must not be negative.");
+      }
+      // The most popular lines are scattered over the table (rather than
+      // just being the first few lines) by a random permutation:
+      cdf.resize(numLines);
+      double sum = 0.0;
+      for (std::size_t k = 0; k < numLines; ++k) {
+        sum += 1.0 / std::pow(double(k + 1), zipfSkew);
+        cdf[k] = sum;
+      }
+      for (auto& c : cdf) { c /= sum; }
+      rankToLine.resize(numLines);
+      std::iota(rankToLine.begin(), rankToLine.end(), 0);
+      std::shuffle(rankToLine.begin(), rankToLine.end(), rng);
+    } else if (pattern == Pattern::Trace) {
+      trace = readTrace(traceFile, numLines);
+      ipu_utils::logger()->info("Read access trace of {} indices from '{}'", trace.size(), traceFile);
+    }
+  }
+
+  std::uint32_t next() {
+    switch (pattern) {
+      case Pattern::Uniform:
+        return uniform(rng);
+      case Pattern::Zipf: {
+        const auto u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        const auto rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return rankToLine[std::min<std::size_t>(rank, numLines - 1)];
+      }
+      case Pattern::Sequential: {
+        const auto line = position;
+        position = (position + 1) % numLines;
+        return line;
+      }
+      case Pattern::Trace: {
+        const auto line = trace[position];
+        position = (position + 1) % trace.size();
+        return line;
+      }
+    }
+    throw std::logic_error("Invalid access pattern.");
+  }
+
+  void fill(std::uint32_t* out, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      out[i] = next();
+    }
+  }
+
+private:
+  const Pattern pattern;
+  const std::size_t numLines;
+  std::mt19937_64 rng;
+  std::uniform_int_distribution<std::uint32_t> uniform;
+  std::size_t position;
+  std::vector<double> cdf;
+  std::vector<std::uint32_t> rankToLine;
+  std::vector<std::uint32_t> trace;
+};
+
+} // end namespace access_patterns
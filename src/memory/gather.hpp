@@ -14,34 +14,43 @@
 
 namespace gather {
 
+/// Gathers outputs rows of a [inputs, dimension] table. If usePlan is set
+/// the slice is planned by popops within the given memory budget (the
+/// proportion of tile memory available for temporaries). The plan must be
+/// made before creating any tensors.
 struct MultiSlice {
   const std::string name;
   std::size_t inputSize;
   std::size_t featureSize;
   std::size_t outputSize;
+  poplar::Type dataType;
+  float availableMemoryProportion;
   poplar::OptionFlags optionFlags;
   popops::SlicePlan slicePlan;
   const bool planned;
 
   MultiSlice(const std::string& name,
-             std::size_t inputs, std::size_t dimension, std::size_t outputs, bool usePlan) :
+             std::size_t inputs, std::size_t dimension, std::size_t outputs, bool usePlan,
+             poplar::Type type = poplar::FLOAT, float memoryProportion = 0.1f) :
               name(name),
               inputSize(inputs),
               featureSize(dimension),
               outputSize(outputs),
+              dataType(type),
+              availableMemoryProportion(memoryProportion),
               planned(usePlan)
   {}
 
   void plan(poplar::Graph& graph) {
     if (planned) {
-      optionFlags = {{"availableMemoryProportion", "0.1"}, {"usedForUpdate", "false"}};
-      slicePlan = popops::embedding::plan(graph, poplar::FLOAT, inputSize, featureSize, {outputSize, 1}, optionFlags);
+      optionFlags = {{"availableMemoryProportion", std::to_string(availableMemoryProportion)}, {"usedForUpdate", "false"}};
+      slicePlan = popops::embedding::plan(graph, dataType, inputSize, featureSize, {outputSize, 1}, optionFlags);
     }
   }
 
   poplar::Tensor createValues(poplar::Graph& graph) {
     ipu_utils::logger()->info("inputSize: {} feature Size: {}", inputSize, featureSize);
-    return popops::createSliceableTensor(graph, poplar::FLOAT, {inputSize, featureSize}, {0}, {1}, slicePlan, optionFlags, name + "/values");
+    return popops::createSliceableTensor(graph, dataType, {inputSize, featureSize}, {0}, {1}, slicePlan, optionFlags, name + "/values");
   }
 
   poplar::Tensor createIndices(poplar::Graph& graph) {
@@ -18,35 +18,83 @@
 
 namespace scatter {
 
+/// Scatters count rows into a [featureCount, featureSize] table, either
+/// overwriting the rows (createProgram()) or accumulating into them
+/// (createAccumulateProgram(), in which case accumulate must be set so that
+/// the plan is made for an add). If usePlan is set the update is planned by
+/// popops within the given memory budget (the proportion of tile memory
+/// available for temporaries). The plan must be made before creating any
+/// tensors and is most effective when the destination is also created from
+/// it with createDestination().
 struct MultiUpdate {
   const std::string name;
-  const poplar::Tensor valuesToUpdate;
+  poplar::Tensor valuesToUpdate;
   const std::size_t featureCount;
   const std::size_t featureSize;
   const std::size_t count;
+  const poplar::Type dataType;
+  const float availableMemoryProportion;
+  const bool accumulate;
   poplar::OptionFlags optionFlags;
   popops::SlicePlan slicePlan;
   const bool planned;
 
+  /// Update an existing table.
   MultiUpdate(const std::string& name,
               poplar::Tensor destination,
-              std::size_t updateCount, bool usePlan)
+              std::size_t updateCount, bool usePlan,
+              float memoryProportion = 0.2f, bool accumulateUpdates = false)
   :
+    name(name),
     valuesToUpdate(destination),
     featureCount(destination.dim(0)),
     featureSize(destination.dim(1)),
     count(updateCount),
+    dataType(destination.elementType()),
+    availableMemoryProportion(memoryProportion),
+    accumulate(accumulateUpdates),
+    planned(usePlan)
+  {}
+
+  /// Update a table that will be created by createDestination().
+  MultiUpdate(const std::string& name,
+              poplar::Type type, std::size_t rows, std::size_t dimension,
+              std::size_t updateCount, bool usePlan,
+              float memoryProportion = 0.2f, bool accumulateUpdates = false)
+  :
+    name(name),
+    featureCount(rows),
+    featureSize(dimension),
+    count(updateCount),
+    dataType(type),
+    availableMemoryProportion(memoryProportion),
+    accumulate(accumulateUpdates),
     planned(usePlan)
   {}
 
   void plan(poplar::Graph& graph) {
     if (planned) {
-      optionFlags = {{"availableMemoryProportion", "0.2"}, {"usedForUpdate", "true"}};
-      // multiUpdate doesn't support slice plans at the moment:
-      //slicePlan = popops::embedding::plan(graph, poplar::FLOAT, featureCount, featureSize, {count, 1}, optionFlags);
+      optionFlags = {
+        {"availableMemoryProportion", std::to_string(availableMemoryProportion)},
+        {"usedForSlice", "false"},
+        {"usedForUpdate", "true"}
+      };
+      if (accumulate) {
+        optionFlags.set("operationForUpdate", "add");
+      }
+      slicePlan = popops::embedding::plan(graph, dataType, featureCount, featureSize, {count, 1}, optionFlags);
     }
   }
 
+  poplar::Tensor createDestination(poplar::Graph& graph) {
+    if (valuesToUpdate.valid()) {
+      throw std::logic_error("MultiUpdate '" + name + "' already has a destination.");
+    }
+    valuesToUpdate = popops::createSliceableTensor(graph, dataType, {featureCount, featureSize}, {0}, {1},
+                                                   slicePlan, optionFlags, name + "/destination");
+    return valuesToUpdate;
+  }
+
   poplar::Tensor createSource(poplar::Graph& graph) {
     auto sliceFrom = popops::createSliceTensor(graph, valuesToUpdate, {0}, {1}, count, name + "/source");
     return sliceFrom;
@@ -56,6 +104,7 @@ struct MultiUpdate {
     return popops::createIndicesTensor(graph, {0}, count, slicePlan, optionFlags, name + "/indices");
   }
 
+  /// Overwrite the rows of the destination given by the indices.
   void createProgram(poplar::Graph& graph,
                      const poplar::Tensor& valuesToInsert,
                      const poplar::Tensor& indicesToUpdate,
@@ -67,6 +116,20 @@ struct MultiUpdate {
 
     popops::multiUpdate(graph, valuesToUpdate, valuesToInsert, indicesToUpdate, {0}, {1}, program, slicePlan, optionFlags, name + "/output");
   }
+
+  /// Add scale * valuesToAdd to the rows of the destination given by the
+  /// indices (repeated indices accumulate). scale is a scalar of the destination type.
+  void createAccumulateProgram(poplar::Graph& graph,
+                               const poplar::Tensor& valuesToAdd,
+                               const poplar::Tensor& indicesToUpdate,
+                               const poplar::Tensor& scale,
+                               poplar::program::Sequence& program) {
+    if (planned && !accumulate) {
+      throw std::logic_error("MultiUpdate '" + name + "' was planned for overwrites: set accumulate "
+                             "to create an accumulate program.");
+    }
+    popops::multiUpdateAdd(graph, valuesToUpdate, valuesToAdd, indicesToUpdate, scale, {0}, {1}, program, slicePlan, optionFlags, name + "/accumulate");
+  }
 };
 
 } // end namespace scatter
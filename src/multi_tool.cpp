@@ -1,11 +1,20 @@
 // Copyright (c) 2021 Graphcore Ltd. All rights reserved.
 
 #include <cstdlib>
+#include <algorithm>
 #include <vector>
 #include <limits>
 #include <chrono>
 #include <memory>
 #include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
 
 #include <boost/program_options.hpp>
 #include "io_utils.hpp"
@@ -59,10 +68,16 @@ std::pair<std::string, ToolFactoryFunction> parseToolName(int argc, char** argv)
   return std::make_pair(toolName, globalTools.at(toolName));
 }
 
-/// Parse the general options and options for the selected tool in one go:
+/// A list of option name and value pairs.
+using OptionOverrides = std::vector<std::pair<std::string, std::string>>;
+
+/// Parse the general options and options for the selected tool in one go.
+/// Any options in overrides replace those given on the command line (this
+/// is used to set the options for each point of a sweep).
 void parseOptions(int argc, char** argv,
                   boost::program_options::options_description& toolOptionsDesc,
-                  boost::program_options::variables_map& args) {
+                  boost::program_options::variables_map& args,
+                  const OptionOverrides& overrides = {}) {
   namespace po = boost::program_options;
   po::options_description desc("General Options");
 
@@ -95,17 +110,51 @@ void parseOptions(int argc, char** argv,
   ("attach-immediately", po::bool_switch()->default_value(false),
   "If false (default) then the device is not acquired until the program is ready to run, if true then the device is acquired before compilation but this does not currently work on IPUOF systems (program will abort)."
   )
+  ("warmup-iterations", po::value<std::size_t>()->default_value(0),
+  "Number of untimed runs of each timed program before measurement starts.")
+  ("trials", po::value<std::size_t>()->default_value(1),
+  "Number of timed runs of each timed program (tools report min/median/p99/stddev over these). Must be at least one.")
   ("log-level", po::value<std::string>()->default_value("debug"),
   "Set the log level to one of the following: 'trace', 'debug', 'info', 'warn', 'err', 'critical', 'off'.")
   ("codelet-path", po::value<std::string>()->default_value(DEFAULT_CODELET_DIR),
   "Set the path to search for tool codelets.")
+  ("results-file", po::value<std::string>()->default_value(""),
+  "If set, append the tool's recorded results and options to this file. A '.csv' extension writes "
+  "CSV (one row per result), otherwise one JSON object per run is written on each line (JSON lines).")
+  ("exe-cache", po::value<std::string>()->default_value(""),
+  "Directory for an automatic cache of compiled executables. A run whose tool, options, Poplar version, "
+  "target, build of this program and codelet sources match a previous run loads the cached executable "
+  "instead of building and compiling the graph.")
+  ("compile-target", po::value<std::string>()->default_value(""),
+  "Compile for this IPU architecture (e.g. 'ipu2') without acquiring any hardware. Requires compile-only.")
+  ("compile-threads", po::value<std::size_t>()->default_value(0),
+  "Number of sweep points to compile concurrently when sweep and compile-only are set (0 means one per "
+  "hardware thread). Concurrency is further limited by the compile memory budget.")
+  ("compile-memory-per-job", po::value<double>()->default_value(8.0),
+  "Estimate of the host memory (GB) needed to compile one sweep point.")
+  ("compile-memory-budget", po::value<double>()->default_value(0.0),
+  "Host memory (GB) that concurrent compilations may use. If zero, the memory currently available is used.")
+  ("sweep", po::value<std::string>()->default_value(""),
+  "Run the tool once for every point in a grid of option values without restarting the process or "
+  "releasing the device. Format: 'opt1=a,b,c;opt2=x,y' (options must take a value).")
   ;
 
   po::options_description all("All Options");
   all.add(desc).add(toolOptionsDesc);
 
   auto parser = po::command_line_parser(argc, argv).options(all);
-  po::store(parser.run(), args);
+  auto parsed = parser.run();
+  if (!overrides.empty()) {
+    auto& opts = parsed.options;
+    opts.erase(std::remove_if(opts.begin(), opts.end(), [&](const po::option& o) {
+      return std::any_of(overrides.begin(), overrides.end(),
+                         [&](const OptionOverrides::value_type& v) { return v.first == o.string_key; });
+    }), opts.end());
+    for (const auto& v : overrides) {
+      opts.push_back(po::option(v.first, {v.second}));
+    }
+  }
+  po::store(parsed, args);
   if (args.count("help")) {
     std::cout << all << "\n";
     std::exit(0);
@@ -117,9 +166,80 @@ void parseOptions(int argc, char** argv,
     throw std::logic_error("You can not set both save-exe and load-exe.");
   }
 
+  if (args.at("trials").as<std::size_t>() == 0) {
+    throw std::logic_error("The number of trials must be at least one.");
+  }
+}
+
+std::map<std::string, std::string> optionsToStrings(const boost::program_options::variables_map& args);
+
+/// Identify the build of this program (its size and modification time) so that
+/// rebuilt tool code never loads an executable compiled by an older build.
+std::string buildIdentifier() {
+  std::error_code error;
+  const auto exe = std::filesystem::read_symlink("/proc/self/exe", error);
+  if (error) {
+    return "unknown";
+  }
+  const auto size = std::filesystem::file_size(exe, error);
+  const auto modified = std::filesystem::last_write_time(exe, error);
+  if (error) {
+    return "unknown";
+  }
+  std::stringstream id;
+  id << exe.string() << ":" << size << ":" << modified.time_since_epoch().count();
+  return id.str();
 }
 
-ipu_utils::RuntimeConfig configFromOptions(const boost::program_options::variables_map& args) {
+/// Hash of the names and contents of every file under the codelet directory
+/// (in a fixed order) so that editing a codelet source invalidates the cache.
+std::string codeletDirectoryHash(const std::string& codeletDir) {
+  std::error_code error;
+  std::vector<std::filesystem::path> files;
+  for (auto it = std::filesystem::recursive_directory_iterator(codeletDir, error);
+       !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+    if (it->is_regular_file()) {
+      files.push_back(it->path());
+    }
+  }
+  if (error) {
+    return "unknown";
+  }
+  std::sort(files.begin(), files.end());
+  std::stringstream contents;
+  for (const auto& f : files) {
+    std::ifstream fs(f, std::ios::binary);
+    contents << f.string() << "\n" << fs.rdbuf() << "\n";
+  }
+  std::stringstream hash;
+  hash << std::hex << ipu_utils::stableHash(contents.str());
+  return hash.str();
+}
+
+/// Build the part of the executable cache key that comes from the command line, the
+/// build of this program and the codelet sources. General options that can not change
+/// the compiled graph are left out so that they do not cause needless cache misses.
+std::string makeExeCacheKey(const std::string& toolName,
+                            const boost::program_options::variables_map& args) {
+  const std::set<std::string> ignored = {
+    "help", "save-exe", "load-exe", "compile-only", "attach-immediately", "log-level",
+    "results-file", "exe-cache", "sweep", "warmup-iterations", "trials",
+    "compile-target", "compile-threads", "compile-memory-per-job", "compile-memory-budget"
+  };
+  std::stringstream key;
+  key << "tool=" << toolName << "\n";
+  key << "build=" << buildIdentifier() << "\n";
+  key << "codelets=" << codeletDirectoryHash(args.at("codelet-path").as<std::string>()) << "\n";
+  for (const auto& o : optionsToStrings(args)) {
+    if (ignored.count(o.first) == 0) {
+      key << o.first << "=" << o.second << "\n";
+    }
+  }
+  return key.str();
+}
+
+ipu_utils::RuntimeConfig configFromOptions(const std::string& toolName,
+                                           const boost::program_options::variables_map& args) {
   auto exeName = args.at("save-exe").as<std::string>();
   if (exeName.empty()) { exeName = args.at("load-exe").as<std::string>(); }
 
@@ -131,7 +251,12 @@ ipu_utils::RuntimeConfig configFromOptions(const boost::program_options::variabl
     !args.at("save-exe").as<std::string>().empty(),
     !args.at("load-exe").as<std::string>().empty(),
     args.at("compile-only").as<bool>(),
-    args.at("compile-only").as<bool>() || !args.at("attach-immediately").as<bool>()
+    args.at("compile-only").as<bool>() || !args.at("attach-immediately").as<bool>(),
+    args.at("warmup-iterations").as<std::size_t>(),
+    args.at("trials").as<std::size_t>(),
+    args.at("exe-cache").as<std::string>(),
+    makeExeCacheKey(toolName, args),
+    args.at("compile-target").as<std::string>()
   };
 }
 
@@ -191,6 +316,352 @@ void deserialiseAndParseCommandLine(std::istream& is,
   parseOptions(argc, &subStrPtrs[0], desc, result);
 }
 
+// Convert the parsed option values to strings so they can be recorded with results:
+std::map<std::string, std::string> optionsToStrings(const boost::program_options::variables_map& args) {
+  std::map<std::string, std::string> strings;
+  for (const auto& p : args) {
+    const auto& v = p.second.value();
+    std::stringstream ss;
+    if (auto s = boost::any_cast<std::string>(&v)) {
+      ss << *s;
+    } else if (auto b = boost::any_cast<bool>(&v)) {
+      ss << (*b ? "true" : "false");
+    } else if (auto s = boost::any_cast<std::size_t>(&v)) {
+      ss << *s;
+    } else if (auto u = boost::any_cast<unsigned>(&v)) {
+      ss << *u;
+    } else if (auto i = boost::any_cast<int>(&v)) {
+      ss << *i;
+    } else if (auto f = boost::any_cast<float>(&v)) {
+      ss << *f;
+    } else if (auto d = boost::any_cast<double>(&v)) {
+      ss << *d;
+    } else if (auto vs = boost::any_cast<std::vector<std::string>>(&v)) {
+      for (auto i = 0u; i < vs->size(); ++i) {
+        ss << (i ? " " : "") << (*vs)[i];
+      }
+    } else {
+      ss << "<unknown-type>";
+    }
+    strings.insert(std::make_pair(p.first, ss.str()));
+  }
+  return strings;
+}
+
+std::string jsonEscape(const std::string& s) {
+  std::stringstream ss;
+  for (const char c : s) {
+    switch (c) {
+      case '"': ss << "\\\""; break;
+      case '\\': ss << "\\\\"; break;
+      case '\n': ss << "\\n"; break;
+      case '\t': ss << "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        } else {
+          ss << c;
+        }
+    }
+  }
+  return ss.str();
+}
+
+std::string csvEscape(const std::string& s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) {
+    return s;
+  }
+  std::string quoted = "\"";
+  for (const char c : s) {
+    if (c == '"') { quoted += '"'; }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string formatValue(double value) {
+  if (!std::isfinite(value)) { return "null"; }
+  std::stringstream ss;
+  ss << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+  return ss.str();
+}
+
+/// Write one JSON object describing the run on a single line (JSON lines format
+/// means many runs can be appended to the same file).
+void writeResultsJson(std::ostream& os, const std::string& toolName,
+                      const std::map<std::string, std::string>& options,
+                      const ipu_utils::ResultsRecorder& results) {
+  os << "{\"tool\": \"" << jsonEscape(toolName) << "\", \"options\": {";
+  bool first = true;
+  for (const auto& o : options) {
+    os << (first ? "" : ", ") << "\"" << jsonEscape(o.first) << "\": \"" << jsonEscape(o.second) << "\"";
+    first = false;
+  }
+  os << "}, \"results\": [";
+  first = true;
+  for (const auto& r : results.get()) {
+    os << (first ? "" : ", ")
+       << "{\"name\": \"" << jsonEscape(r.name) << "\", \"value\": " << formatValue(r.value)
+       << ", \"unit\": \"" << jsonEscape(r.unit) << "\"}";
+    first = false;
+  }
+  os << "]}\n";
+}
+
+/// Write one CSV row per result. The header is only written if the file is new.
+/// Appending to a file with different columns (e.g. results from another tool) is an error.
+void writeResultsCsv(const std::string& fileName, const std::string& toolName,
+                     const std::map<std::string, std::string>& options,
+                     const ipu_utils::ResultsRecorder& results) {
+  std::stringstream header;
+  header << "tool,metric,value,unit";
+  for (const auto& o : options) {
+    header << "," << csvEscape(o.first);
+  }
+
+  std::string existingHeader;
+  {
+    std::ifstream in(fileName);
+    std::getline(in, existingHeader);
+  }
+  if (!existingHeader.empty() && existingHeader != header.str()) {
+    throw std::runtime_error("Results file '" + fileName + "' has incompatible CSV columns.");
+  }
+
+  std::ofstream os(fileName, std::ios::app);
+  if (existingHeader.empty()) {
+    os << header.str() << "\n";
+  }
+  for (const auto& r : results.get()) {
+    os << csvEscape(toolName) << "," << csvEscape(r.name) << ","
+       << formatValue(r.value) << "," << csvEscape(r.unit);
+    for (const auto& o : options) {
+      os << "," << csvEscape(o.second);
+    }
+    os << "\n";
+  }
+}
+
+void writeResults(const std::string& fileName, const std::string& toolName,
+                  const boost::program_options::variables_map& args,
+                  const ipu_utils::ResultsRecorder& results) {
+  const auto options = optionsToStrings(args);
+  const std::string csvExt = ".csv";
+  const bool csv = fileName.size() >= csvExt.size() &&
+                   fileName.compare(fileName.size() - csvExt.size(), csvExt.size(), csvExt) == 0;
+  if (csv) {
+    writeResultsCsv(fileName, toolName, options, results);
+  } else {
+    std::ofstream os(fileName, std::ios::app);
+    writeResultsJson(os, toolName, options, results);
+  }
+  ipu_utils::logger()->info("Wrote {} results to '{}'", results.get().size(), fileName);
+}
+
+/// Parse a sweep specification of the form 'opt1=a,b,c;opt2=x,y' and
+/// return the list of option overrides for every point in the grid.
+std::vector<OptionOverrides> parseSweep(const std::string& spec) {
+  std::vector<std::pair<std::string, std::vector<std::string>>> axes;
+  std::stringstream specStream(spec);
+  std::string axis;
+  while (std::getline(specStream, axis, ';')) {
+    if (axis.empty()) { continue; }
+    auto eq = axis.find('=');
+    std::vector<std::string> values;
+    if (eq != std::string::npos) {
+      std::stringstream valueStream(axis.substr(eq + 1));
+      std::string v;
+      while (std::getline(valueStream, v, ',')) {
+        if (!v.empty()) { values.push_back(v); }
+      }
+    }
+    if (eq == std::string::npos || eq == 0 || values.empty()) {
+      throw std::runtime_error("Invalid sweep axis: '" + axis + "' (expected 'option=v1,v2,...').");
+    }
+    axes.push_back(std::make_pair(axis.substr(0, eq), values));
+  }
+
+  // Cartesian product (last axis varies fastest):
+  std::vector<OptionOverrides> points = {{}};
+  for (const auto& a : axes) {
+    std::vector<OptionOverrides> expanded;
+    for (const auto& p : points) {
+      for (const auto& v : a.second) {
+        expanded.push_back(p);
+        expanded.back().push_back(std::make_pair(a.first, v));
+      }
+    }
+    points = expanded;
+  }
+  return points;
+}
+
+std::string toString(const OptionOverrides& point) {
+  std::stringstream ss;
+  for (const auto& o : point) {
+    ss << "--" << o.first << " " << o.second << " ";
+  }
+  return ss.str();
+}
+
+/// Return the host memory available in GB (MemAvailable from /proc/meminfo) or zero if unknown.
+double availableHostMemoryGB() {
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  std::size_t kiloBytes;
+  std::string unit;
+  while (meminfo >> key >> kiloBytes >> unit) {
+    if (key == "MemAvailable:") {
+      return kiloBytes * 1e-6;
+    }
+  }
+  return 0.0;
+}
+
+/// One point of a sweep: the options that were overridden and the initialised tool.
+struct SweepJob {
+  OptionOverrides point;
+  std::unique_ptr<ToolInterface> tool;
+  boost::program_options::variables_map opts;
+};
+
+/// Create and initialise a tool for one point of a sweep.
+SweepJob makeSweepJob(int argc, char** argv, const std::string& toolName,
+                      ToolFactoryFunction factoryFunc, const OptionOverrides& point) {
+  SweepJob job{point, factoryFunc(), {}};
+  boost::program_options::options_description desc(toolName + " Options");
+  job.tool->addToolOptions(desc);
+  parseOptions(argc, argv, desc, job.opts, point);
+  boost::program_options::notify(job.opts);
+
+  auto cfg = configFromOptions(toolName, job.opts);
+  if (cfg.saveExe || cfg.loadExe) {
+    throw std::logic_error("Options save-exe and load-exe can not be used in sweep mode.");
+  }
+  job.tool->setRuntimeConfig(cfg);
+  job.tool->init(job.opts);
+  return job;
+}
+
+/// Compile sweep jobs into the executable cache using a pool of host
+/// threads. The number of concurrent compilations is bounded by the
+/// thread count and by the memory budget divided by the per job estimate.
+/// Returns the number of jobs that failed.
+std::size_t compileSweep(std::vector<SweepJob>& jobs,
+                         const boost::program_options::variables_map& args) {
+  std::size_t threads = args.at("compile-threads").as<std::size_t>();
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  auto budget = args.at("compile-memory-budget").as<double>();
+  if (budget <= 0.0) {
+    budget = availableHostMemoryGB();
+  }
+  const auto perJob = args.at("compile-memory-per-job").as<double>();
+  if (budget > 0.0 && perJob > 0.0) {
+    const std::size_t memoryLimit = std::max(1.0, std::floor(budget / perJob));
+    threads = std::min(threads, memoryLimit);
+  }
+  threads = std::max<std::size_t>(1, std::min(threads, jobs.size()));
+  ipu_utils::logger()->info("Compiling {} sweep points using {} threads (memory budget: {} GB, per job: {} GB)",
+                            jobs.size(), threads, budget, perJob);
+
+  std::atomic<std::size_t> next(0);
+  std::atomic<std::size_t> failures(0);
+  auto worker = [&]() {
+    for (auto i = next++; i < jobs.size(); i = next++) {
+      int exitCode = EXIT_FAILURE;
+      try {
+        auto& builder = jobs[i].tool->getGraphBuilder();
+        auto device = ipu_utils::GraphManager::getDevice(builder);
+        exitCode = ipu_utils::GraphManager().run(builder, *device);
+      } catch (const std::exception& e) {
+        ipu_utils::logger()->error("Exception: {}", e.what());
+      }
+      if (exitCode != EXIT_SUCCESS) {
+        ipu_utils::logger()->error("Compilation failed for sweep point: {}", toString(jobs[i].point));
+        failures += 1;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (auto t = 0u; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  for (auto& t : pool) {
+    t.join();
+  }
+  return failures;
+}
+
+/// Run every point in the sweep grid in this process. A device is acquired once and
+/// is only released if a sweep point needs a differently configured device. Failed
+/// points are logged and skipped. In compile only mode the points are compiled in
+/// parallel into the executable cache instead.
+int runSweep(int argc, char** argv, const std::string& toolName,
+             ToolFactoryFunction factoryFunc, const std::string& sweepSpec,
+             const boost::program_options::variables_map& args) {
+  const auto points = parseSweep(sweepSpec);
+  ipu_utils::logger()->info("Sweep has {} points", points.size());
+
+  const bool compileOnly = args.at("compile-only").as<bool>();
+  if (compileOnly && args.at("exe-cache").as<std::string>().empty()) {
+    throw std::logic_error("Compiling a sweep requires exe-cache to be set (otherwise the executables are lost).");
+  }
+
+  std::unique_ptr<ipu_utils::DeviceInterface> device;
+  ipu_utils::RuntimeConfig deviceConfig;
+  std::vector<SweepJob> compileJobs;
+  std::size_t failures = 0;
+
+  for (auto i = 0u; i < points.size(); ++i) {
+    const auto& point = points[i];
+    ipu_utils::logger()->info("Sweep point {}/{}: {}", i + 1, points.size(), toString(point));
+
+    int exitCode = EXIT_FAILURE;
+    try {
+      auto job = makeSweepJob(argc, argv, toolName, factoryFunc, point);
+      if (compileOnly) {
+        compileJobs.push_back(std::move(job));
+        continue;
+      }
+
+      auto& builder = job.tool->getGraphBuilder();
+      const auto cfg = builder.getRuntimeConfig();
+      const bool deviceChanged = device && (cfg.numIpus != deviceConfig.numIpus ||
+                                            cfg.useIpuModel != deviceConfig.useIpuModel);
+      if (!device || deviceChanged) {
+        device.reset();
+        device = ipu_utils::GraphManager::getDevice(builder);
+        deviceConfig = cfg;
+      }
+
+      exitCode = ipu_utils::GraphManager().run(builder, *device);
+
+      const auto resultsFile = job.opts["results-file"].as<std::string>();
+      if (exitCode == EXIT_SUCCESS && !resultsFile.empty()) {
+        writeResults(resultsFile, toolName, job.opts, builder.getResults());
+      }
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->error("Exception: {}", e.what());
+    }
+
+    if (exitCode != EXIT_SUCCESS) {
+      ipu_utils::logger()->error("Sweep point {}/{} failed: {}", i + 1, points.size(), toString(point));
+      failures += 1;
+    }
+  }
+
+  if (compileOnly && !compileJobs.empty()) {
+    failures += compileSweep(compileJobs, args);
+  }
+
+  ipu_utils::logger()->info("Sweep finished: {} of {} points failed.", failures, points.size());
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv) {
   std::string toolName;
   ToolFactoryFunction factoryFunc;
@@ -206,7 +677,12 @@ int main(int argc, char** argv) {
   setupLogging(allOpts);
   ipu_utils::logger()->info("Selected tool {}", toolName);
 
-  auto cfg = configFromOptions(allOpts);
+  const auto sweepSpec = allOpts["sweep"].as<std::string>();
+  if (!sweepSpec.empty()) {
+    return runSweep(argc, argv, toolName, factoryFunc, sweepSpec, allOpts);
+  }
+
+  auto cfg = configFromOptions(toolName, allOpts);
 
   // If executable saving is requested we need to save the command arguments also:
   if (cfg.saveExe) {
@@ -233,5 +709,12 @@ int main(int argc, char** argv) {
 
   ipu_utils::logger()->debug("Codelet path: {}", allOpts["codelet-path"].as<std::string>());
 
-  return ipu_utils::GraphManager().run(tool->getGraphBuilder());
+  auto exitCode = ipu_utils::GraphManager().run(tool->getGraphBuilder());
+
+  const auto resultsFile = allOpts["results-file"].as<std::string>();
+  if (exitCode == EXIT_SUCCESS && !resultsFile.empty()) {
+    writeResults(resultsFile, toolName, allOpts, tool->getGraphBuilder().getResults());
+  }
+
+  return exitCode;
 }
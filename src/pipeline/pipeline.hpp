@@ -0,0 +1,236 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+
+#include <poplar/Program.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace pipeline {
+
+/// Function that returns the program for one stage of the pipeline when it
+/// operates on the given buffer slot. Stage s of item i reads slot (i % B) of
+/// the buffers written by stage s-1 and writes slot (i % B) of its own output
+/// buffers (where B is the number of buffers in the pipeline).
+using StageFunction = std::function<poplar::program::Program(std::size_t slot)>;
+
+struct Stage {
+  std::string name;
+  unsigned phase;
+  StageFunction build;
+};
+
+/// The three parts of a generated pipeline. Run them one after the other
+/// (or use PipelineBuilder::build() which returns them in a single sequence).
+struct PipelineSchedule {
+  poplar::program::Sequence prologue;
+  poplar::program::Program steadyState;
+  poplar::program::Sequence epilogue;
+};
+
+/// Generates software pipelined programs from a list of stages.
+///
+/// Each item (e.g. one transfer of data from the host) passes through the
+/// stages in order. The program is divided into steps: in every step each
+/// active stage processes a different item. Within a step stages are
+/// emitted in ascending phase order. Stages that share a phase are intended
+/// to overlap in time (they must run on disjoint tiles, e.g. host exchange on
+/// IO tiles and compute on compute tiles). Stages in later phases are typically
+/// exchanges between those tile sets.
+///
+/// A stage runs in the same step as its predecessor (on the same item) if its
+/// phase is later than its predecessor's, otherwise it runs one step later.
+/// Within a phase stages are emitted from last to first so that a stage always
+/// reads its input before the previous stage overwrites it. This means that
+/// a single buffer between stages is enough for correctness. NumBuffers > 1
+/// rotates the stages through that many buffer slots so that consecutive
+/// items do not reuse the same buffer.
+///
+/// The steady state (all stages active) is unrolled numBuffers times inside
+/// a Repeat so that the buffer slots are static in every copy of the body.
+class PipelineBuilder {
+public:
+  PipelineBuilder(std::size_t numBuffers) : buffers(numBuffers) {
+    if (buffers == 0) {
+      throw std::logic_error("A pipeline needs at least one buffer.");
+    }
+  }
+
+  /// Append a stage to the pipeline.
+  void addStage(const std::string& name, unsigned phase, StageFunction fn) {
+    stages.push_back(Stage{name, phase, fn});
+    programCache.clear();
+  }
+
+  std::size_t numBuffers() const { return buffers; }
+  std::size_t numStages() const { return stages.size(); }
+
+  /// Number of steps between an item entering the first stage and leaving the last.
+  std::size_t latency() const {
+    const auto offsets = stepOffsets();
+    return offsets.empty() ? 0 : offsets.back();
+  }
+
+  /// Generate the prologue, steady state and epilogue that push numItems items through the pipeline.
+  PipelineSchedule schedule(std::size_t numItems) {
+    if (stages.empty()) {
+      throw std::logic_error("Pipeline has no stages.");
+    }
+
+    const auto offsets = stepOffsets();
+    const auto rampSteps = offsets.back();
+    const auto totalSteps = numItems + rampSteps;
+
+    PipelineSchedule result;
+    if (numItems <= rampSteps) {
+      // Pipeline never fills: there is no steady state so just emit every step.
+      for (std::size_t t = 0; t < totalSteps; ++t) {
+        result.prologue.add(buildStep(t, numItems, offsets));
+      }
+      result.steadyState = poplar::program::Sequence();
+      return result;
+    }
+
+    for (std::size_t t = 0; t < rampSteps; ++t) {
+      result.prologue.add(buildStep(t, numItems, offsets));
+    }
+
+    // Steady state: unroll numBuffers steps so that slot indices repeat:
+    const auto steadySteps = numItems - rampSteps;
+    const auto unroll = std::min(buffers, steadySteps);
+    poplar::program::Sequence body;
+    for (std::size_t t = 0; t < unroll; ++t) {
+      body.add(buildStep(rampSteps + t, numItems, offsets));
+    }
+    const auto repeats = steadySteps / unroll;
+    poplar::program::Sequence steady;
+    steady.add(poplar::program::Repeat(repeats, body));
+    for (std::size_t t = rampSteps + repeats * unroll; t < numItems; ++t) {
+      steady.add(buildStep(t, numItems, offsets));
+    }
+    result.steadyState = steady;
+
+    for (std::size_t t = numItems; t < totalSteps; ++t) {
+      result.epilogue.add(buildStep(t, numItems, offsets));
+    }
+
+    return result;
+  }
+
+  /// Return the complete pipeline program.
+  poplar::program::Sequence build(std::size_t numItems) {
+    auto s = schedule(numItems);
+    return poplar::program::Sequence{s.prologue, s.steadyState, s.epilogue};
+  }
+
+  /// Describe the schedule (which stage processes which item in which slot on each step).
+  /// The steady state is shown once in terms of the first item it processes.
+  std::string describe(std::size_t numItems) const {
+    const auto offsets = stepOffsets();
+    const auto rampSteps = offsets.empty() ? 0 : offsets.back();
+    const auto totalSteps = numItems + rampSteps;
+    const bool hasSteadyState = numItems > rampSteps;
+    const auto unroll = hasSteadyState ? std::min(buffers, numItems - rampSteps) : 0;
+
+    std::stringstream ss;
+    for (std::size_t t = 0; t < totalSteps; ++t) {
+      const bool inSteady = hasSteadyState && t >= rampSteps && t < numItems;
+      if (inSteady && t >= rampSteps + unroll) {
+        continue;
+      }
+      if (hasSteadyState && t == rampSteps) {
+        ss << "steady state (repeats every " << unroll << " steps from item i):\n";
+      }
+      if (hasSteadyState && t == numItems) {
+        ss << "epilogue:\n";
+      }
+      if (t == 0 && !inSteady) {
+        ss << "prologue:\n";
+      }
+      ss << "  step " << t << ":";
+      for (const auto s : stepOrder()) {
+        if (!isActive(t, s, numItems, offsets)) { continue; }
+        const auto item = t - offsets[s];
+        ss << " " << stages[s].name << "[";
+        if (inSteady) {
+          ss << "i" << (item >= rampSteps ? "+" : "-")
+             << (item >= rampSteps ? item - rampSteps : rampSteps - item);
+        } else {
+          ss << item;
+        }
+        ss << " slot " << item % buffers << "]";
+      }
+      ss << "\n";
+    }
+    return ss.str();
+  }
+
+private:
+  /// The step (relative to the item's first step) in which each stage runs.
+  std::vector<std::size_t> stepOffsets() const {
+    std::vector<std::size_t> offsets;
+    for (std::size_t s = 0; s < stages.size(); ++s) {
+      if (s == 0) {
+        offsets.push_back(0);
+      } else {
+        const bool laterPhase = stages[s].phase > stages[s - 1].phase;
+        offsets.push_back(offsets.back() + (laterPhase ? 0 : 1));
+      }
+    }
+    return offsets;
+  }
+
+  /// Order in which stages are emitted in one step: ascending phase,
+  /// then from last stage to first within each phase.
+  std::vector<std::size_t> stepOrder() const {
+    std::vector<std::size_t> order(stages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+      if (stages[a].phase != stages[b].phase) {
+        return stages[a].phase < stages[b].phase;
+      }
+      return a > b;
+    });
+    return order;
+  }
+
+  bool isActive(std::size_t step, std::size_t stage, std::size_t numItems,
+                const std::vector<std::size_t>& offsets) const {
+    return step >= offsets[stage] && step - offsets[stage] < numItems;
+  }
+
+  poplar::program::Sequence buildStep(std::size_t step, std::size_t numItems,
+                                      const std::vector<std::size_t>& offsets) {
+    poplar::program::Sequence seq;
+    for (const auto s : stepOrder()) {
+      if (isActive(step, s, numItems, offsets)) {
+        seq.add(getProgram(s, (step - offsets[s]) % buffers));
+      }
+    }
+    return seq;
+  }
+
+  /// Programs are only built once per stage and slot and then reused.
+  poplar::program::Program getProgram(std::size_t stage, std::size_t slot) {
+    const auto key = std::make_pair(stage, slot);
+    auto found = programCache.find(key);
+    if (found == programCache.end()) {
+      found = programCache.insert(std::make_pair(key, stages[stage].build(slot))).first;
+    }
+    return found->second;
+  }
+
+  std::size_t buffers;
+  std::vector<Stage> stages;
+  std::map<std::pair<std::size_t, std::size_t>, poplar::program::Program> programCache;
+};
+
+} // end namespace pipeline
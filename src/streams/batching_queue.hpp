@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace streams {
+
+/// Counters describing how batches were formed.
+struct BatchingStats {
+  std::size_t items = 0;           // Items returned in batches.
+  std::size_t batches = 0;         // Non-empty batches returned.
+  std::size_t fullBatches = 0;     // Batches of maxBatch items.
+  std::size_t deadlineBatches = 0; // Partial batches released because the oldest item reached the deadline.
+};
+
+/// Multi-producer, single-consumer queue that groups items into batches.
+///
+/// Any number of threads push() items. The consumer calls popBatch() which
+/// returns as soon as maxBatch items are queued, or once the oldest queued item
+/// has waited for maxDelay (whichever comes first). This trades latency for
+/// throughput: a longer delay gives fuller batches under light load.
+template <class T>
+class BatchingQueue {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  BatchingQueue(std::size_t maxBatch, Clock::duration maxDelay)
+    : batchSize(maxBatch), delay(maxDelay), stopped(false) {
+    if (batchSize == 0) {
+      throw std::logic_error("BatchingQueue batch size must be at least one.");
+    }
+  }
+
+  /// Add an item. Returns false (and drops the item) if the queue has been stopped.
+  bool push(T item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopped) {
+        return false;
+      }
+      queue.push_back(Entry{Clock::now(), std::move(item)});
+    }
+    ready.notify_one();
+    return true;
+  }
+
+  /// Wait for the next batch. After stop() the remaining items are still
+  /// returned (without waiting for the deadline) and then an empty batch
+  /// signals that the queue is finished.
+  std::vector<T> popBatch() {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [&]() { return stopped || !queue.empty(); });
+    bool deadline = false;
+    while (!stopped && queue.size() < batchSize) {
+      const auto due = queue.front().time + delay;
+      if (ready.wait_until(lock, due) == std::cv_status::timeout || Clock::now() >= due) {
+        deadline = queue.size() < batchSize;
+        break;
+      }
+    }
+
+    std::vector<T> batch;
+    const auto count = std::min(batchSize, queue.size());
+    batch.reserve(count);
+    for (auto i = 0u; i < count; ++i) {
+      batch.push_back(std::move(queue.front().item));
+      queue.pop_front();
+    }
+    if (!batch.empty()) {
+      stats.items += batch.size();
+      stats.batches += 1;
+      stats.fullBatches += batch.size() == batchSize;
+      stats.deadlineBatches += deadline;
+    }
+    return batch;
+  }
+
+  /// Stop accepting items and wake up the consumer.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+    }
+    ready.notify_all();
+  }
+
+  std::size_t maxBatch() const { return batchSize; }
+
+  BatchingStats getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+private:
+  struct Entry {
+    Clock::time_point time;
+    T item;
+  };
+
+  const std::size_t batchSize;
+  const Clock::duration delay;
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Entry> queue;
+  bool stopped;
+  BatchingStats stats;
+};
+
+} // end namespace streams
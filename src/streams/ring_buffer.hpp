@@ -0,0 +1,196 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+
+#include <poplar/StreamCallback.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace streams {
+
+/// Lock free single-producer/single-consumer ring of fixed size slots.
+///
+/// The consumer side has separate read and release positions: a slot that
+/// has been read stays valid until it is released. This matches the
+/// prefetch/complete/invalidatePrefetched protocol of poplar::StreamCallback
+/// where prefetched data may later be discarded and must then be supplied
+/// again.
+template <class T>
+class RingBuffer {
+public:
+  RingBuffer(std::size_t numSlots, std::size_t slotSize)
+    : slots(numSlots), slotElements(slotSize), storage(numSlots * slotSize),
+      writePos(0), readPos(0), releasePos(0), stopped(false) {
+    if (numSlots == 0) {
+      throw std::logic_error("RingBuffer must have at least one slot.");
+    }
+  }
+
+  std::size_t numSlots() const { return slots; }
+  std::size_t slotSize() const { return slotElements; }
+
+  /// Producer: return the next free slot, waiting for the consumer to release
+  /// one if the ring is full. Returns nullptr if the ring was stopped while
+  /// waiting. The second element of the pair is true if the producer had to wait.
+  std::pair<T*, bool> beginWrite() {
+    const auto w = writePos.load(std::memory_order_relaxed);
+    bool waited = false;
+    while (w - releasePos.load(std::memory_order_acquire) >= slots) {
+      if (stopped.load(std::memory_order_relaxed)) {
+        return std::make_pair(nullptr, waited);
+      }
+      waited = true;
+      std::this_thread::yield();
+    }
+    return std::make_pair(slot(w), waited);
+  }
+
+  /// Producer: publish the slot returned by beginWrite().
+  void endWrite() {
+    writePos.fetch_add(1, std::memory_order_release);
+  }
+
+  /// Consumer: return the next unread slot without waiting or nullptr if none is ready.
+  const T* tryRead() {
+    const auto r = readPos.load(std::memory_order_relaxed);
+    if (r == writePos.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    readPos.store(r + 1, std::memory_order_relaxed);
+    return slot(r);
+  }
+
+  /// Consumer: release the oldest read slot back to the producer.
+  void release() {
+    releasePos.fetch_add(1, std::memory_order_release);
+  }
+
+  /// Consumer: forget every slot that was read but not released so that
+  /// subsequent reads return the same data again.
+  void rewind() {
+    readPos.store(releasePos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+
+  /// Wake up and stop a producer that is waiting in beginWrite().
+  void stop() { stopped.store(true, std::memory_order_relaxed); }
+  bool isStopped() const { return stopped.load(std::memory_order_relaxed); }
+
+private:
+  T* slot(std::size_t pos) { return &storage[(pos % slots) * slotElements]; }
+
+  const std::size_t slots;
+  const std::size_t slotElements;
+  std::vector<T> storage;
+  std::atomic<std::size_t> writePos;
+  std::atomic<std::size_t> readPos;
+  std::atomic<std::size_t> releasePos;
+  std::atomic<bool> stopped;
+};
+
+/// Counters describing how well the producer kept up with the device.
+struct RingBufferStats {
+  std::size_t prefetchCalls = 0;   // Calls to StreamCallback::prefetch().
+  std::size_t prefetchMisses = 0;  // prefetch() calls that found no data ready.
+  std::size_t fetchCalls = 0;      // Calls to StreamCallback::fetch().
+  std::size_t fetchWaits = 0;      // fetch() calls that had to wait for the producer.
+  std::size_t invalidations = 0;   // Calls to StreamCallback::invalidatePrefetched().
+  std::size_t produced = 0;        // Slots written by the producer.
+  std::size_t producerStalls = 0;  // Times the producer waited for a free slot.
+};
+
+/// Host to device stream callback that serves data from a RingBuffer
+/// filled by a dedicated producer thread. The producer function is called
+/// with a pointer to a slot, the slot size (in elements) and the sequence
+/// number of the slot. The producer thread starts on construction and is
+/// stopped and joined on destruction.
+template <class T>
+class RingBufferCallback : public poplar::StreamCallback {
+public:
+  using Producer = std::function<void(T*, std::size_t, std::size_t)>;
+
+  RingBufferCallback(std::size_t numSlots, std::size_t slotSize, Producer producer)
+    : ring(numSlots, slotSize), produce(producer),
+      producedCount(0), stallCount(0) {
+    producerThread = std::thread([this]() { producerLoop(); });
+  }
+
+  virtual ~RingBufferCallback() {
+    ring.stop();
+    if (producerThread.joinable()) {
+      producerThread.join();
+    }
+  }
+
+  poplar::StreamCallback::Result prefetch(void* p) override {
+    stats.prefetchCalls += 1;
+    auto data = ring.tryRead();
+    if (data == nullptr) {
+      stats.prefetchMisses += 1;
+      return poplar::StreamCallback::Result::NotAvailable;
+    }
+    copy(p, data);
+    return poplar::StreamCallback::Result::Success;
+  }
+
+  void fetch(void* p) override {
+    stats.fetchCalls += 1;
+    auto data = ring.tryRead();
+    if (data == nullptr) {
+      stats.fetchWaits += 1;
+      while ((data = ring.tryRead()) == nullptr) {
+        std::this_thread::yield();
+      }
+    }
+    copy(p, data);
+  }
+
+  void complete() override {
+    ring.release();
+  }
+
+  void invalidatePrefetched() override {
+    stats.invalidations += 1;
+    ring.rewind();
+  }
+
+  /// Return the current counters (safe to call while the producer is running).
+  RingBufferStats getStats() const {
+    auto s = stats;
+    s.produced = producedCount.load();
+    s.producerStalls = stallCount.load();
+    return s;
+  }
+
+private:
+  void copy(void* dst, const T* src) {
+    std::memcpy(dst, src, ring.slotSize() * sizeof(T));
+  }
+
+  void producerLoop() {
+    for (std::size_t seq = 0; !ring.isStopped(); ++seq) {
+      T* slot;
+      bool waited;
+      std::tie(slot, waited) = ring.beginWrite();
+      if (waited) { stallCount += 1; }
+      if (slot == nullptr) { break; }
+      produce(slot, ring.slotSize(), seq);
+      ring.endWrite();
+      producedCount += 1;
+    }
+  }
+
+  RingBuffer<T> ring;
+  Producer produce;
+  RingBufferStats stats;
+  std::atomic<std::size_t> producedCount;
+  std::atomic<std::size_t> stallCount;
+  std::thread producerThread;
+};
+
+} // end namespace streams
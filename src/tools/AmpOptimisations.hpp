@@ -147,9 +147,9 @@ struct AmpOptimisations :
     std::uint64_t cycles = ~0u;
     cycleCount.connectReadStream(engine, &cycles);
 
-    auto t0 = std::chrono::system_clock::now();
-    getPrograms().run(engine, "transform");
-    auto t1 = std::chrono::system_clock::now();
+    const auto cfg = getRuntimeConfig();
+    const auto timing = ipu_utils::timeProgram(getPrograms(), engine, "transform",
+                                               cfg.warmupIterations, cfg.trials);
 
     if (vertexName == "AsmTest") {
       return;
@@ -161,7 +161,7 @@ struct AmpOptimisations :
       ipu_utils::logger()->info("Result: {}", outputData);
     }
 
-    const double secs = std::chrono::duration<double>(t1 - t0).count();
+    const double secs = timing.median;
     const auto flops = (inputData.size() / 4) * (7 * 4);
     const float flopsPerCycle = flops/(float)cycles;
     const float vertsPerCycle = (inputData.size() / 4)/(float)cycles;
@@ -173,6 +173,13 @@ struct AmpOptimisations :
     ipu_utils::logger()->info("Extrapolated FLOPs/cycle/device: {}", flopsPerCycle * device.getTarget().getNumTiles());
     ipu_utils::logger()->info("Extrapolated vertices/cycle/device: {}", vertsPerCycle * device.getTarget().getNumTiles());
 
+    auto& metrics = getResults();
+    metrics.add("engine_run_time", timing);
+    metrics.add("flop_count", flops, "FLOP");
+    metrics.add("cycle_count", cycles, "cycles");
+    metrics.add("flops_per_cycle", flopsPerCycle, "FLOP/cycle");
+    metrics.add("vertices_per_cycle", vertsPerCycle, "vertices/cycle");
+
     // Check the result:
     for (auto i = 0u; i < inputData.size() - 1; i += 2) {
       std::swap(inputData[i], inputData[i + 1]);
@@ -21,65 +21,133 @@
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <complex>
+
 /// Example computes a 1D Fourier transform using the Cooley-Tukey algorithm for fast
 /// Fourier transforms (FFT). The the discrete Fourier transform (DFT) matrix is factorised
 /// into a base matrix multiply of some dimension (the radix size) followed by 'twiddles' or
 /// 'butterflies' that compute the second linear transformation in the factorisation (without
-/// the computational cost of the original large DFT matrix multiply).
+/// the computational cost of the original large DFT matrix multiply). Sizes that are not a
+/// power of two are supported by mixed radix-2/3/4/5 decompositions (e.g. 3*2^k or 5*2^k).
+/// The 'convolve' and 'correlate' FFT types benchmark FFT based convolution (forward FFT,
+/// pointwise product, inverse FFT) and check the result against a direct convolution.
+/// The '3d' type transforms cubic volumes and '--distributed' splits the rows of a 2D-FFT
+/// across replicas (the transpose between the row and column passes is a gcl all-to-all).
 struct FourierTransform :
   public ipu_utils::BuilderInterface, public ToolInterface
 {
   FourierTransform() : size(0), batchSize(0), radixSize(0),
-                       serialisation(0), availableMemoryProportion(-1.f) {}
+                       serialisation(0), availableMemoryProportion(-1.f), realInput(false), kernelSize(0),
+                       planMemoryProportion(0.f), overlapped(false), transforms(0), distributed(false), stageCycleCounts(false), remoteConstantThreshold(0),
+                       fusedComplexVertices(false), graphBuilt(false),
+                       inputReal("input_real"), inputImag("input_imag"),
+                       outputReal("output_real"), outputImag("output_imag"), cycles("cycle_count"),
+                       stageCycles("stage_cycles") {}
   virtual ~FourierTransform() {}
 
   void build(poplar::Graph& graph, const poplar::Target&) override {
-    popops::addCodelets(graph);
-    poplin::addCodelets(graph);
     poplar::program::Sequence prog;
-
-    FFTBuilder builder(graph, "fft_builder");
-    auto input = complex::ComplexTensor(graph, poplar::FLOAT, {batchSize, size}, "a");
-    input.mapLinearly(graph);
-    builder.setAvailableMemoryProportion(availableMemoryProportion);
     poplar::program::Sequence fftSeq;
+    complex::ComplexTensor input;
     complex::ComplexTensor output;
-    if (fftType == "1d") {
-      ipu_utils::logger()->info("Building 1D-FFT of input-size {} batch-size {} radix-size {}", size, batchSize, radixSize);
-      output = builder.fft1d(fftSeq, input, radixSize);
-    } else {
-      ipu_utils::logger()->info("Building 2D-FFT of input-size {} x {} radix-size {} (batch-size 1)", size, batchSize, radixSize);
-      output = builder.fft2d(fftSeq, input, radixSize, serialisation);
-    }
+    complex::ComplexTensor kernel;
+    FFTBuilder builder(graph, "fft_builder");
+    constructFFT(graph, builder, prog, fftSeq, input, kernel, output);
+    graphBuilt = true;
 
     ipu_utils::logger()->info("FFT estimated FLOP count: {}", builder.getFlopEstimate());
+    getResults().add("flop_estimate", builder.getFlopEstimate(), "FLOP");
+    addTileMemoryResults("fft_constants", builder.getConstantMemoryStats());
+    remoteConstants = builder.getRemoteConstants();
+    std::size_t remoteBytes = 0;
+    for (const auto& c : remoteConstants) {
+      remoteBytes += c.data.size() * graph.getTarget().getTypeSize(c.type);
+    }
+    getResults().add("fft_remote_constant_bytes", remoteBytes, "bytes");
+    getResults().add("fft_constant_cache_hits", builder.getConstantCacheHits());
+    addTileMemoryResults("fft_output", tileMemoryStats(graph, {output.real, output.imag}));
 
     auto cycleCount = poplar::cycleCount(graph, fftSeq, 0, poplar::SyncType::INTERNAL);
+
+    if (distributed) {
+      // Each replica streams its own block of rows:
+      inputReal = input.real;
+      inputImag = input.imag;
+      outputReal = output.real;
+      outputImag = output.imag;
+      cycles = cycleCount;
+      prog.add(inputReal.buildWrite(graph, true));
+      prog.add(inputImag.buildWrite(graph, true));
+      prog.add(fftSeq);
+      prog.add(outputReal.buildRead(graph, true));
+      prog.add(outputImag.buildRead(graph, true));
+      prog.add(cycles.buildRead(graph, false));
+      if (stageCycleCounts) {
+        stageCycles = builder.getStageCycleCounts();
+        prog.add(stageCycles.buildRead(graph, false));
+      }
+      getPrograms().add("fft", prog);
+      return;
+    }
+
     prog.add(fftSeq);
 
     graph.createHostWrite("input_real", input.real);
-    graph.createHostWrite("input_imag", input.imag);
+    if (!realInput) {
+      graph.createHostWrite("input_imag", input.imag);
+    }
+    if (convolution()) {
+      graph.createHostWrite("kernel_real", kernel.real);
+      graph.createHostWrite("kernel_imag", kernel.imag);
+    }
     graph.createHostRead("output_real", output.real);
     graph.createHostRead("output_imag", output.imag);
     graph.createHostRead("cycle_count", cycleCount);
+    if (stageCycleCounts) {
+      graph.createHostRead("stage_cycles", builder.getStageCycleCounts());
+    }
 
     getPrograms().add("fft", prog);
   }
 
   void execute(poplar::Engine& engine, const poplar::Device& device) override {
     // Create input values and write to the device:
-    auto x = 0u;
-    for (auto b = 0u; b < batchSize; ++b) {
-      // Each item in a batch is identical:
-      for (auto i = 0u; i < size; ++i) {
-        x += 1;
-        realData[b*size + i] = x;
-        imagData[b*size + i] = x;
-      }
+    for (auto i = 0u; i < realData.size(); ++i) {
+      realData[i] = i + 1;
+      imagData[i] = realInput ? 0.f : i + 1;
+    }
+
+    if (remoteConstantThreshold && !graphBuilt) {
+      // build() was skipped (--load-exe or an exe-cache hit) so the remote constants' host data does
+      // not exist. Their names and values only depend on the options so rebuild the FFT in a graph
+      // that is never compiled to recover them:
+      ipu_utils::logger()->info("Rebuilding the FFT to recover its remote buffer constants.");
+      poplar::Graph probe(device.getTarget(), poplar::replication_factor(getRuntimeConfig().numReplicas));
+      poplar::program::Sequence prog;
+      poplar::program::Sequence fftSeq;
+      complex::ComplexTensor input;
+      complex::ComplexTensor output;
+      complex::ComplexTensor kernel;
+      FFTBuilder builder(probe, "fft_builder");
+      constructFFT(probe, builder, prog, fftSeq, input, kernel, output);
+      remoteConstants = builder.getRemoteConstants();
+    }
+
+    if (!remoteConstants.empty() && !device.supportsRemoteBuffers()) {
+      throw std::runtime_error("Remote buffers are not supported on this device (see --remote-constant-threshold).");
+    }
+    FFTBuilder::writeRemoteConstants(engine, device.getTarget(), remoteConstants, getRuntimeConfig().numReplicas);
+
+    if (distributed) {
+      executeDistributed(engine);
+      return;
     }
 
     ipu_utils::writeTensor(engine, "input_real", realData);
-    ipu_utils::writeTensor(engine, "input_imag", imagData);
+    if (!realInput) {
+      ipu_utils::writeTensor(engine, "input_imag", imagData);
+    }
     if (size < 32u && batchSize < 5u) {
       for (auto b = 0u; b < batchSize; ++b) {
         ipu_utils::logger()->info("1D FFT input[{}] Re:\n{}\n", b, slice(realData, b * size, (b + 1) * size));
@@ -87,6 +155,29 @@ struct FourierTransform :
       }
     }
 
+    // Keep the input for checking convolution results:
+    std::vector<std::complex<double>> signal;
+    std::vector<std::complex<double>> kernelValues;
+    if (convolution()) {
+      for (auto i = 0u; i < realData.size(); ++i) {
+        signal.emplace_back(realData[i], imagData[i]);
+      }
+      std::vector<float> kernelReal(kernelSize), kernelImag(kernelSize);
+      for (auto k = 0u; k < kernelSize; ++k) {
+        kernelReal[k] = 1.f / (k + 1);
+        kernelImag[k] = 0.5f / (k + 1);
+        kernelValues.emplace_back(kernelReal[k], kernelImag[k]);
+      }
+      ipu_utils::writeTensor(engine, "kernel_real", kernelReal);
+      ipu_utils::writeTensor(engine, "kernel_imag", kernelImag);
+    }
+
+    // Real FFTs only return the non-redundant bins and
+    // convolutions return the full (linear) result:
+    const auto outputSize = realInput ? size / 2 + 1 : convolution() ? size + kernelSize - 1 : size;
+    realData.resize(numElements() / size * outputSize);
+    imagData.resize(numElements() / size * outputSize);
+
     ipu_utils::logger()->info("Running program");
     getPrograms().run(engine, "fft");
 
@@ -96,10 +187,41 @@ struct FourierTransform :
     uint64_t cycleCount = 0u;
     ipu_utils::readScalar(engine, "cycle_count", cycleCount);
     ipu_utils::logger()->info("FFT completed in {} cycles.", cycleCount);
+    getResults().add("cycle_count", cycleCount, "cycles");
+    if (stageCycleCounts) {
+      std::vector<unsigned> stageCounts(numStages());
+      ipu_utils::readTensor(engine, "stage_cycles", stageCounts);
+      addStageCycleResults(stageCounts);
+    }
+
+    if (convolution()) {
+      // Compare with a direct convolution/correlation on the host:
+      const bool correlate = fftType == "correlate";
+      double maxError = 0.0;
+      double maxValue = 0.0;
+      for (auto b = 0u; b < batchSize; ++b) {
+        for (auto j = 0u; j < outputSize; ++j) {
+          std::complex<double> expected = 0.0;
+          for (auto k = 0u; k < kernelSize; ++k) {
+            // For correlation output j holds lag j - (kernelSize - 1):
+            const long n = correlate ? long(j + k) - long(kernelSize - 1) : long(j) - long(k);
+            if (n >= 0 && n < long(size)) {
+              expected += signal[b * size + n] * (correlate ? std::conj(kernelValues[k]) : kernelValues[k]);
+            }
+          }
+          const auto i = b * outputSize + j;
+          maxError = std::max(maxError, std::abs(expected - std::complex<double>(realData[i], imagData[i])));
+          maxValue = std::max(maxValue, std::abs(expected));
+        }
+      }
+      const auto relativeError = maxValue > 0.0 ? maxError / maxValue : maxError;
+      ipu_utils::logger()->info("FFT {} max relative error: {}", fftType, relativeError);
+      getResults().add("max_relative_error", relativeError);
+    }
     if (size <= 16u && batchSize <= 8u) {
       for (auto b = 0u; b < batchSize; ++b) {
-        ipu_utils::logger()->info("1D FFT result[{}] Re:\n{}\n", b, slice(realData, b * size, (b + 1) * size));
-        ipu_utils::logger()->info("1D FFT result[{}] Im:\n{}\n", b, slice(imagData, b * size, (b + 1) * size));
+        ipu_utils::logger()->info("1D FFT result[{}] Re:\n{}\n", b, slice(realData, b * outputSize, (b + 1) * outputSize));
+        ipu_utils::logger()->info("1D FFT result[{}] Im:\n{}\n", b, slice(imagData, b * outputSize, (b + 1) * outputSize));
       }
     }
   }
@@ -108,45 +230,281 @@ struct FourierTransform :
     namespace po = boost::program_options;
     desc.add_options()
     ("fft-type", po::value<std::string>(&fftType)->default_value("1d"),
-     "Dimensionality of the FFT to compute 1D treats input as a batch of 1D vectors. 2D treats input as a 2D field of batch-size 1.")
+     "Dimensionality of the FFT to compute 1D treats input as a batch of 1D vectors. 2D treats input as a 2D field of batch-size "
+     "rows (a batch of 'transforms' fields). 3D treats input as 'transforms' cubic volumes of side fft-size. "
+     "'convolve' and 'correlate' compute the linear convolution/correlation of a batch of 1D vectors with a kernel "
+     "using forward FFTs, a pointwise product and an inverse FFT.")
     ("fft-size", po::value<std::size_t>(&size)->default_value(1024),
      "Dimension of input vector to 1D FFT.")
     ("batch-size", po::value<std::size_t>(&batchSize)->default_value(1),
      "Batch size for 1D FFT (i.e. number of input vectors).")
     ("radix-size", po::value<std::size_t>(&radixSize)->default_value(0),
-     "Choose radix size (base case size at which DFT matrix-multiply is performed). The default (0) automatically "
-     "sets the radix to half the input size (i.e. no FFT recursion).")
+     "Choose radix size (base case size at which DFT matrix-multiply is performed). The input size divided by the "
+     "radix must be a product of 2, 3, 4 and 5 (mixed-radix FFT). The default (0) chooses the radix with the FFT "
+     "planner for 1d and 2d FFTs. For the other FFT types it sets the radix to the input size divided by its "
+     "smallest factor of 2, 3 or 5 (i.e. no FFT recursion), or to the input size itself (a plain DFT) if it has "
+     "none of those factors.")
+    ("transforms", po::value<std::size_t>(&transforms)->default_value(1),
+     "Number of independent 2D or 3D FFTs computed together (the batch size of a 2D/3D FFT).")
+    ("distributed", po::value<bool>(&distributed)->default_value(false),
+     "For FFT-2D split the rows of the (square) input across the replicas and transpose it between the row and column "
+     "passes with a gcl all-to-all. The FFT size must be divisible by the number of replicas.")
+    ("stage-cycles", po::value<bool>(&stageCycleCounts)->default_value(false),
+     "Time each stage of the FFT (DFT matmuls, twiddles, butterflies and transposes/copies) and report the cycles "
+     "of each. The counters add syncs so an instrumented run is slower than the total cycle count without them.")
+    ("remote-constant-threshold", po::value<std::size_t>(&remoteConstantThreshold)->default_value(0),
+     "Hold FFT constants (Fourier matrices and twiddles) of at least this many bytes in remote buffers and "
+     "copy them onto the tiles before each use. 0 keeps all constants on chip.")
+    ("fused-complex-vertices", po::value<bool>(&fusedComplexVertices)->default_value(false),
+     "Compute the FFT twiddles and radix-2/radix-4 butterflies with the fused complex arithmetic vertices "
+     "(loaded from the codelet-path) instead of popops element-wise operations. Experimental: the FFT planner's "
+     "cost model assumes the popops path.")
+    ("kernel-size", po::value<std::size_t>(&kernelSize)->default_value(64),
+     "Kernel length for convolve and correlate (the FFT size is chosen automatically).")
+    ("real-input", po::value<bool>(&realInput)->default_value(false),
+     "Treat the input as real valued and use the real FFT (rfft1d/rfft2d) which only returns the size/2 + 1 "
+     "non-redundant bins. For 2D the input has batch-size rows of fft-size columns (it need not be square).")
     ("serialisation-factor", po::value<std::size_t>(&serialisation)->default_value(1),
-     "For FFT-2D controls how many chunks the input is split into. Higher values trade performance for reduced memory use.")
+     "For FFT-2D controls how many chunks the input is split into. Higher values trade performance for reduced memory use. "
+     "0 chooses the factor with the FFT planner.")
+    ("overlapped-serialisation", po::value<bool>(&overlapped)->default_value(false),
+     "For FFT-2D merge each chunk's copy-out with the next chunk's copy-in and fold the "
+     "transpose between the row and column passes into the chunk copies.")
+    ("plan-table", po::value<std::string>(&planTable)->default_value(""),
+     "CSV file of measured cycle counts (as written by python/fft/perf_analysis.py) which the FFT planner uses in "
+     "preference to its cost model.")
+    ("plan-memory-proportion", po::value<float>(&planMemoryProportion)->default_value(0.6f),
+     "Proportion of tile memory the FFT planner allows the FFT to use.")
     ("available-memory-proportion", po::value<float>(&availableMemoryProportion)->default_value(-1.f),
      "Set the memory proportion available for the inner DFT matrix multiplies. Default: use the Poplar default.");
   }
 
   void init(const boost::program_options::variables_map& args) override {
-    if (fftType != "1d" && fftType != "2d" ) {
-      throw std::runtime_error("Option 'fftType' must be either '1d' or '2d'.");
+    codeletPath = args["codelet-path"].as<std::string>();
+    if (fftType != "1d" && fftType != "2d" && fftType != "3d" && !convolution()) {
+      throw std::runtime_error("Option 'fftType' must be one of '1d', '2d', '3d', 'convolve' or 'correlate'.");
     }
-
-    if (size % 2) {
-      throw std::logic_error("FFT input size must be a multiple of 2.");
+    if (transforms == 0) {
+      throw std::runtime_error("Option 'transforms' must be at least one.");
+    }
+    if (transforms > 1 && fftType != "2d" && fftType != "3d") {
+      throw std::runtime_error("Option 'transforms' is only supported for 2d and 3d FFTs (use batch-size for 1d).");
     }
-    if (radixSize == 0) {
-      radixSize = size / 2;
+    if ((transforms > 1 || fftType == "3d") && (realInput || overlapped)) {
+      throw std::runtime_error("Real input and overlapped serialisation are only supported for single 1d/2d FFTs.");
     }
-    if (radixSize > size / 2) {
-      throw std::runtime_error("Radix size can not be greater than half the input size.");
+    if (distributed && (fftType != "2d" || realInput || transforms != 1 || batchSize != size)) {
+      throw std::runtime_error("Distributed FFTs must be complex 2d FFTs of a single square input (batch-size == fft-size).");
     }
-    realData.resize(size * batchSize);
-    imagData.resize(size * batchSize);
+
+    if (convolution()) {
+      if (realInput) {
+        throw std::runtime_error("Real input is not supported for convolve or correlate.");
+      }
+      if (kernelSize == 0) {
+        throw std::runtime_error("Kernel size must be at least one.");
+      }
+      if (radixSize != 0) {
+        FFTBuilder::factorise(FFTBuilder::nextFastSize(size + kernelSize - 1), radixSize);
+      }
+    } else if (realInput) {
+      // The real FFT computes a complex FFT of half the size. The radix
+      // is left to be chosen automatically per FFT size unless specified:
+      if (size % 2) {
+        throw std::runtime_error("Real FFT input size must be a multiple of 2.");
+      }
+      if (radixSize != 0) {
+        FFTBuilder::factorise(size / 2, radixSize);
+        if (fftType == "2d") {
+          FFTBuilder::factorise(batchSize, radixSize);
+        }
+      }
+    } else if (radixSize != 0) {
+      // Throws if the size can not be decomposed down to the radix:
+      const auto factors = FFTBuilder::factorise(size, radixSize);
+      ipu_utils::logger()->debug("FFT size {} radix {} Cooley-Tukey factors: {}", size, radixSize, factors);
+    }
+    if (serialisation == 0 && (fftType != "2d" || realInput || transforms > 1 || distributed)) {
+      throw std::runtime_error("A serialisation factor of 0 (planned) is only supported for single complex 2d FFTs.");
+    }
+    realData.resize(numElements());
+    imagData.resize(numElements());
   }
 
 private:
+  /// Configure the builder and construct the FFT program (in fftSeq) on the
+  /// input, planning it first if necessary. Also used by execute() to rebuild
+  /// the FFT's remote constants when build() has been skipped.
+  void constructFFT(poplar::Graph& graph, FFTBuilder& builder, poplar::program::Sequence& prog,
+                    poplar::program::Sequence& fftSeq, complex::ComplexTensor& input,
+                    complex::ComplexTensor& kernel, complex::ComplexTensor& output) {
+    popops::addCodelets(graph);
+    poplin::addCodelets(graph);
+    const auto replicas = graph.getReplicationFactor();
+    if (distributed && size % replicas) {
+      throw std::runtime_error("The FFT size must be divisible by the number of replicas for a distributed FFT.");
+    }
+    input = complex::ComplexTensor(graph, poplar::FLOAT, inputShape(replicas), "a");
+    input.mapLinearly(graph);
+    builder.setAvailableMemoryProportion(availableMemoryProportion);
+    builder.setOverlappedSerialisation(overlapped);
+    builder.setRemoteConstantThreshold(remoteConstantThreshold);
+    if (fusedComplexVertices) {
+      complex::addCodelets(graph, codeletPath);
+      builder.setFusedComplexVertices(true);
+    }
+    if (stageCycleCounts) {
+      builder.enableStageCycleCounts(prog);
+    }
+
+    if (planned()) {
+      // Let the planner pick whichever of the radix and serialisation factor were not specified:
+      FFTPlanningCache cache;
+      if (!planTable.empty()) {
+        cache.loadMeasurements(planTable);
+      }
+      FFTPlanParams params{fftType == "2d" ? 2u : 1u, size, batchSize, poplar::FLOAT, planMemoryProportion};
+      params.radix = radixSize;
+      params.serialisationFactor = fftType == "2d" ? serialisation : 1;
+      params.overlappedSerialisation = overlapped;
+      const auto plan = builder.plan(params, &cache);
+      radixSize = plan.radix;
+      serialisation = plan.serialisationFactor;
+      getResults().add("planned_radix", radixSize);
+      getResults().add("planned_serialisation_factor", serialisation);
+      getResults().add("plan_cycles", plan.cycles, plan.measured ? "cycles (measured)" : "cycles (estimated)");
+    }
+
+    if (distributed) {
+      ipu_utils::logger()->info("Building 2D-FFT of input-size {} x {} radix-size {} (distributed over {} replicas)",
+                                size, size, radixSize, replicas);
+      output = builder.fft2dDistributed(fftSeq, input, radixSize);
+    } else if (fftType == "3d") {
+      ipu_utils::logger()->info("Building 3D-FFT of input-size {} x {} radix-size {} ({} x {} x {} volume, {} transforms)",
+                                size, size, radixSize, size, size, size, transforms);
+      output = builder.fft3d(fftSeq, input, radixSize, serialisation);
+    } else if (realInput && fftType == "1d") {
+      ipu_utils::logger()->info("Building 1D-FFT of input-size {} batch-size {} radix-size {} (real input)", size, batchSize, radixSize);
+      output = builder.rfft1d(fftSeq, input.real, radixSize);
+    } else if (realInput) {
+      ipu_utils::logger()->info("Building 2D-FFT of input-size {} x {} radix-size {} (real input)", size, batchSize, radixSize);
+      output = builder.rfft2d(fftSeq, input.real, radixSize, serialisation);
+    } else if (convolution()) {
+      kernel = complex::ComplexTensor(graph, poplar::FLOAT, {1, kernelSize}, "kernel");
+      kernel.mapLinearly(graph);
+      output = builder.convolve1d(fftSeq, input, kernel, fftType == "correlate", 0, radixSize);
+    } else if (fftType == "1d") {
+      ipu_utils::logger()->info("Building 1D-FFT of input-size {} batch-size {} radix-size {}", size, batchSize, radixSize);
+      output = builder.fft1d(fftSeq, input, radixSize);
+    } else {
+      ipu_utils::logger()->info("Building 2D-FFT of input-size {} x {} radix-size {} ({} transforms)", size, batchSize, radixSize, transforms);
+      output = builder.fft2d(fftSeq, input, radixSize, serialisation);
+    }
+  }
+
+  void executeDistributed(poplar::Engine& engine) {
+    // The host buffers hold the whole matrix: replica r's stream
+    // buffer is r's block of rows so the streams are in row order:
+    const auto replicas = getRuntimeConfig().numReplicas;
+    std::vector<float> resultReal(realData.size()), resultImag(imagData.size());
+    std::vector<std::uint64_t> replicaCycles(replicas);
+    std::vector<unsigned> stageCounts(replicas * numStages());
+    inputReal.connectWriteStream(engine, realData);
+    inputImag.connectWriteStream(engine, imagData);
+    outputReal.connectReadStream(engine, resultReal);
+    outputImag.connectReadStream(engine, resultImag);
+    cycles.connectReadStream(engine, replicaCycles);
+    if (stageCycleCounts) {
+      stageCycles.connectReadStream(engine, stageCounts);
+    }
+
+    ipu_utils::logger()->info("Running program");
+    getPrograms().run(engine, "fft");
+
+    realData = resultReal;
+    imagData = resultImag;
+    const auto cycleCount = *std::max_element(replicaCycles.begin(), replicaCycles.end());
+    ipu_utils::logger()->info("Distributed FFT completed in {} cycles.", cycleCount);
+    getResults().add("cycle_count", cycleCount, "cycles");
+    if (stageCycleCounts) {
+      addStageCycleResults(stageCounts);
+    }
+  }
+
+  static std::size_t numStages() { return std::size_t(FFTStage::NumStages); }
+
+  /// Record the cycles of each stage (the slowest replica's
+  /// if there is a count per replica):
+  void addStageCycleResults(const std::vector<unsigned>& counts) {
+    for (auto s = 0u; s < numStages(); ++s) {
+      unsigned slowest = 0;
+      for (auto i = s; i < counts.size(); i += numStages()) {
+        slowest = std::max(slowest, counts[i]);
+      }
+      const auto name = FFTBuilder::stageName(FFTStage(s));
+      ipu_utils::logger()->info("FFT stage {}: {} cycles", name, slowest);
+      getResults().add("stage_cycles_" + name, slowest, "cycles");
+    }
+  }
+
+  void addTileMemoryResults(const std::string& name, const TileMemoryStats& stats) {
+    ipu_utils::logger()->info("{}: {} bytes on {} tiles (max {} bytes per tile, imbalance {})",
+                              name, stats.totalBytes, stats.tilesUsed, stats.maxTileBytes, stats.imbalance);
+    getResults().add(name + "_bytes", stats.totalBytes, "bytes");
+    getResults().add(name + "_tiles", stats.tilesUsed);
+    getResults().add(name + "_max_tile_bytes", stats.maxTileBytes, "bytes");
+    getResults().add(name + "_mean_tile_bytes", stats.meanTileBytes, "bytes");
+    getResults().add(name + "_tile_imbalance", stats.imbalance);
+  }
+
+  std::vector<std::size_t> inputShape(unsigned replicas) const {
+    if (distributed) {
+      return {size / replicas, size};
+    }
+    if (fftType == "3d") {
+      return {transforms, size, size, size};
+    }
+    if (transforms > 1) {
+      return {transforms, batchSize, size};
+    }
+    return {batchSize, size};
+  }
+
+  std::size_t numElements() const {
+    return fftType == "3d" ? transforms * size * size * size : transforms * batchSize * size;
+  }
+
+  bool convolution() const { return fftType == "convolve" || fftType == "correlate"; }
+  bool planned() const {
+    return !realInput && !convolution() && !distributed && fftType != "3d" && transforms == 1 &&
+           (radixSize == 0 || serialisation == 0);
+  }
+
   std::string fftType;
   std::size_t size;
   std::size_t batchSize;
   std::size_t radixSize;
   std::size_t serialisation;
   float availableMemoryProportion;
+  bool realInput;
+  std::size_t kernelSize;
+  std::string planTable;
+  float planMemoryProportion;
+  bool overlapped;
+  std::size_t transforms;
+  bool distributed;
+  bool stageCycleCounts;
+  std::size_t remoteConstantThreshold;
+  bool fusedComplexVertices;
+  std::string codeletPath;
+  std::vector<FFTBuilder::RemoteConstant> remoteConstants;
+  bool graphBuilt;
+  ipu_utils::StreamableTensor inputReal;
+  ipu_utils::StreamableTensor inputImag;
+  ipu_utils::StreamableTensor outputReal;
+  ipu_utils::StreamableTensor outputImag;
+  ipu_utils::StreamableTensor cycles;
+  ipu_utils::StreamableTensor stageCycles;
   std::vector<float> realData;
   std::vector<float> imagData;
 };
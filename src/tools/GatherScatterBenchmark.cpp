@@ -0,0 +1,235 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "GatherScatterBenchmark.hpp"
+
+#include <memory/gather.hpp>
+#include <memory/scatter.hpp>
+
+#include <popops/codelets.hpp>
+#include <poplar/CycleCount.hpp>
+
+#include <cstring>
+#include <random>
+
+GatherScatterBenchmark::GatherScatterBenchmark()
+:
+  table("table"),
+  indices("indices"),
+  updates("updates"),
+  output("output"),
+  cycleCount("cycles")
+{}
+
+GatherScatterBenchmark::~GatherScatterBenchmark() {}
+
+void GatherScatterBenchmark::init(const boost::program_options::variables_map& args) {
+  if (operation != "gather" && operation != "update" && operation != "update-add") {
+    throw std::runtime_error("Unknown operation: '" + operation + "' (choose gather, update or update-add).");
+  }
+  if (dataTypeString == "half") {
+    dtype = poplar::HALF;
+  } else if (dataTypeString == "float") {
+    dtype = poplar::FLOAT;
+  } else {
+    throw std::runtime_error("Unsupported data type.");
+  }
+}
+
+float GatherScatterBenchmark::rowValue(std::size_t row) const {
+  // Keep values exactly representable in half precision:
+  return row % 2048;
+}
+
+void GatherScatterBenchmark::build(poplar::Graph& g, const poplar::Target&) {
+  using namespace poplar::program;
+
+  popops::addCodelets(g);
+
+  ipu_utils::logger()->info("Operation: {} of {} rows from a table of {} rows of {} elements",
+                            operation, indexCount, tableRows, rowSize);
+  ipu_utils::logger()->info("Planned: {} Available memory proportion: {}", usePlan, availableMemoryProportion);
+
+  // Plans must be made before any of the tensors are created:
+  Sequence op;
+  Sequence readData;
+  if (isGather()) {
+    gather::MultiSlice slice("gather", tableRows, rowSize, indexCount, usePlan, dtype, availableMemoryProportion);
+    slice.plan(g);
+    table = slice.createValues(g);
+    indices = slice.createIndices(g);
+    output = slice.createOutput(g, table, indices, op);
+    readData.add(output.buildRead(g, true));
+  } else {
+    const bool accumulate = operation == "update-add";
+    scatter::MultiUpdate update("scatter", dtype, tableRows, rowSize, indexCount, usePlan,
+                                availableMemoryProportion, accumulate);
+    update.plan(g);
+    table = update.createDestination(g);
+    indices = update.createIndices(g);
+    updates = update.createSource(g);
+    if (accumulate) {
+      auto scale = g.addConstant(dtype, {}, 1.f, "scale");
+      g.setTileMapping(scale, 0);
+      update.createAccumulateProgram(g, updates, indices, scale, op);
+    } else {
+      update.createProgram(g, updates, indices, op);
+    }
+    readData.add(table.buildRead(g, true));
+  }
+
+  Sequence writeData;
+  writeData.add(table.buildWrite(g, true));
+  writeData.add(indices.buildWrite(g, true));
+  if (!isGather()) {
+    writeData.add(updates.buildWrite(g, true));
+  }
+
+  cycleCount = poplar::cycleCount(g, op, 0u, poplar::SyncType::INTERNAL, "count_cycles");
+  readData.add(cycleCount.buildRead(g, false));
+
+  logTensorInfo(g, table);
+
+  getPrograms().add("write_data", writeData);
+  getPrograms().add("run_once", op);
+  getPrograms().add("repeat_loop", Repeat(iterations, op));
+  getPrograms().add("read_data", readData);
+}
+
+void GatherScatterBenchmark::execute(poplar::Engine& engine, const poplar::Device& device) {
+  ipu_utils::logger()->info("Execution starts");
+  const auto& target = device.getTarget();
+
+  // Convert float values to and from the device type:
+  auto toDevice = [&](const std::vector<float>& values) {
+    std::vector<std::uint8_t> bytes(values.size() * target.getTypeSize(dtype));
+    if (dtype == poplar::HALF) {
+      poplar::copyFloatToDeviceHalf(target, values.data(), bytes.data(), values.size());
+    } else {
+      std::memcpy(bytes.data(), values.data(), bytes.size());
+    }
+    return bytes;
+  };
+  auto fromDevice = [&](const std::vector<std::uint8_t>& bytes) {
+    std::vector<float> values(bytes.size() / target.getTypeSize(dtype));
+    if (dtype == poplar::HALF) {
+      poplar::copyDeviceHalfToFloat(target, bytes.data(), values.data(), values.size());
+    } else {
+      std::memcpy(values.data(), bytes.data(), bytes.size());
+    }
+    return values;
+  };
+
+  // Gathers read a table whose rows hold their row number. Updates write
+  // ones into a zero table (so an accumulated row counts its updates):
+  std::vector<float> tableValues(tableRows * rowSize, 0.f);
+  if (isGather()) {
+    for (auto r = 0u; r < tableRows; ++r) {
+      std::fill_n(tableValues.begin() + r * rowSize, rowSize, rowValue(r));
+    }
+  }
+  auto tableBytes = toDevice(tableValues);
+  auto updateBytes = toDevice(std::vector<float>(indexCount * rowSize, 1.f));
+  std::vector<std::uint8_t> outputBytes(indexCount * rowSize * target.getTypeSize(dtype));
+
+  std::mt19937 gen(1442);
+  std::uniform_int_distribution<unsigned> dist(0, tableRows - 1);
+  std::vector<unsigned> hostIndices(indexCount);
+  for (auto& i : hostIndices) { i = dist(gen); }
+
+  table.connectWriteStream(engine, tableBytes.data());
+  indices.connectWriteStream(engine, hostIndices);
+  if (isGather()) {
+    output.connectReadStream(engine, outputBytes.data());
+  } else {
+    updates.connectWriteStream(engine, updateBytes.data());
+    table.connectReadStream(engine, tableBytes.data());
+  }
+  std::uint64_t cycles = ~0u;
+  cycleCount.connectReadStream(engine, &cycles);
+
+  // Check the result of a single run:
+  const auto& progs = getPrograms();
+  progs.run(engine, "write_data");
+  progs.run(engine, "run_once");
+  progs.run(engine, "read_data");
+
+  // Expected value of each result row: a gather returns indexCount rows
+  // and an update returns the whole table:
+  std::vector<float> expected;
+  std::vector<float> result;
+  std::size_t rowsToCheck = 0;
+  if (isGather()) {
+    result = fromDevice(outputBytes);
+    rowsToCheck = indexCount;
+    expected.resize(indexCount);
+    for (auto i = 0u; i < indexCount; ++i) {
+      expected[i] = rowValue(hostIndices[i]);
+    }
+  } else {
+    result = fromDevice(tableBytes);
+    rowsToCheck = tableRows;
+    expected.resize(tableRows, 0.f);
+    for (auto i : hostIndices) {
+      expected[i] = operation == "update-add" ? expected[i] + 1.f : 1.f;
+    }
+  }
+  std::size_t errors = 0;
+  for (auto r = 0u; r < rowsToCheck; ++r) {
+    for (auto c = 0u; c < rowSize; ++c) {
+      errors += result[r * rowSize + c] != expected[r];
+    }
+  }
+  if (errors) {
+    ipu_utils::logger()->error("{} of {} elements are incorrect", errors, rowsToCheck * rowSize);
+  } else {
+    ipu_utils::logger()->info("Result of {} is correct", operation);
+  }
+
+  const auto cfg = getRuntimeConfig();
+  const auto timing = ipu_utils::timeProgram(progs, engine, "repeat_loop", cfg.warmupIterations, cfg.trials);
+  ipu_utils::logger()->info("Execution time: {}", timing);
+
+  const double bytesPerIteration = double(indexCount) * rowSize * target.getTypeSize(dtype);
+  const double bytesPerCycle = bytesPerIteration / cycles;
+  const double gigaBytesPerSecond = 1e-9 * bytesPerIteration * iterations / timing.median;
+  ipu_utils::logger()->info("Cycles per {}: {}", operation, cycles);
+  ipu_utils::logger()->info("Row bytes per cycle: {}", bytesPerCycle);
+  ipu_utils::logger()->info("Row bandwidth measured: {} GB/sec", gigaBytesPerSecond);
+
+  auto& metrics = getResults();
+  metrics.add("execution_time", timing);
+  metrics.add("cycles_per_iteration", cycles, "cycles");
+  metrics.add("bytes_per_cycle", bytesPerCycle, "bytes/cycle");
+  metrics.add("bandwidth_measured", gigaBytesPerSecond, "GB/s");
+  metrics.add("errors", errors);
+}
+
+void GatherScatterBenchmark::addToolOptions(boost::program_options::options_description& desc) {
+  namespace po = boost::program_options;
+  desc.add_options()
+  ("operation", po::value<std::string>(&operation)->default_value("gather"),
+   "Operation to benchmark: 'gather' (multiSlice), 'update' (multiUpdate) or 'update-add' (multiUpdateAdd)."
+  )
+  ("table-rows", po::value<std::size_t>(&tableRows)->default_value(100000),
+   "Number of rows in the table."
+  )
+  ("row-size", po::value<std::size_t>(&rowSize)->default_value(64),
+   "Number of elements in each row."
+  )
+  ("indices", po::value<std::size_t>(&indexCount)->default_value(1024),
+   "Number of rows gathered or updated by each operation."
+  )
+  ("iterations", po::value<std::size_t>(&iterations)->default_value(100),
+   "Number of iterations for benchmarking."
+  )
+  ("type", po::value<std::string>(&dataTypeString)->default_value("float"),
+   "Data type of the table: 'float' or 'half'."
+  )
+  ("plan", po::value<bool>(&usePlan)->default_value(true),
+   "Plan the operation with popops (otherwise the default unplanned implementation is used)."
+  )
+  ("available-memory-proportion", po::value<float>(&availableMemoryProportion)->default_value(0.2),
+   "Proportion of tile memory the planner may use for temporaries."
+  )
+  ;
+}
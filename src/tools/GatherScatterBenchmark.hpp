@@ -0,0 +1,43 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "ipu_utils.hpp"
+#include "io_utils.hpp"
+#include "tool_registry.hpp"
+
+#include <boost/program_options.hpp>
+
+struct GatherScatterBenchmark :
+  public ipu_utils::BuilderInterface, public ToolInterface
+{
+  GatherScatterBenchmark();
+  virtual ~GatherScatterBenchmark();
+
+  // Builder interface:
+  void build(poplar::Graph& g, const poplar::Target&) override;
+  void execute(poplar::Engine& engine, const poplar::Device& device) override;
+
+  // Tool interface:
+  void addToolOptions(boost::program_options::options_description& desc) override;
+  void init(const boost::program_options::variables_map& args) override;
+
+private:
+  bool isGather() const { return operation == "gather"; }
+  float rowValue(std::size_t row) const;
+
+  std::size_t tableRows;
+  std::size_t rowSize;
+  std::size_t indexCount;
+  std::size_t iterations;
+  std::string operation;
+  std::string dataTypeString;
+  poplar::Type dtype;
+  bool usePlan;
+  float availableMemoryProportion;
+  ipu_utils::StreamableTensor table;
+  ipu_utils::StreamableTensor indices;
+  ipu_utils::StreamableTensor updates;
+  ipu_utils::StreamableTensor output;
+  ipu_utils::StreamableTensor cycleCount;
+};
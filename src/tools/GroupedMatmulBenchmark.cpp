@@ -87,18 +87,21 @@ void GroupedMatmulBenchmark::execute(poplar::Engine& engine, const poplar::Devic
   const auto& progs = getPrograms();
   progs.run(engine, "write_data");
 
-  auto startTime = std::chrono::steady_clock::now();
-  progs.run(engine, "repeat_loop");
-  auto endTime = std::chrono::steady_clock::now();
-
-  auto seconds = std::chrono::duration<double>(endTime - startTime).count();
-  ipu_utils::logger()->info("Execution time: {}", seconds);
+  const auto cfg = getRuntimeConfig();
+  const auto timing = ipu_utils::timeProgram(progs, engine, "repeat_loop", cfg.warmupIterations, cfg.trials);
+  const auto seconds = timing.median;
+  ipu_utils::logger()->info("Execution time: {}", timing);
 
   double tflopsPerIteration = 1e-12 * groupSize * batchSize * (lhsRows * lhsCols * rhsCols * 2);
   double totalTflops = iterations * tflopsPerIteration;
   double tflopsPerSecond = totalTflops / seconds;
   ipu_utils::logger()->info("TFLOPS/iteration: {}", tflopsPerIteration);
   ipu_utils::logger()->info("TFLOPS/sec: {}", tflopsPerSecond);
+
+  auto& metrics = getResults();
+  metrics.add("execution_time", timing);
+  metrics.add("tflops_per_iteration", tflopsPerIteration, "TFLOP");
+  metrics.add("tflops_per_second", tflopsPerSecond, "TFLOP/s");
 }
 
 void GroupedMatmulBenchmark::addToolOptions(boost::program_options::options_description& desc) {
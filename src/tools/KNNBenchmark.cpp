@@ -11,22 +11,247 @@
 #include <gcl/Collectives.hpp>
 #include <popops/DynamicSlice.hpp>
 #include <popops/ElementWise.hpp>
+#include <popops/Fill.hpp>
+#include <popops/Reduce.hpp>
+#include <popops/Zero.hpp>
+
+#include <remote_buffer_loader.hpp>
+#include <streams/batching_queue.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <map>
+#include <random>
+#include <thread>
 
 KNNBenchmark::KNNBenchmark()
 :
   query("query"),
   vecs("vecs"),
-  results("results")
+  vecScales("vec_scales"),
+  results("results"),
+  updateIndices("update_indices"),
+  updateVecs("update_vecs"),
+  updateScales("update_scales")
 {}
 
 KNNBenchmark::~KNNBenchmark() {}
 
+namespace {
+
+// Each FusedDistanceTopK vertex searches at least this many vectors per
+// result it keeps, so the candidates that are merged after the kernel use a
+// fraction of the memory the full [batch, N] distances tensor would:
+constexpr std::size_t minVectorsPerCandidate = 32;
+
+/// A query submitted to the serving loop. The callback receives the k
+/// nearest neighbours, or nullptr if the server failed before running it.
+struct QueryRequest {
+  std::vector<float> query;
+  std::function<void(const unsigned* neighbours)> done;
+};
+
+/// Value of element d of every vector in the benchmark's database. It is
+/// not parallel to the queries (which are all 0.5) so that updating a vector
+/// to equal the query makes it the unique nearest under every metric.
+float databaseValue(std::size_t d) {
+  return d % 2 ? .25f : .5f;
+}
+
+/// Convert dot products (in place) into scores for the metric. norms2 holds
+/// the (float) squared norms of the vectors and has the same shape as dots.
+void dotsToScores(poplar::Graph& g, poplar::Tensor dots, poplar::Tensor norms2,
+                  KNNBenchmark::Metric metric, poplar::program::Sequence& prog) {
+  namespace pe = popops::expr;
+  const auto dtype = dots.elementType();
+  if (metric == KNNBenchmark::Metric::L2) {
+    popops::mapInPlace(g, pe::Sub(pe::Cast(pe::_2, dtype), pe::Add(pe::_1, pe::_1)),
+                       {dots, norms2}, prog, "l2_distances");
+  } else if (metric == KNNBenchmark::Metric::Cosine) {
+    // Zero vectors get a score of zero rather than NaN:
+    auto invNorms = pe::Rsqrt(pe::Max(pe::_2, pe::Const(1e-12f)));
+    popops::mapInPlace(g, pe::Neg(pe::Mul(pe::_1, pe::Cast(invNorms, dtype))),
+                       {dots, norms2}, prog, "cosine_distances");
+  }
+}
+
+/// Convert the dot products from a matmul into scores for the metric.
+/// vecs is the [D, N] block of vectors that the distances were computed against.
+void applyMetric(poplar::Graph& g, poplar::Tensor distances, poplar::Tensor vecs,
+                 KNNBenchmark::Metric metric, poplar::program::Sequence& prog) {
+  if (metric == KNNBenchmark::Metric::Dot) {
+    return;
+  }
+  auto norms = popops::reduce(g, vecs, poplar::FLOAT, {0}, popops::Operation::SQUARE_ADD, prog, "vec_norms"); // [N]
+  dotsToScores(g, distances, norms.expand({0}).broadcast(distances.dim(0), 0), metric, prog);
+}
+
+/// Quantise a vector to int8 with one scale per block of scaleBlock elements.
+void quantiseVector(const float* values, std::size_t dim, std::size_t scaleBlock,
+                    std::int8_t* quantised, float* scales) {
+  for (auto b = 0u; b < dim / scaleBlock; ++b) {
+    const auto begin = values + b * scaleBlock;
+    float maxAbs = 0.f;
+    for (auto v = begin; v < begin + scaleBlock; ++v) {
+      maxAbs = std::max(maxAbs, std::abs(*v));
+    }
+    scales[b] = maxAbs > 0.f ? maxAbs / 127.f : 1.f;
+    for (auto d = 0u; d < scaleBlock; ++d) {
+      quantised[b * scaleBlock + d] = std::int8_t(std::lround(begin[d] / scales[b]));
+    }
+  }
+}
+
+/// Find the k best scores for each query (and the row indices of the vectors in
+/// vecsRows that they came from) without materialising the [batch, N] scores:
+/// each FusedDistanceTopK vertex scores a block of the vectors on its tile
+/// against every query and keeps only its best k, then the per-vertex
+/// candidates are merged with a topK. If scales is valid the vectors are
+/// int8 with one scale per block of scaleBlock elements (stored on the same
+/// tiles as the vectors they scale).
+std::pair<poplar::Tensor, poplar::Tensor>
+fusedDistanceTopK(poplar::Graph& g, poplar::Tensor queries, poplar::Tensor vecsRows,
+                  poplar::Tensor scales, std::size_t scaleBlock,
+                  const popops::TopKParams& params, KNNBenchmark::Metric metric,
+                  poplar::program::Sequence& prog, const std::string& name) {
+  using namespace poplar::program;
+  struct Block {
+    unsigned tile;
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  const auto batch = queries.dim(0);
+  const auto dim = queries.dim(1);
+  const auto k = params.k;
+  const auto numWorkers = g.getTarget().getNumWorkerContexts();
+
+  // Split the rows on each tile between its workers:
+  std::vector<Block> blocks;
+  std::vector<unsigned> usedTiles;
+  const auto mapping = g.getTileMapping(vecsRows);
+  for (auto tile = 0u; tile < mapping.size(); ++tile) {
+    if (!mapping[tile].empty()) {
+      usedTiles.push_back(tile);
+    }
+    for (const auto& interval : mapping[tile]) {
+      const auto begin = interval.begin() / dim;
+      const auto end = interval.end() / dim;
+      const auto splits = std::max<std::size_t>(
+        1, std::min<std::size_t>(numWorkers, (end - begin) / (minVectorsPerCandidate * k)));
+      const auto rowsPerSplit = (end - begin + splits - 1) / splits;
+      for (auto b = begin; b < end; b += rowsPerSplit) {
+        blocks.push_back({tile, b, std::min(end, b + rowsPerSplit)});
+      }
+    }
+  }
+
+  // Every tile needs its own copy of the queries:
+  auto tileQueries = g.addVariable(queries.elementType(), {usedTiles.size(), batch * dim}, name + "/tile_queries");
+  std::map<unsigned, poplar::Tensor> queriesOnTile;
+  for (auto t = 0u; t < usedTiles.size(); ++t) {
+    g.setTileMapping(tileQueries[t], usedTiles[t]);
+    queriesOnTile[usedTiles[t]] = tileQueries[t];
+  }
+  prog.add(Copy(queries.flatten().expand({0}).broadcast(usedTiles.size(), 0), tileQueries));
+
+  auto scores = g.addVariable(poplar::FLOAT, {blocks.size(), batch, k}, name + "/candidate_scores");
+  auto indices = g.addVariable(poplar::UNSIGNED_INT, {blocks.size(), batch, k}, name + "/candidate_indices");
+  const bool quantised = scales.valid();
+  auto cs = g.addComputeSet(name + "/distances");
+  for (auto i = 0u; i < blocks.size(); ++i) {
+    const auto& block = blocks[i];
+    g.setTileMapping(scores[i], block.tile);
+    g.setTileMapping(indices[i], block.tile);
+    auto v = g.addVertex(cs, quantised ? "QuantisedDistanceTopK" : "FusedDistanceTopK", {
+      {"queries", queriesOnTile[block.tile]},
+      {"vectors", vecsRows.slice(block.begin, block.end, 0).flatten()},
+      {"bestScores", scores[i].flatten()},
+      {"bestIndices", indices[i].flatten()}
+    });
+    if (quantised) {
+      g.connect(v["scales"], scales.slice(block.begin, block.end, 0).flatten());
+      g.setInitialValue(v["scaleBlock"], unsigned(scaleBlock));
+    }
+    g.setInitialValue(v["dim"], unsigned(dim));
+    g.setInitialValue(v["k"], unsigned(k));
+    g.setInitialValue(v["metric"], unsigned(metric));
+    g.setInitialValue(v["baseIndex"], unsigned(block.begin));
+    g.setTileMapping(v, block.tile);
+    g.setPerfEstimate(v, (block.end - block.begin) * (dim + batch * (dim + k)));
+  }
+  prog.add(Execute(cs));
+
+  ipu_utils::logger()->info("Fused distance kernel: {} vertices keep {} candidates per query ({} vectors)",
+                            blocks.size(), blocks.size() * k, vecsRows.dim(0));
+  auto candidateScores = scores.dimShuffle({1, 0, 2}).reshape({batch, blocks.size() * k});
+  auto candidateIndices = indices.dimShuffle({1, 0, 2}).reshape({batch, blocks.size() * k});
+  return popops::topKKeyValue(g, prog, candidateScores, candidateIndices, params, name + "/merge");
+}
+
+} // end anonymous namespace
+
+void KNNBenchmark::init(const boost::program_options::variables_map& args) {
+  codeletPath = args["codelet-path"].as<std::string>();
+
+  if (metricName == "dot") {
+    metric = Metric::Dot;
+  } else if (metricName == "l2") {
+    metric = Metric::L2;
+  } else if (metricName == "cosine") {
+    metric = Metric::Cosine;
+  } else {
+    throw std::runtime_error("Unknown metric: '" + metricName + "' (choose dot, l2 or cosine).");
+  }
+
+  if (kernelName != "matmul" && kernelName != "fused") {
+    throw std::runtime_error("Unknown distance kernel: '" + kernelName + "' (choose matmul or fused).");
+  }
+  fusedKernel = kernelName == "fused";
+
+  if (mergeName != "all-gather" && mergeName != "all-to-all") {
+    throw std::runtime_error("Unknown merge: '" + mergeName + "' (choose all-gather or all-to-all).");
+  }
+  allToAllMerge = mergeName == "all-to-all";
+
+  if (storageTypeName == "half") {
+    storageType = poplar::HALF;
+  } else if (storageTypeName == "int8") {
+    storageType = poplar::SIGNED_CHAR;
+  } else {
+    throw std::runtime_error("Unknown storage type: '" + storageTypeName + "' (choose half or int8).");
+  }
+  if (quantised() && !fusedKernel) {
+    // A matmul would need a dequantised (half) copy of the vectors which
+    // would undo the memory saving:
+    throw std::runtime_error("int8 storage needs --distance-kernel fused.");
+  }
+  if (scaleBlock == 0) {
+    scaleBlock = D;
+  }
+  if (D % scaleBlock != 0) {
+    throw std::runtime_error("scale-block must divide the vector size D.");
+  }
+  if (rerankCandidates != 0 && rerankCandidates < k) {
+    throw std::runtime_error("rerank must be zero or at least k.");
+  }
+  if (rerankCandidates > numVecs) {
+    throw std::runtime_error("rerank must not be more than the number of vectors searched at a time (N).");
+  }
+}
+
 void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
   using namespace poplar::program;
+  namespace pe = popops::expr;
   auto numReplicas = g.getReplicationFactor();
 
   popops::addCodelets(g);
   poplin::addCodelets(g);
+  if (fusedKernel) {
+    g.addCodelets(codeletPath + "/KNNBenchmark/fused_distance_topk.cpp");
+  }
 
   auto dtype = poplar::HALF;
 
@@ -34,8 +259,34 @@ void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
   const std::vector<std::size_t> lhsShape = {batchSize, D};
   const std::vector<std::size_t> rhsShape = {D, numVecs};
 
-  auto queryM = poplin::createMatMulInputLHS(g, dtype, dtype, lhsShape, rhsShape, "query", {}, &cache);
-  vecs = poplin::createMatMulInputRHS(g, dtype, dtype, lhsShape, rhsShape, "vecs", {}, &cache);
+  // Each replica owns one shard of the database. A resident shard is held in
+  // vecs, a paged shard is stored in a remote buffer and is paged through vecs
+  // numVecs vectors at a time:
+  const bool paged = shardPages > 0;
+  const auto shardSize = getShardSize();
+
+  poplar::Tensor queryM;
+  if (fusedKernel) {
+    // The fused kernel reads whole vectors so each tile holds complete rows:
+    queryM = g.addVariable(dtype, lhsShape, "query");
+    poputil::mapTensorLinearly(g, queryM);
+    auto vecsRows = g.addVariable(storageType, {numVecs, D}, "vecs");
+    poputil::mapTensorLinearly(g, vecsRows, 0, D);
+    vecs = vecsRows.transpose();
+    if (quantised()) {
+      // Each vector's scales live on the same tile as the vector:
+      vecScales = g.addVariable(poplar::FLOAT, {numVecs, D / scaleBlock}, "vec_scales");
+      const auto mapping = g.getTileMapping(vecsRows);
+      for (auto tile = 0u; tile < mapping.size(); ++tile) {
+        for (const auto& interval : mapping[tile]) {
+          g.setTileMapping(vecScales.get().slice(interval.begin() / D, interval.end() / D, 0), tile);
+        }
+      }
+    }
+  } else {
+    queryM = poplin::createMatMulInputLHS(g, dtype, dtype, lhsShape, rhsShape, "query", {}, &cache);
+    vecs = poplin::createMatMulInputRHS(g, dtype, dtype, lhsShape, rhsShape, "vecs", {}, &cache);
+  }
   if (numReplicas == 1) {
     query = queryM.flatten();
   } else {
@@ -49,7 +300,12 @@ void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
   if (!includeQueryTransfer) {
     writeData.add(queryWrite);
   }
-  writeData.add(vecs.buildWrite(g, true));
+  if (!paged) {
+    writeData.add(vecs.buildWrite(g, true));
+    if (quantised()) {
+      writeData.add(vecScales.buildWrite(g, true));
+    }
+  }
 
   Sequence knn;
   if (includeQueryTransfer) {
@@ -60,22 +316,129 @@ void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
     knn.add(Copy(gatheredQuery.flatten(), queryM.flatten()));
   }
 
-  auto distances = poplin::matMul(g, queryM, vecs, knn, "calcDistances");  // [batch, D] X [D, N] -> [batch, N]
   auto topKParams = popops::TopKParams(k, false, popops::SortOrder::ASCENDING);
+
+  // When re-ranking each shard first finds more candidates than are needed:
+  const auto searchK = rerankCandidates ? rerankCandidates : k;
+  auto searchParams = popops::TopKParams(searchK, false, popops::SortOrder::ASCENDING);
+
+  // Search the vectors currently held in vecs: [batch, D] X [D, N] -> ([batch, searchK], [batch, searchK])
+  auto searchVecs = [&](Sequence& prog, const std::string& name) -> std::pair<poplar::Tensor, poplar::Tensor> {
+    if (fusedKernel) {
+      return fusedDistanceTopK(g, queryM, vecs.get().transpose(), quantised() ? vecScales.get() : poplar::Tensor(),
+                               scaleBlock, searchParams, metric, prog, name);
+    }
+    auto distances = poplin::matMul(g, queryM, vecs, prog, "calcDistances");  // [batch, D] X [D, N] -> [batch, N]
+    applyMetric(g, distances, vecs, metric, prog);
+    return popops::topKWithPermutation(g, prog, distances, searchParams, name); // [batch, N] -> ([batch, searchK], [batch, searchK])
+  };
+  const auto scoreType = fusedKernel ? poplar::FLOAT : dtype;
+
   poplar::Tensor ipuIndices, ipuResults;
-  std::tie(ipuResults, ipuIndices) =
-    popops::topKWithPermutation(g, knn, distances, topKParams, "topK"); // [batch, N] -> ([batch, k], [batch, k])
+  if (!paged) {
+    std::tie(ipuResults, ipuIndices) = searchVecs(knn, "topK");
+  } else {
+    // Page the shard through vecs: the remote buffer holds one vector per row.
+    ipu_utils::logger()->info("Paging shard of {} vectors through {} pages", shardSize, shardPages);
+    pages = g.addRemoteBuffer("db_pages", storageType, D, shardSize);
+    if (quantised()) {
+      pageScales = g.addRemoteBuffer("db_page_scales", poplar::FLOAT, D / scaleBlock, shardSize);
+    }
+
+    auto page = g.addVariable(poplar::UNSIGNED_INT, {1}, "page");
+    g.setTileMapping(page, 0);
+    std::vector<unsigned> rowSteps(numVecs);
+    std::iota(rowSteps.begin(), rowSteps.end(), 0u);
+    auto rowIota = g.addConstant<unsigned>(poplar::UNSIGNED_INT, {numVecs}, rowSteps, "page_rows");
+    poputil::mapTensorLinearly(g, rowIota);
+
+    // Best results over the pages searched so far (smallest first):
+    auto bestResults = g.addVariable(scoreType, {batchSize, searchK}, "best_results");
+    auto bestIndices = g.addVariable(poplar::UNSIGNED_INT, {batchSize, searchK}, "best_indices");
+    poputil::mapTensorLinearly(g, bestResults);
+    poputil::mapTensorLinearly(g, bestIndices);
+    const float worstScore = scoreType == poplar::HALF ? 65504.f : std::numeric_limits<float>::max();
+    popops::fill(g, bestResults, knn, worstScore, "init_best_results");
+    popops::zero(g, bestIndices, knn, "init_best_indices");
+    popops::zero(g, page, knn, "init_page");
+
+    Sequence searchPage;
+    auto pageRows = popops::map(g, pe::Add(pe::_1, pe::Mul(pe::_2, pe::Const(unsigned(numVecs)))),
+                                {rowIota, page.broadcast(numVecs, 0)}, searchPage, "page_offsets");
+    searchPage.add(Copy(pages, vecs.get().transpose(), pageRows, "load_page"));
+    if (quantised()) {
+      searchPage.add(Copy(pageScales, vecScales.get(), pageRows, "load_page_scales"));
+    }
+    poplar::Tensor pageResults, pageIndices;
+    std::tie(pageResults, pageIndices) = searchVecs(searchPage, "pageTopK");
+    popops::mapInPlace(g, pe::Add(pe::_1, pe::Mul(pe::Const(unsigned(numVecs)), pe::_2)),
+                       {pageIndices, page.reshape({1, 1}).broadcast(batchSize, 0).broadcast(searchK, 1)},
+                       searchPage, "addPageOffsets");
+    poplar::Tensor mergedResults, mergedIndices;
+    std::tie(mergedResults, mergedIndices) =
+      popops::topKKeyValue(g, searchPage, poplar::concat(bestResults, pageResults, 1),
+                           poplar::concat(bestIndices, pageIndices, 1), searchParams, "mergePages");
+    searchPage.add(Copy(mergedResults, bestResults));
+    searchPage.add(Copy(mergedIndices, bestIndices));
+    popops::addInPlace(g, page, 1u, searchPage, "next_page");
+    knn.add(Repeat(shardPages, searchPage));
+
+    ipuResults = bestResults;
+    ipuIndices = bestIndices;
+  }
+
+  if (rerankCandidates) {
+    // Re-rank each shard's candidates exactly: the full precision vectors are
+    // kept in a remote buffer and only the candidates are fetched on chip:
+    exactVecs = g.addRemoteBuffer("db_exact", dtype, D, shardSize);
+    auto candidateVecs = g.addVariable(dtype, {batchSize * searchK, D}, "rerank_vecs");
+    poputil::mapTensorLinearly(g, candidateVecs, 0, D);
+    knn.add(Copy(exactVecs, candidateVecs, ipuIndices.flatten(), "load_candidates"));
+    auto candidates = candidateVecs.reshape({batchSize, searchK, D});
+    auto products = popops::map(g, pe::Mul(pe::Cast(pe::_1, poplar::FLOAT), pe::Cast(pe::_2, poplar::FLOAT)),
+                                {candidates, queryM.expand({1}).broadcast(searchK, 1)}, knn, "rerank_products");
+    auto dots = popops::reduce(g, products, {2}, popops::Operation::ADD, knn, "rerank_dots"); // [batch, searchK]
+    if (metric != Metric::Dot) {
+      auto norms = popops::reduce(g, candidates, poplar::FLOAT, {2}, popops::Operation::SQUARE_ADD, knn, "rerank_norms");
+      dotsToScores(g, dots, norms, metric, knn);
+    }
+    std::tie(ipuResults, ipuIndices) = popops::topKKeyValue(g, knn, dots, ipuIndices, topKParams, "rerank");
+    ipu_utils::logger()->info("Re-ranking {} candidates per query", searchK);
+  }
 
   if (numReplicas == 1) {
     results = std::move(ipuIndices);
+  } else if (allToAllMerge) {
+    // Each replica merges the results for its own slice of the queries: an
+    // all-to-all sends every replica only the Top K candidates for its slice
+    // (instead of gathering all candidates everywhere) and the merged Top K
+    // is only materialised on the replica that streams it to the host:
+    if (batchSize % numReplicas != 0) {
+      throw std::runtime_error("The all-to-all merge needs batch-size to be a multiple of the number of replicas.");
+    }
+    const auto queriesPerReplica = batchSize / numReplicas;
+    auto repIndex = g.addReplicationIndexConstant("repIndex");
+    g.setTileMapping(repIndex, 0);
+    auto expr = pe::Add(pe::_1, pe::Mul(pe::Const(unsigned(shardSize)), pe::_2));
+    popops::mapInPlace(g, expr, {ipuIndices, repIndex}, knn, "addIndexOffsets");
+    auto exchange = [&](poplar::Tensor t) { // [batch, k] -> [batch / r, r * k]
+      auto received = gcl::allToAllCrossReplica(g, t.reshape({numReplicas, queriesPerReplica, k}),
+                                                knn, gcl::CommGroup(), "allToAll");
+      return received.dimShuffle({1, 0, 2}).reshape({queriesPerReplica, numReplicas * k});
+    };
+    auto exchangedResults = exchange(ipuResults);
+    auto exchangedIndices = exchange(ipuIndices);
+    poplar::Tensor keys, values;
+    std::tie(keys, values) =
+      popops::topKKeyValue(g, knn, exchangedResults, exchangedIndices, topKParams, "multiReplicaTopK"); // [batch / r, r * k] -> [batch / r, k]
+    results = std::move(values);
   } else {
     // Each replica has its Top K, to gather them requires the indices to
     // be converted to the global array, gathered together and a second
     // topK performed to get the top indices across the whole set of replicas
     auto repIndex = g.addReplicationIndexConstant("repIndex");
     g.setTileMapping(repIndex, 0);
-    auto expr = popops::expr::Add(popops::expr::_1,
-                  popops::expr::Mul(popops::expr::Const(numVecs), popops::expr::_2));
+    auto expr = pe::Add(pe::_1, pe::Mul(pe::Const(unsigned(shardSize)), pe::_2));
     popops::mapInPlace(g, expr, {ipuIndices, repIndex}, knn, "addIndexOffsets");
     auto gatheredResults = gcl::allGatherCrossReplica(g, ipuResults, knn, gcl::CommGroup(), "allGather"); // [batch, k] -> [r, batch, k]
     gatheredResults = gatheredResults.dimShuffle({1, 0, 2}).reshape({batchSize, numReplicas * k});
@@ -87,6 +450,7 @@ void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
     results = std::move(values);
   }
   auto resultRead = results.buildRead(g, true);
+  Sequence searchOnce = knn;
   if (includeResultTransfer) {
     knn = Sequence({resultRead, knn});
   }
@@ -96,48 +460,288 @@ void KNNBenchmark::build(poplar::Graph& g, const poplar::Target&) {
   Sequence readData;
   readData.add(resultRead);
 
+  // Resident shards are updated in place by scattering a batch of streamed vectors
+  // into vecs (paged shards are updated directly in their remote buffer by the host):
+  if (updateBatch > 0 && !paged) {
+    auto vecsRows = vecs.get().transpose(); // [N, D]
+    updateIndices = popops::createIndicesTensor(g, {0}, updateBatch, {}, {}, "update_indices");
+    updateVecs = popops::createSliceTensor(g, vecsRows, {0}, {1}, updateBatch, "update_vecs");
+    Sequence updateProg;
+    updateProg.add(updateIndices.buildWrite(g, true));
+    updateProg.add(updateVecs.buildWrite(g, true));
+    popops::multiUpdate(g, vecsRows, updateVecs, updateIndices, {0}, {1}, updateProg, {}, {}, "update_vectors");
+    if (quantised()) {
+      updateScales = popops::createSliceTensor(g, vecScales.get(), {0}, {1}, updateBatch, "update_scales");
+      updateProg.add(updateScales.buildWrite(g, true));
+      popops::multiUpdate(g, vecScales.get(), updateScales, updateIndices, {0}, {1}, updateProg, {}, {}, "update_scales");
+    }
+    getPrograms().add("update_vectors", updateProg);
+  }
+
   ipu_utils::logger()->info(
-    "Searching {} vectors of size {}", numVecs * numReplicas, D);
+    "Searching {} vectors of size {} ({} per replica)", shardSize * numReplicas, D, shardSize);
   ipu_utils::logger()->info(
-    "{} lookups to find k={} nearest neighbours.", batchSize, k);
+    "{} lookups to find k={} nearest neighbours ({} metric, {} kernel, {} storage).",
+    batchSize, k, metricName, kernelName, storageTypeName);
   logTensorInfo(g, results);
   getPrograms().add("write_data", writeData);
   getPrograms().add("repeat_loop", repeat_loop);
+  getPrograms().add("search_once", searchOnce);
   getPrograms().add("read_data", readData);
+
+  // One batch of the serving loop: queries are streamed in and results out every time:
+  Sequence serveBatch;
+  if (!includeQueryTransfer) {
+    serveBatch.add(queryWrite);
+  }
+  serveBatch.add(searchOnce);
+  serveBatch.add(resultRead);
+  getPrograms().add("serve_batch", serveBatch);
+}
+
+std::size_t KNNBenchmark::getShardSize() const {
+  return numVecs * std::max<std::size_t>(1, shardPages);
+}
+
+void KNNBenchmark::encodeVector(const poplar::Target& target, const float* values, void* dst, float* scales) const {
+  if (quantised()) {
+    quantiseVector(values, D, scaleBlock, static_cast<std::int8_t*>(dst), scales);
+  } else {
+    poplar::copyFloatToDeviceHalf(target, values, dst, D);
+  }
+}
+
+void KNNBenchmark::updateVectors(poplar::Engine& engine, const poplar::Device& device, std::size_t numReplicas,
+                                 const std::vector<std::size_t>& ids, const std::vector<float>& values) {
+  const auto shardSize = getShardSize();
+
+  // Sort the updates by the shard (replica) that owns them:
+  std::vector<std::vector<std::size_t>> shardUpdates(numReplicas);
+  for (auto u = 0u; u < ids.size(); ++u) {
+    const auto shard = ids[u] / shardSize;
+    if (shard >= numReplicas) {
+      throw std::runtime_error("Vector id " + std::to_string(ids[u]) + " is out of range.");
+    }
+    shardUpdates[shard].push_back(u);
+  }
+
+  const auto& target = device.getTarget();
+  const auto vecBytes = D * target.getTypeSize(storageType);
+  const auto scalesPerVec = D / scaleBlock;
+  std::vector<std::uint16_t> halfVec(D);
+
+  // The full precision copy used for re-ranking is always in a remote buffer:
+  if (rerankCandidates) {
+    for (auto r = 0u; r < numReplicas; ++r) {
+      for (auto u : shardUpdates[r]) {
+        poplar::copyFloatToDeviceHalf(target, &values[u * D], halfVec.data(), D);
+        engine.copyToRemoteBuffer(halfVec.data(), "db_exact", ids[u] % shardSize, r);
+      }
+    }
+  }
+
+  if (shardPages > 0) {
+    // Write updates straight into the remote buffer that holds each shard:
+    std::vector<std::uint8_t> encoded(vecBytes);
+    std::vector<float> scales(scalesPerVec);
+    for (auto r = 0u; r < numReplicas; ++r) {
+      for (auto u : shardUpdates[r]) {
+        encodeVector(target, &values[u * D], encoded.data(), scales.data());
+        engine.copyToRemoteBuffer(encoded.data(), "db_pages", ids[u] % shardSize, r);
+        if (quantised()) {
+          engine.copyToRemoteBuffer(scales.data(), "db_page_scales", ids[u] % shardSize, r);
+        }
+      }
+    }
+    return;
+  }
+
+  // Stream the updates to every replica in batches. Unused entries get an out of
+  // range index which multiUpdate ignores:
+  std::size_t maxUpdates = 0;
+  for (const auto& s : shardUpdates) {
+    maxUpdates = std::max(maxUpdates, s.size());
+  }
+  std::vector<unsigned> indexBuffer(updateBatch * numReplicas);
+  std::vector<std::uint8_t> vecBuffer(updateBatch * vecBytes * numReplicas);
+  std::vector<float> scaleBuffer(updateBatch * scalesPerVec * numReplicas);
+  updateIndices.connectWriteStream(engine, indexBuffer);
+  updateVecs.connectWriteStream(engine, vecBuffer.data());
+  if (quantised()) {
+    updateScales.connectWriteStream(engine, scaleBuffer);
+  }
+  for (auto start = 0u; start < maxUpdates; start += updateBatch) {
+    std::fill(indexBuffer.begin(), indexBuffer.end(), numVecs);
+    for (auto r = 0u; r < numReplicas; ++r) {
+      for (auto i = 0u; i < updateBatch && start + i < shardUpdates[r].size(); ++i) {
+        const auto u = shardUpdates[r][start + i];
+        const auto slot = r * updateBatch + i;
+        indexBuffer[slot] = ids[u] % shardSize;
+        encodeVector(target, &values[u * D], &vecBuffer[slot * vecBytes], &scaleBuffer[slot * scalesPerVec]);
+      }
+    }
+    getPrograms().run(engine, "update_vectors");
+  }
+}
+
+void KNNBenchmark::serve(poplar::Engine& engine, const poplar::Device& device,
+                         std::vector<std::uint16_t>& queryBuffer, const std::vector<unsigned>& resultBuffer) {
+  using Clock = std::chrono::steady_clock;
+  streams::BatchingQueue<QueryRequest> queue(batchSize, std::chrono::microseconds(serveMaxDelayUs));
+
+  // Closed loop clients: each one submits its next query as soon as the
+  // previous one has been answered (so there are at most serveClients
+  // queries in flight):
+  std::vector<std::vector<double>> latencies(serveClients);
+  std::vector<std::thread> clients;
+  const auto startTime = Clock::now();
+  for (auto c = 0u; c < serveClients; ++c) {
+    clients.emplace_back([&, c]() {
+      for (auto r = 0u; r < serveRequests; ++r) {
+        std::promise<bool> answered;
+        auto future = answered.get_future();
+        QueryRequest request{std::vector<float>(D, .5f),
+                             [&](const unsigned* neighbours) { answered.set_value(neighbours != nullptr); }};
+        const auto submitTime = Clock::now();
+        if (!queue.push(std::move(request)) || !future.get()) {
+          break;
+        }
+        latencies[c].push_back(std::chrono::duration<double>(Clock::now() - submitTime).count());
+      }
+    });
+  }
+  std::thread closer([&]() {
+    for (auto& t : clients) {
+      t.join();
+    }
+    queue.stop();
+  });
+
+  // Server: run the search once per batch, padding partial batches with zero queries:
+  const auto& target = device.getTarget();
+  const auto& progs = getPrograms();
+  std::exception_ptr error;
+  for (auto batch = queue.popBatch(); !batch.empty(); batch = queue.popBatch()) {
+    if (error) {
+      for (auto& request : batch) { request.done(nullptr); }
+      continue;
+    }
+    try {
+      std::fill(queryBuffer.begin() + batch.size() * D, queryBuffer.begin() + batchSize * D, 0u);
+      for (auto i = 0u; i < batch.size(); ++i) {
+        poplar::copyFloatToDeviceHalf(target, batch[i].query.data(), &queryBuffer[i * D], D);
+      }
+      progs.run(engine, "serve_batch");
+      for (auto i = 0u; i < batch.size(); ++i) {
+        batch[i].done(&resultBuffer[i * k]);
+      }
+    } catch (...) {
+      // Fail every outstanding request so that the clients finish:
+      error = std::current_exception();
+      queue.stop();
+      for (auto& request : batch) { request.done(nullptr); }
+    }
+  }
+  closer.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  const auto seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+  std::vector<double> allLatencies;
+  for (const auto& l : latencies) {
+    allLatencies.insert(allLatencies.end(), l.begin(), l.end());
+  }
+  const auto latency = ipu_utils::computeTimingStats(allLatencies);
+  const auto stats = queue.getStats();
+  const double queriesPerSecond = stats.items / seconds;
+  const double meanBatch = stats.batches ? double(stats.items) / stats.batches : 0.0;
+  ipu_utils::logger()->info("Served {} queries from {} clients in {} batches (mean batch size {}, {} released by the deadline)",
+                            stats.items, serveClients, stats.batches, meanBatch, stats.deadlineBatches);
+  ipu_utils::logger()->info("Serving throughput: {} queries/sec, latency: {}", queriesPerSecond, latency);
+
+  auto& metrics = getResults();
+  metrics.add("serve_latency", latency);
+  metrics.add("serve_queries_per_second", queriesPerSecond, "queries/s");
+  metrics.add("serve_mean_batch_size", meanBatch, "queries");
+  metrics.add("serve_deadline_batch_fraction", stats.batches ? double(stats.deadlineBatches) / stats.batches : 0.0);
 }
 
 void KNNBenchmark::execute(poplar::Engine& engine, const poplar::Device& device) {
   ipu_utils::logger()->info("Execution starts");
   auto numReplicas = getGraphBuilder().getRuntimeConfig().numReplicas;
-  std::vector<float> vecsInput(numVecs * D * numReplicas, .5f);
+  const auto shardSize = getShardSize();
   std::vector<float> queryInput(batchSize * D * numReplicas, .5f);
   std::vector<unsigned> hostResult(batchSize * k * numReplicas, 0);
-  std::vector<std::uint16_t> vecsHalfInput(vecsInput.size(), 1u);
   std::vector<std::uint16_t> queryHalfInput(queryInput.size(), 1u);
 
-
-  poplar::copyFloatToDeviceHalf(
-        device.getTarget(), vecsInput.data(),
-        vecsHalfInput.data(), vecsHalfInput.size());
   poplar::copyFloatToDeviceHalf(
         device.getTarget(), queryInput.data(),
         queryHalfInput.data(), queryHalfInput.size());
 
   query.connectWriteStream(engine, queryHalfInput.data());
-  vecs.connectWriteStream(engine, vecsHalfInput.data());
   results.connectReadStream(engine, hostResult.data());
 
+  // Every vector in the database is the same:
+  const auto& target = device.getTarget();
+  const auto vecBytes = D * target.getTypeSize(storageType);
+  std::vector<float> databaseVec(D);
+  for (auto d = 0u; d < D; ++d) {
+    databaseVec[d] = databaseValue(d);
+  }
+  std::vector<std::uint8_t> encodedVec(vecBytes);
+  std::vector<float> vecScaleValues(D / scaleBlock);
+  encodeVector(target, databaseVec.data(), encodedVec.data(), vecScaleValues.data());
+  std::vector<std::uint16_t> halfVec(D);
+  poplar::copyFloatToDeviceHalf(target, databaseVec.data(), halfVec.data(), D);
+
+  std::vector<std::uint8_t> vecsInput;
+  std::vector<float> scalesInput;
+  if (shardPages == 0) {
+    // Host layout of vecs is [replica, D, N] (scales are [replica, N, D / scale-block]):
+    const auto elementBytes = target.getTypeSize(storageType);
+    vecsInput.resize(numVecs * vecBytes * numReplicas);
+    for (auto i = 0u; i < numVecs * D * numReplicas; ++i) {
+      const auto d = (i / numVecs) % D;
+      std::memcpy(&vecsInput[i * elementBytes], &encodedVec[d * elementBytes], elementBytes);
+    }
+    vecs.connectWriteStream(engine, vecsInput.data());
+    if (quantised()) {
+      for (auto v = 0u; v < numVecs * numReplicas; ++v) {
+        scalesInput.insert(scalesInput.end(), vecScaleValues.begin(), vecScaleValues.end());
+      }
+      vecScales.connectWriteStream(engine, scalesInput);
+    }
+  }
+
   const auto& progs = getPrograms();
   if (!skipInitialization) {
     progs.run(engine, "write_data");
+    // Every vector in every shard is the same so all rows come from one buffer:
+    ipu_utils::RemoteBufferFillOptions fillOptions;
+    fillOptions.threads = fillThreads;
+    auto fill = [&](const std::string& handle, const void* row, std::size_t rowBytes) {
+      for (auto r = 0u; r < numReplicas; ++r) {
+        fillOptions.replica = r;
+        ipu_utils::fillRemoteBuffer(engine, handle, shardSize, rowBytes,
+                                    [&](std::size_t, void*) { return row; }, fillOptions);
+      }
+    };
+    if (shardPages > 0) {
+      fill("db_pages", encodedVec.data(), vecBytes);
+      if (quantised()) {
+        fill("db_page_scales", vecScaleValues.data(), vecScaleValues.size() * sizeof(float));
+      }
+    }
+    if (rerankCandidates) {
+      fill("db_exact", halfVec.data(), D * sizeof(std::uint16_t));
+    }
   }
 
-  auto startTime = std::chrono::steady_clock::now();
-  progs.run(engine, "repeat_loop");
-  auto endTime = std::chrono::steady_clock::now();
-
-  auto seconds = std::chrono::duration<double>(endTime - startTime).count();
-  ipu_utils::logger()->info("Execution time: {}", seconds);
+  const auto cfg = getRuntimeConfig();
+  const auto timing = ipu_utils::timeProgram(progs, engine, "repeat_loop", cfg.warmupIterations, cfg.trials);
+  const auto seconds = timing.median;
+  ipu_utils::logger()->info("Execution time: {}", timing);
 
 
   double lookupsPerIteration = batchSize;
@@ -145,6 +749,62 @@ void KNNBenchmark::execute(poplar::Engine& engine, const poplar::Device& device)
   double lookupsPerSecond = totalLookups / seconds;
   ipu_utils::logger()->info("Queries/iteration: {}", lookupsPerIteration);
   ipu_utils::logger()->info("Queries/sec: {}", lookupsPerSecond);
+
+  // Bytes of on-chip (or paged) storage per database vector:
+  const double bytesPerVector = vecBytes + (quantised() ? (D / scaleBlock) * sizeof(float) : 0);
+  ipu_utils::logger()->info("Storage per vector: {} bytes", bytesPerVector);
+
+  auto& metrics = getResults();
+  metrics.add("execution_time", timing);
+  metrics.add("bytes_per_vector", bytesPerVector, "bytes");
+  metrics.add("queries_per_iteration", lookupsPerIteration, "queries");
+  metrics.add("queries_per_second", lookupsPerSecond, "queries/s");
+
+  if (updateBatch > 0) {
+    // Time incremental updates of random vectors (with unchanged values so
+    // that the search is unaffected):
+    std::mt19937 gen(1442);
+    std::uniform_int_distribution<std::size_t> idDist(0, shardSize * numReplicas - 1);
+    std::vector<std::size_t> ids(updateBatch * numReplicas);
+    std::vector<float> values(ids.size() * D);
+    for (auto i = 0u; i < values.size(); ++i) {
+      values[i] = databaseValue(i % D);
+    }
+    const auto updateTiming = ipu_utils::timeTrials([&]() {
+      for (auto& id : ids) { id = idDist(gen); }
+      updateVectors(engine, device, numReplicas, ids, values);
+    }, cfg.warmupIterations, cfg.trials);
+    const double updatesPerSecond = ids.size() / updateTiming.median;
+    ipu_utils::logger()->info("Update of {} vectors: {} ({} vectors/sec)", ids.size(), updateTiming, updatesPerSecond);
+    metrics.add("update_time", updateTiming);
+    metrics.add("updates_per_second", updatesPerSecond, "vectors/s");
+
+    // Check the update is visible to the search: a zero vector has the smallest
+    // dot product with every query and a copy of the query is nearest under
+    // the other metrics so it must be in every result. (With the all-to-all
+    // merge each replica reads back its slice of the queries so the results for
+    // the whole batch are still at the start of the host buffer):
+    const std::size_t testId = shardSize * numReplicas - 1;
+    const float testValue = metric == Metric::Dot ? 0.f : queryInput.front();
+    updateVectors(engine, device, numReplicas, {testId}, std::vector<float>(D, testValue));
+    progs.run(engine, "search_once");
+    progs.run(engine, "read_data");
+    std::size_t found = 0;
+    for (auto b = 0u; b < batchSize; ++b) {
+      const auto begin = hostResult.begin() + b * k;
+      found += std::find(begin, begin + k, testId) != begin + k;
+    }
+    if (found != batchSize) {
+      ipu_utils::logger()->error("Updated vector {} was only found by {}/{} queries", testId, found, batchSize);
+    } else {
+      ipu_utils::logger()->info("Updated vector {} was found by every query", testId);
+    }
+    metrics.add("update_found_fraction", double(found) / batchSize);
+  }
+
+  if (serveClients > 0) {
+    serve(engine, device, queryHalfInput, hostResult);
+  }
 }
 
 void KNNBenchmark::addToolOptions(boost::program_options::options_description& desc) {
@@ -174,5 +834,51 @@ void KNNBenchmark::addToolOptions(boost::program_options::options_description& d
   ("skip-initialization", po::value<bool>(&skipInitialization)->default_value(false),
    "Skip the initialization of the database"
   )
+  ("shard-pages", po::value<std::size_t>(&shardPages)->default_value(0),
+   "If non-zero each replica's shard of the database is stored in a remote buffer as this many pages "
+   "of N vectors which are loaded on chip one at a time for each search (so the database can be larger "
+   "than on-chip memory). If zero each replica holds its shard of N vectors on chip."
+  )
+  ("fill-threads", po::value<std::size_t>(&fillThreads)->default_value(1),
+   "Number of host threads used to fill the remote buffer pages. The threads prepare rows in parallel but "
+   "the copies to the device are serialised."
+  )
+  ("update-batch", po::value<std::size_t>(&updateBatch)->default_value(0),
+   "If non-zero benchmark incremental database updates: each update streams this many vectors per replica "
+   "(into the on-chip shard, or into the remote buffer if the shard is paged)."
+  )
+  ("serve-clients", po::value<std::size_t>(&serveClients)->default_value(0),
+   "If non-zero benchmark a serving loop: this many client threads submit single queries to a queue that "
+   "forms batches of up to batch-size queries (or fewer once the oldest query has waited serve-max-delay)."
+  )
+  ("serve-requests", po::value<std::size_t>(&serveRequests)->default_value(1000),
+   "Number of queries each serving client submits."
+  )
+  ("serve-max-delay", po::value<std::size_t>(&serveMaxDelayUs)->default_value(1000),
+   "Longest time (in microseconds) a query waits for its batch to fill before the batch is run."
+  )
+  ("metric", po::value<std::string>(&metricName)->default_value("dot"),
+   "Distance metric: 'dot' (smallest dot product is nearest), 'l2' or 'cosine'."
+  )
+  ("distance-kernel", po::value<std::string>(&kernelName)->default_value("matmul"),
+   "How distances are computed: 'matmul' computes the full [batch, N] distances with a matmul followed "
+   "by a topK, 'fused' uses a codelet that keeps only the best candidates so the distances are never stored."
+  )
+  ("storage-type", po::value<std::string>(&storageTypeName)->default_value("half"),
+   "Type used to store the database vectors: 'half' or 'int8' (quantised with a float scale per block of "
+   "scale-block elements, needs --distance-kernel fused)."
+  )
+  ("scale-block", po::value<std::size_t>(&scaleBlock)->default_value(0),
+   "Number of elements that share each int8 quantisation scale (0 means one scale per vector). Must divide D."
+  )
+  ("rerank", po::value<std::size_t>(&rerankCandidates)->default_value(0),
+   "If non-zero each shard finds this many candidates (at least k) which are re-ranked exactly using "
+   "full precision copies of the vectors fetched from a remote buffer."
+  )
+  ("merge", po::value<std::string>(&mergeName)->default_value("all-gather"),
+   "How replicas merge their results: 'all-gather' gathers every replica's Top K to every replica, "
+   "'all-to-all' sends each replica only the candidates for its slice of the queries which it then merges "
+   "(batch-size must be a multiple of the number of replicas)."
+  )
   ;
 }
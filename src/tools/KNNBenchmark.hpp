@@ -11,6 +11,14 @@
 struct KNNBenchmark :
   public ipu_utils::BuilderInterface, public ToolInterface
 {
+  /// Distance between a query and a database vector (smallest is nearest).
+  /// Values match the metric field of the FusedDistanceTopK vertex.
+  enum class Metric {
+    Dot = 0,   // Score is q.v
+    L2 = 1,    // Score is |v|^2 - 2 q.v (same ranking as |q - v|^2)
+    Cosine = 2 // Score is -q.v / |v| (same ranking as -cos(q, v))
+  };
+
   KNNBenchmark();
   virtual ~KNNBenchmark();
 
@@ -20,17 +28,46 @@ struct KNNBenchmark :
 
   // Tool interface:
   void addToolOptions(boost::program_options::options_description& desc) override;
-  void init(const boost::program_options::variables_map& args) override {}
+  void init(const boost::program_options::variables_map& args) override;
 
 private:
+  std::size_t getShardSize() const;
+  bool quantised() const { return storageType == poplar::SIGNED_CHAR; }
+  void encodeVector(const poplar::Target& target, const float* values, void* dst, float* scales) const;
+  void updateVectors(poplar::Engine& engine, const poplar::Device& device, std::size_t numReplicas,
+                     const std::vector<std::size_t>& ids, const std::vector<float>& values);
+  void serve(poplar::Engine& engine, const poplar::Device& device,
+             std::vector<std::uint16_t>& queryBuffer, const std::vector<unsigned>& resultBuffer);
+
   std::size_t batchSize;
   std::size_t k;
   std::size_t D;
   std::size_t numVecs;
   std::size_t iterations;
+  std::size_t shardPages;
+  std::size_t fillThreads;
+  std::size_t updateBatch;
+  std::size_t serveClients;
+  std::size_t serveRequests;
+  std::size_t serveMaxDelayUs;
   bool includeQueryTransfer, includeResultTransfer, skipInitialization;
+  std::string metricName, kernelName, mergeName, storageTypeName;
+  std::size_t scaleBlock;
+  std::size_t rerankCandidates;
+  poplar::Type storageType;
+  Metric metric;
+  bool fusedKernel;
+  bool allToAllMerge;
+  std::string codeletPath;
   ipu_utils::StreamableTensor query;
   ipu_utils::StreamableTensor vecs;
+  ipu_utils::StreamableTensor vecScales;
   ipu_utils::StreamableTensor results;
+  ipu_utils::StreamableTensor updateIndices;
+  ipu_utils::StreamableTensor updateVecs;
+  ipu_utils::StreamableTensor updateScales;
+  poplar::RemoteBuffer pages;
+  poplar::RemoteBuffer pageScales;
+  poplar::RemoteBuffer exactVecs;
 };
  
\ No newline at end of file
@@ -107,12 +107,10 @@ void MatmulBenchmark::execute(poplar::Engine& engine, const poplar::Device& devi
   const auto& progs = getPrograms();
   progs.run(engine, "write_data");
 
-  auto startTime = std::chrono::steady_clock::now();
-  progs.run(engine, "repeat_loop");
-  auto endTime = std::chrono::steady_clock::now();
-
-  auto seconds = std::chrono::duration<double>(endTime - startTime).count();
-  ipu_utils::logger()->info("Execution time: {}", seconds);
+  const auto cfg = getRuntimeConfig();
+  const auto timing = ipu_utils::timeProgram(progs, engine, "repeat_loop", cfg.warmupIterations, cfg.trials);
+  const auto seconds = timing.median;
+  ipu_utils::logger()->info("Execution time: {}", timing);
 
   progs.run(engine, "read_data");
 
@@ -128,6 +126,14 @@ void MatmulBenchmark::execute(poplar::Engine& engine, const poplar::Device& devi
   ipu_utils::logger()->info("Clock THz: {}", clockTHz);
   ipu_utils::logger()->info("TFLOPS/sec from cycles: {}", flopsPerCycle * clockTHz);
   ipu_utils::logger()->info("TFLOPS/sec measured: {}", tflopsPerSecond);
+
+  auto& metrics = getResults();
+  metrics.add("execution_time", timing);
+  metrics.add("flops_per_iteration", flopsPerIteration, "FLOP");
+  metrics.add("cycles_per_iteration", cycles, "cycles");
+  metrics.add("flops_per_cycle_per_tile", flopsPerCycle / tilesUsed, "FLOP/cycle");
+  metrics.add("tflops_per_second_from_cycles", flopsPerCycle * clockTHz, "TFLOP/s");
+  metrics.add("tflops_per_second_measured", tflopsPerSecond, "TFLOP/s");
 }
 
 void MatmulBenchmark::addToolOptions(boost::program_options::options_description& desc) {
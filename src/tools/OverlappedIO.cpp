@@ -2,10 +2,37 @@
 
 #include "OverlappedIO.hpp"
 
+#include <host_memory.hpp>
+#include <pipeline/pipeline.hpp>
+#include <streams/ring_buffer.hpp>
+
+#include <poplar/CycleCount.hpp>
 #include <pvti/pvti.hpp>
 
+#include <sstream>
+#include <stdexcept>
+
 static pvti::TraceChannel traceChannel{"streams"};
 
+// Add the stages of the IO pipeline. Phase 0 stages (host exchange on the IO
+// tiles and compute on the compute tiles) overlap. Phase 1 stages exchange
+// data between the IO tiles and the compute tiles. The stage structure (and
+// so the pipeline latency) depends only on the number of compute stages:
+static void addIOPipelineStages(pipeline::PipelineBuilder& pipeline, std::size_t computeStages,
+                                pipeline::StageFunction hostIn, pipeline::StageFunction internalIn,
+                                std::function<poplar::program::Program(std::size_t, std::size_t)> compute,
+                                pipeline::StageFunction internalOut, pipeline::StageFunction hostOut) {
+  pipeline.addStage("host_in", 0, hostIn);
+  pipeline.addStage("internal_in", 1, internalIn);
+  for (auto c = 0u; c < computeStages; ++c) {
+    pipeline.addStage("compute_" + std::to_string(c), 0, [compute, c](std::size_t slot) {
+      return compute(c, slot);
+    });
+  }
+  pipeline.addStage("internal_out", 1, internalOut);
+  pipeline.addStage("host_out", 0, hostOut);
+}
+
 class StreamInCallback : public poplar::StreamCallback {
 public:
   StreamInCallback(const std::vector<float>& data) : data_(data), completeCount(0) {};
@@ -62,29 +89,82 @@ private:
 void OverlappedIO::addToolOptions(boost::program_options::options_description& desc) {
   namespace po = boost::program_options;
   desc.add_options()
-  ("num-io-tiles", po::value<unsigned>(&numTilesForIO)->default_value(0u),
+  ("num-io-tiles", po::value<unsigned>(&requestedIOTiles)->default_value(0u),
     "Number of tiles to use for IO. Defaults to the minimum number.")
+  ("tune-io-tiles", po::bool_switch(&tuneIOTiles)->default_value(false),
+    "Before running, build, compile and time a separate pipeline for each candidate number of "
+    "IO tiles and report the split with the highest steady state throughput.")
+  ("tune-candidates", po::value<std::string>(&tuneCandidates)->default_value(""),
+    "Comma separated list of IO tile counts to try when tuning. By default the minimum "
+    "number of IO tiles is doubled until it reaches a quarter of the tiles.")
   ("work-size", po::value<std::size_t>(&sizePerWorker)->default_value(128u),
     "Amount of work to give each worker thread.")
+  ("compute-loops", po::value<unsigned>(&dummyComputeLoops)->default_value(512u),
+    "Amount of dummy compute in each compute vertex (in units of 1024 nop instructions).")
   ("iterations", po::value<std::size_t>(&numIterations)->default_value(100u),
     "Number of iterations of the IO pipeline.")
+  ("buffering-depth", po::value<unsigned>(&bufferingDepth)->default_value(4u),
+    "Buffering depth of the input FIFO. This is also the number of slots in the host ring buffer.")
+  ("input-callback", po::value<std::string>(&inputCallback)->default_value("fixed"),
+    "Host callback used for the input stream: 'fixed' copies the same data for every iteration, "
+    "'ring' serves data from a ring buffer that is filled by a separate producer thread.")
+  ("pipeline-buffers", po::value<std::size_t>(&pipelineBuffers)->default_value(1u),
+    "Number of buffer slots for each pipeline stage (e.g. 2 for double buffering).")
+  ("compute-stages", po::value<std::size_t>(&computeStages)->default_value(1u),
+    "Number of compute stages in the pipeline.")
+  ("stream-mode", po::value<std::string>(&streamMode)->default_value("callback"),
+    "How the host streams are connected: 'callback' uses stream callbacks that copy the data "
+    "(see input-callback), 'direct' connects the streams directly to page aligned host buffers.")
+  ("huge-pages", po::bool_switch(&hugePages)->default_value(false),
+    "Use huge pages for the host buffers in direct stream mode.")
   ;
 }
 
-void OverlappedIO::init(const boost::program_options::variables_map& args) {}
+void OverlappedIO::init(const boost::program_options::variables_map& args) {
+  if (inputCallback != "fixed" && inputCallback != "ring") {
+    throw std::runtime_error("Unrecognised input callback: '" + inputCallback + "'");
+  }
+  if (streamMode != "callback" && streamMode != "direct") {
+    throw std::runtime_error("Unrecognised stream mode: '" + streamMode + "'");
+  }
+  if (streamMode == "direct" && inputCallback != "fixed") {
+    throw std::runtime_error("Input callback '" + inputCallback + "' can not be used with direct stream mode.");
+  }
+  if (pipelineBuffers == 0 || computeStages == 0) {
+    throw std::runtime_error("The pipeline needs at least one buffer and one compute stage.");
+  }
+  if (bufferingDepth == 0) {
+    throw std::runtime_error("Buffering depth must be at least 1.");
+  }
+
+  // The steady state step count is needed in execute() which can run without
+  // build() (e.g. if the executable is loaded) so compute it from the options:
+  pipeline::PipelineBuilder shape(pipelineBuffers);
+  auto noop = [](std::size_t) { return poplar::program::Sequence(); };
+  addIOPipelineStages(shape, computeStages, noop, noop,
+                      [](std::size_t, std::size_t) { return poplar::program::Sequence(); }, noop, noop);
+  if (numIterations <= shape.latency()) {
+    throw std::runtime_error("Too few iterations for the pipeline to reach a steady state.");
+  }
+  steadyStateSteps = numIterations - shape.latency();
+}
 
 void OverlappedIO::build(poplar::Graph& graph, const poplar::Target& target) {
+  getPrograms().add("io_pipeline", buildPipeline(graph, target, requestedIOTiles, &getPrograms()));
+}
+
+poplar::program::Sequence OverlappedIO::buildPipeline(poplar::Graph& graph, const poplar::Target& target,
+                                                      unsigned ioTileCount, ipu_utils::ProgramManager* balancePrograms) {
   popops::addCodelets(graph);
   graph.addCodelets("../src/codelets/OverlappedIO/simple.cpp");
 
   // Get two disjoint sets of tiles to use for compute and IO:
   const auto numTotalTiles = target.getNumTiles();
   const auto minIOTiles = gcl::getMinIoTiles(graph);
-  numTilesForIO = std::max(minIOTiles, numTilesForIO);
+  numTilesForIO = std::max(minIOTiles, ioTileCount);
 
   ioTiles = gcl::perIPUTiles(graph, 0, numTilesForIO);
   numWorkerContexts = target.getNumWorkerContexts();
-  sizePerWorker = 128;
 
   computeTiles = gcl::perIPUTiles(graph, numTilesForIO, numTotalTiles - numTilesForIO);
   numComputeTiles = computeTiles.size();
@@ -100,13 +180,13 @@ void OverlappedIO::build(poplar::Graph& graph, const poplar::Target& target) {
   // Create two virtual graphs from the two disjoint sets of tiles.
   // These graphs can run in parallel:
   auto compute_graph = graph.createVirtualGraph(computeTiles);
-  poplar::ComputeSet cs_compute_0;
-  poplar::Tensor compute_tensor_in, compute_tensor_out;
-  std::tie(cs_compute_0, compute_tensor_in, compute_tensor_out) = buildComputeGraph(compute_graph, elementType);
+  std::vector<std::vector<poplar::ComputeSet>> compute_sets;
+  std::vector<poplar::Tensor> compute_tensors_in, compute_tensors_out;
+  std::tie(compute_sets, compute_tensors_in, compute_tensors_out) = buildComputeGraph(compute_graph, elementType);
 
   auto io_graph = graph.createVirtualGraph(ioTiles);
-  poplar::Tensor io_tensor_in, io_tensor_out;
-  std::tie(io_tensor_in, io_tensor_out) = buildIOGraph(io_graph, target, elementType);
+  std::vector<poplar::Tensor> io_tensors_in, io_tensors_out;
+  std::tie(io_tensors_in, io_tensors_out) = buildIOGraph(io_graph, target, elementType);
 
   // Create the input and output data FIFOs:
   auto stream_in = io_graph.addHostToDeviceFIFO(
@@ -114,92 +194,159 @@ void OverlappedIO::build(poplar::Graph& graph, const poplar::Target& target) {
     elementType,
     numTransferInElements,
     poplar::ReplicatedStreamMode::REPLICATE,
-    {{"bufferingDepth", "4"}});
+    {{"bufferingDepth", std::to_string(bufferingDepth)}});
 
   auto stream_out = io_graph.addDeviceToHostFIFO(
     "stream_out",
     elementType,
     numTransferOutElements);
 
-  // Create the copy programs:
+  // Build the pipeline from its stages. Each stage function returns the
+  // program that operates on the given buffer slot:
   const bool doNotOutline = true;
+  pipeline::PipelineBuilder pipeline(pipelineBuffers);
+  addIOPipelineStages(pipeline, compute_sets.size(),
+    // Transfer from the host to the IO tiles:
+    [&](std::size_t slot) {
+      return poplar::program::Copy(stream_in, io_tensors_in[slot]);
+    },
+    // Exchange from the IO tiles to the compute tiles:
+    [&](std::size_t slot) {
+      return poplar::program::Copy(io_tensors_in[slot].flatten(), compute_tensors_in[slot].flatten(), doNotOutline);
+    },
+    // Execute the compute sets for the compute tiles:
+    [&](std::size_t c, std::size_t slot) {
+      return poplar::program::Execute(compute_sets[c][slot]);
+    },
+    // Exchange results from the compute tiles to the IO tiles:
+    [&](std::size_t slot) {
+      return poplar::program::Copy(compute_tensors_out[slot].flatten(), io_tensors_out[slot].flatten(), doNotOutline);
+    },
+    // Transfer from the IO tiles to the host:
+    [&](std::size_t slot) {
+      return poplar::program::Copy(io_tensors_out[slot], stream_out);
+    });
+
+  ipu_utils::logger()->debug("IO pipeline schedule:\n{}", pipeline.describe(numIterations));
+
+  if (balancePrograms) {
+    // Programs that run the compute stages and the host IO stages on their
+    // own (numIterations times) so that they can be timed separately. The
+    // cycle counters do not sync so each only measures its own tile set:
+    poplar::program::Sequence computeBody;
+    for (const auto& stage_sets : compute_sets) {
+      computeBody.add(poplar::program::Execute(stage_sets.front()));
+    }
+    poplar::program::Sequence computeOnly{poplar::program::Repeat(numIterations, computeBody)};
+    auto computeCycles = poplar::cycleCount(compute_graph, computeOnly, 0, poplar::SyncType::NONE, "compute_cycles");
+    graph.createHostRead("compute_cycles", computeCycles);
+    balancePrograms->add("compute_only", computeOnly);
+
+    poplar::program::Sequence ioBody{
+      poplar::program::Copy(io_tensors_out.front(), stream_out),
+      poplar::program::Copy(stream_in, io_tensors_in.front())
+    };
+    poplar::program::Sequence ioOnly{poplar::program::Repeat(numIterations, ioBody)};
+    auto ioCycles = poplar::cycleCount(io_graph, ioOnly, 0, poplar::SyncType::NONE, "io_cycles");
+    graph.createHostRead("io_cycles", ioCycles);
+    balancePrograms->add("io_only", ioOnly);
+  }
 
-  // These copies do the transfers between the host and the IO tiles:
-  auto program_host_exchange_in = poplar::program::Copy(stream_in, io_tensor_in);
-  auto program_host_exchange_out = poplar::program::Copy(io_tensor_out, stream_out);
-
-  // These copies exchange data between the IO tiles and the compute tiles:
-  auto program_internal_exchange_in = poplar::program::Copy(
-    io_tensor_in.flatten(),
-    compute_tensor_in.flatten(),
-    doNotOutline);
-  auto program_internal_exchange_out = poplar::program::Copy(
-    compute_tensor_out.flatten(),
-    io_tensor_out.flatten(),
-    doNotOutline);
-
-  // Create the complete graph program:
-
-  // Execute the compute sets for the compute tiles:
-  auto program_compute = poplar::program::Execute(cs_compute_0);
-
-  // This is the main pipeline sequence that runs in a loop after ramp-up:
-  auto main_sequence = poplar::program::Sequence {
-    program_host_exchange_out,
-    program_host_exchange_in,
-    program_compute,
-    program_internal_exchange_out,
-    program_internal_exchange_in
-  };
+  // Time the steady state only so that ramp up/down do not skew the result
+  // (init() checked that there are enough iterations to have one):
+  auto schedule = pipeline.schedule(numIterations);
+  poplar::program::Sequence steadyState{schedule.steadyState};
+  auto steadyStateCycles = poplar::cycleCount(graph, steadyState, 0, poplar::SyncType::INTERNAL, "steady_state_cycles");
+  graph.createHostRead("steady_state_cycles", steadyStateCycles);
+  return poplar::program::Sequence{schedule.prologue, steadyState, schedule.epilogue};
+}
 
-  // Create the pipeline (first ramp up, then run main-sequence loop, then ramp-down):
-  auto pipeline = poplar::program::Sequence{
-    // Ramp up/Priming stage
-    // comm input buffer = data[0]
-    program_host_exchange_in,
-    // comp input buffer = data[0]
-    program_internal_exchange_in,
-    // [
-    //   comp output buffer = output[0],
-    //   comm input buffer = data[1]
-    // ]
-    poplar::program::Sequence{program_compute, program_host_exchange_in},
-    // comm output buffer = output[0]
-    program_internal_exchange_out,
-    // comp input buffer = data[1]
-    program_internal_exchange_in,
-    // At this point the state is:
-    // [
-    //   comm input = data[1], (stale)
-    //   comp input = data[1],
-    //   comp output = data[0],  (stale)
-    //   comm output = output[0]
-    // ]
-    poplar::program::Repeat(numIterations - 2, main_sequence),
-    // At this point the state is:
-    // [
-    //   comm input = data[-1], (stale)
-    //   comp input = data[-1],
-    //   comp output = output[-2], (stale)
-    //   comm output = output[-2],
-    // ]
-    // Next steps:
-    // [
-    //   outfeed output[-2],
-    //   comp output = output[-1]
-    // ]
-    poplar::program::Sequence{program_host_exchange_out, program_compute},
-    // comm output = output[-1]
-    program_internal_exchange_out,
-    // outfeed output[-1]
-    program_host_exchange_out
-  };
+std::vector<unsigned> OverlappedIO::getTuningCandidates(const poplar::Target& target) {
+  std::vector<unsigned> candidates;
+  if (!tuneCandidates.empty()) {
+    std::stringstream ss(tuneCandidates);
+    std::string c;
+    while (std::getline(ss, c, ',')) {
+      try {
+        candidates.push_back(std::stoul(c));
+      } catch (const std::logic_error&) {
+        throw std::runtime_error("Option 'tune-candidates' has an invalid tile count: '" + c + "'");
+      }
+    }
+    return candidates;
+  }
 
-  // Register the completed pipeline program with the program manager:
-  getPrograms().add("io_pipeline", pipeline);
+  poplar::Graph probe(target);
+  const auto maxIOTiles = target.getTilesPerIPU() / 4;
+  for (auto c = std::max(1u, gcl::getMinIoTiles(probe)); c <= maxIOTiles; c *= 2) {
+    candidates.push_back(c);
+  }
+  return candidates;
+}
+
+void OverlappedIO::runIOTileTuner(const poplar::Device& device) {
+  const auto& target = device.getTarget();
+  auto& metrics = getResults();
+
+  // Building a candidate pipeline overwrites the sizes computed for
+  // the main graph so save them and restore them when we are done:
+  const auto mainGraphState = std::make_tuple(
+    numTilesForIO, ioTiles, computeTiles, numComputeTiles,
+    numTransferInElements, numTransferOutElements);
+
+  unsigned bestIOTiles = 0;
+  double bestGigaBytesPerSec = 0.0;
+  for (const auto candidate : getTuningCandidates(target)) {
+    ipu_utils::logger()->info("Tuning: trying {} IO tiles", candidate);
+    try {
+      poplar::Graph graph(target);
+      auto prog = buildPipeline(graph, target, candidate, nullptr);
+      poplar::Engine engine(graph, {prog});
+      engine.load(device);
+
+      std::vector<float> in(numTransferInElements, 1.f);
+      std::vector<float> out(numTransferOutElements);
+      ipu_utils::connectStream(engine, "stream_in", in);
+      ipu_utils::connectStream(engine, "stream_out", out);
+      engine.run(0);
+
+      std::uint64_t cycles = 0;
+      ipu_utils::readScalar(engine, "steady_state_cycles", cycles);
+      const double cyclesPerIteration = cycles / double(steadyStateSteps);
+      const double secsPerIteration = cyclesPerIteration / target.getTileClockFrequency();
+      const double gigaBytesPerSec = 1e-9 * numTransferInElements * sizeof(float) / secsPerIteration;
+      ipu_utils::logger()->info("Tuning: {} IO tiles, {} compute tiles: {} cycles/iteration, input rate: {} GB/sec",
+                                numTilesForIO, numComputeTiles, cyclesPerIteration, gigaBytesPerSec);
+      metrics.add("tune_" + std::to_string(numTilesForIO) + "_io_tiles_cycles_per_iteration", cyclesPerIteration, "cycles");
+      metrics.add("tune_" + std::to_string(numTilesForIO) + "_io_tiles_input_bandwidth", gigaBytesPerSec, "GB/s");
+
+      if (gigaBytesPerSec > bestGigaBytesPerSec) {
+        bestGigaBytesPerSec = gigaBytesPerSec;
+        bestIOTiles = numTilesForIO;
+      }
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->warn("Tuning: {} IO tiles is not a valid split: {}", candidate, e.what());
+    }
+  }
+
+  std::tie(numTilesForIO, ioTiles, computeTiles, numComputeTiles,
+           numTransferInElements, numTransferOutElements) = mainGraphState;
+
+  if (bestIOTiles == 0) {
+    throw std::runtime_error("IO tile tuning found no valid IO/compute split.");
+  }
+  ipu_utils::logger()->info("Tuning: best split uses {} IO tiles (input rate: {} GB/sec)",
+                            bestIOTiles, bestGigaBytesPerSec);
+  metrics.add("tune_best_io_tiles", bestIOTiles);
+  metrics.add("tune_best_input_bandwidth", bestGigaBytesPerSec, "GB/s");
 }
 
 void OverlappedIO::execute(poplar::Engine& engine, const poplar::Device& device) {
+  if (tuneIOTiles) {
+    runIOTileTuner(device);
+    // The tuner loaded other engines so the main one has to be loaded again:
+    engine.load(device);
+  }
 
   ipu_utils::logger()->info("Num compute tiles: {}", numComputeTiles);
   std::vector<float> host_in(numTransferInElements);
@@ -211,102 +358,209 @@ void OverlappedIO::execute(poplar::Engine& engine, const poplar::Device& device)
   }
   std::cout << "..." << std::endl;
 
-  engine.connectStreamToCallback(
-      "stream_in",
-      0,
-      std::make_unique<StreamInCallback>(host_in));
-
   std::vector<float> host_out(numTransferOutElements);
   for (unsigned i = 0; i < host_out.size(); ++i) {
       host_out[i] = -1.0;
   }
 
-  engine.connectStreamToCallback(
-      "stream_out",
-      std::make_unique<StreamOutCallback>(host_out));
+  // In direct mode the streams read and write page aligned buffers with no callback:
+  ipu_utils::HostBuffer<float> direct_in;
+  ipu_utils::HostBuffer<float> direct_out;
+
+  // The ring buffered callback is owned by the engine so keep a pointer to read its stats:
+  streams::RingBufferCallback<float>* ringCallback = nullptr;
+  if (streamMode == "direct") {
+    direct_in = ipu_utils::HostBuffer<float>(host_in.size(), hugePages);
+    std::copy(host_in.begin(), host_in.end(), direct_in.begin());
+    direct_out = ipu_utils::HostBuffer<float>(host_out.size(), hugePages);
+    std::copy(host_out.begin(), host_out.end(), direct_out.begin());
+    ipu_utils::logger()->info("Streams connected directly to host buffers (huge pages: {})",
+                              direct_in.usesHugePages() && direct_out.usesHugePages());
+    ipu_utils::connectStream(engine, "stream_in", direct_in);
+    ipu_utils::connectStream(engine, "stream_out", direct_out);
+  } else if (inputCallback == "ring") {
+    // The producer thread generates the same values as host_in but offset by
+    // the iteration number so that every transfer is fresh data:
+    auto producer = [this](float* slot, std::size_t size, std::size_t seq) {
+      for (std::size_t i = 0; i < size; ++i) {
+        slot[i] = i / sizePerWorker + seq;
+      }
+    };
+    auto callback = std::make_unique<streams::RingBufferCallback<float>>(
+      bufferingDepth, numTransferInElements, producer);
+    ringCallback = callback.get();
+    engine.connectStreamToCallback("stream_in", 0, std::move(callback));
+  } else {
+    engine.connectStreamToCallback(
+        "stream_in",
+        0,
+        std::make_unique<StreamInCallback>(host_in));
+  }
 
+  if (streamMode == "callback") {
+    engine.connectStreamToCallback(
+        "stream_out",
+        std::make_unique<StreamOutCallback>(host_out));
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
   getPrograms().run(engine, "io_pipeline");
+  auto endTime = std::chrono::steady_clock::now();
+  const auto seconds = std::chrono::duration<double>(endTime - startTime).count();
+  ipu_utils::logger()->info("IO pipeline time: {} secs ({} secs/iteration)", seconds, seconds / numIterations);
+
+  auto& metrics = getResults();
+  metrics.add("pipeline_time", seconds, "s");
+  metrics.add("pipeline_time_per_iteration", seconds / numIterations, "s");
+
+  if (ringCallback) {
+    const auto stats = ringCallback->getStats();
+    const double missFraction = stats.prefetchCalls ? stats.prefetchMisses / double(stats.prefetchCalls) : 0.0;
+    ipu_utils::logger()->info("Ring buffer: {} prefetches, {} found no data ready ({}%)",
+                              stats.prefetchCalls, stats.prefetchMisses, 100.0 * missFraction);
+    ipu_utils::logger()->info("Ring buffer: {} fetches, {} waited for the producer",
+                              stats.fetchCalls, stats.fetchWaits);
+    ipu_utils::logger()->info("Ring buffer: {} slots produced, producer waited for a free slot {} times",
+                              stats.produced, stats.producerStalls);
+    metrics.add("prefetch_calls", stats.prefetchCalls);
+    metrics.add("prefetch_misses", stats.prefetchMisses);
+    metrics.add("prefetch_miss_fraction", missFraction);
+    metrics.add("fetch_calls", stats.fetchCalls);
+    metrics.add("fetch_waits", stats.fetchWaits);
+    metrics.add("producer_stalls", stats.producerStalls);
+  }
 
+  if (streamMode == "direct") {
+    std::copy(direct_out.begin(), direct_out.end(), host_out.begin());
+  }
   for (unsigned i = 0; i < std::min(8ul,host_out.size()); ++i) {
       std::cout << "host_out[" << i << "] = " << host_out[i] << std::endl;
   }
   std::cout << "..." << std::endl;
+
+  // Compare the pipeline's steady state with the compute and host IO stages
+  // run on their own. This has to come last as it consumes more stream data:
+  std::uint64_t steadyCycles = 0;
+  ipu_utils::readScalar(engine, "steady_state_cycles", steadyCycles);
+  getPrograms().run(engine, "compute_only");
+  getPrograms().run(engine, "io_only");
+  std::uint64_t computeCycles = 0;
+  std::uint64_t ioCycles = 0;
+  ipu_utils::readScalar(engine, "compute_cycles", computeCycles);
+  ipu_utils::readScalar(engine, "io_cycles", ioCycles);
+  const double pipelineCyclesPerIteration = steadyCycles / double(steadyStateSteps);
+  const double computeCyclesPerIteration = computeCycles / double(numIterations);
+  const double ioCyclesPerIteration = ioCycles / double(numIterations);
+  const bool computeBound = computeCyclesPerIteration >= ioCyclesPerIteration;
+  ipu_utils::logger()->info("Cycles per iteration: pipeline steady state: {} compute: {} host IO: {}",
+                            pipelineCyclesPerIteration, computeCyclesPerIteration, ioCyclesPerIteration);
+  ipu_utils::logger()->info("Pipeline is {} bound (compute/IO ratio: {})",
+                            computeBound ? "compute" : "IO", computeCyclesPerIteration / ioCyclesPerIteration);
+  metrics.add("pipeline_cycles_per_iteration", pipelineCyclesPerIteration, "cycles");
+  metrics.add("compute_cycles_per_iteration", computeCyclesPerIteration, "cycles");
+  metrics.add("io_cycles_per_iteration", ioCyclesPerIteration, "cycles");
+  metrics.add("compute_io_ratio", computeCyclesPerIteration / ioCyclesPerIteration);
+  metrics.add("compute_bound", computeBound ? 1.0 : 0.0);
 }
 
-std::tuple<poplar::ComputeSet, poplar::Tensor, poplar::Tensor>
+std::tuple<std::vector<std::vector<poplar::ComputeSet>>, std::vector<poplar::Tensor>, std::vector<poplar::Tensor>>
 OverlappedIO::buildComputeGraph(poplar::Graph& compute_graph, poplar::Type dtype) {
-  // Construct the compute graph
-  auto compute_tensor_in = compute_graph.addVariable(
-    dtype,
-    {numComputeTiles, numWorkerContexts, sizePerWorker},
-    "compute_tensor_in");
+  // Construct the compute graph. Every compute stage reads and writes its own
+  // buffers so that stages can work on different pipeline items. Each buffer
+  // has a copy for every pipeline buffer slot.
+  auto addSlots = [&](const std::string& name, std::vector<std::size_t> shape) {
+    std::vector<poplar::Tensor> slots;
+    for (auto b = 0u; b < pipelineBuffers; ++b) {
+      auto t = compute_graph.addVariable(dtype, shape, name + "_" + std::to_string(b));
+      for (unsigned tile = 0; tile < numComputeTiles; ++tile) {
+        compute_graph.setTileMapping(t[tile], tile);
+      }
+      slots.push_back(t);
+    }
+    return slots;
+  };
 
-  for (unsigned tile = 0; tile < numComputeTiles; ++tile) {
-    compute_graph.setTileMapping(compute_tensor_in[tile], tile);
+  // Stage c reads stage_buffers[c] and writes stage_buffers[c + 1]:
+  std::vector<std::vector<poplar::Tensor>> stage_buffers;
+  stage_buffers.push_back(addSlots("compute_tensor_in", {numComputeTiles, numWorkerContexts, sizePerWorker}));
+  for (auto c = 1u; c < computeStages; ++c) {
+    stage_buffers.push_back(addSlots("compute_tensor_" + std::to_string(c),
+                                     {numComputeTiles, numWorkerContexts, sizePerWorker}));
   }
 
-  numTransferInElements = compute_tensor_in.numElements();
+  numTransferInElements = stage_buffers.front().front().numElements();
   ipu_utils::logger()->debug("numTransferInElements: {}", numTransferInElements);
 
   numTransferOutElements = numComputeTiles * numWorkerContexts;
   ipu_utils::logger()->debug("numTransferOutElements: {}", numTransferOutElements);
-  auto compute_tensor_out = compute_graph.addVariable(
-    dtype,
-    {numComputeTiles, numWorkerContexts},
-    "compute_tensor_out");
-
-  for (unsigned tile = 0; tile < numComputeTiles; ++tile) {
-    compute_graph.setTileMapping(compute_tensor_out[tile], tile);
-  }
-
-  auto cs_compute_0 = compute_graph.addComputeSet("cs_compute_0");
-  for (unsigned tile = 0; tile < numComputeTiles; ++tile) {
-    for (unsigned worker = 0; worker < numWorkerContexts; ++worker) {
-      auto vertex = compute_graph.addVertex(cs_compute_0, "ComputeVertex");
-
-      compute_graph.connect(vertex["in"], compute_tensor_in[tile][worker]);
-      compute_graph.connect(vertex["out"], compute_tensor_out[tile][worker]);
-
-      compute_graph.setTileMapping(vertex, tile);
+  stage_buffers.push_back(addSlots("compute_tensor_out", {numComputeTiles, numWorkerContexts}));
+
+  // The last stage reduces the data using ComputeVertex. Any earlier stages
+  // copy it through with the same amount of dummy compute:
+  std::vector<std::vector<poplar::ComputeSet>> compute_sets(computeStages);
+  for (auto c = 0u; c < computeStages; ++c) {
+    const bool last = c + 1 == computeStages;
+    const auto vertexName = last ? "ComputeVertex" : "PassThroughVertex";
+    for (auto b = 0u; b < pipelineBuffers; ++b) {
+      auto cs = compute_graph.addComputeSet("cs_compute_" + std::to_string(c) + "_" + std::to_string(b));
+      const auto& in = stage_buffers[c][b];
+      const auto& out = stage_buffers[c + 1][b];
+      for (unsigned tile = 0; tile < numComputeTiles; ++tile) {
+        for (unsigned worker = 0; worker < numWorkerContexts; ++worker) {
+          auto vertex = compute_graph.addVertex(cs, vertexName);
+          compute_graph.setInitialValue(vertex["dummyLoops"], dummyComputeLoops);
+
+          compute_graph.connect(vertex["in"], in[tile][worker]);
+          compute_graph.connect(vertex["out"], out[tile][worker]);
+
+          compute_graph.setTileMapping(vertex, tile);
+        }
+      }
+      compute_sets[c].push_back(cs);
     }
   }
 
-  return std::make_tuple(cs_compute_0, compute_tensor_in, compute_tensor_out);
+  return std::make_tuple(compute_sets, stage_buffers.front(), stage_buffers.back());
 }
 
-std::tuple<poplar::Tensor, poplar::Tensor>
+std::tuple<std::vector<poplar::Tensor>, std::vector<poplar::Tensor>>
 OverlappedIO::buildIOGraph(poplar::Graph& io_graph, const poplar::Target& target, poplar::Type elementType) {
-  // Construct the IO graph
-  if ((numTransferInElements % numTilesForIO) != 0) {
-      throw std::runtime_error(
-          "Number of io tiles does not divide compute elements");
-  }
-
-  const auto num_elements_in_per_io_tile = numTransferInElements / numTilesForIO;
-  const auto num_elements_out_per_io_tile = numTransferOutElements / numTilesForIO;
+  // Construct the IO graph. If the number of IO tiles does not divide the
+  // number of elements the last tiles get fewer elements:
+  auto ceilDiv = [](std::size_t a, std::size_t b) { return (a + b - 1) / b; };
+  const auto num_elements_in_per_io_tile = ceilDiv(numTransferInElements, numTilesForIO);
+  const auto num_elements_out_per_io_tile = ceilDiv(numTransferOutElements, numTilesForIO);
 
   ipu_utils::logger()->debug("num_elements_in_per_io_tile: {}", num_elements_in_per_io_tile);
   ipu_utils::logger()->debug("num_elements_out_per_io_tile: {}", num_elements_out_per_io_tile);
 
-  if ((num_elements_in_per_io_tile + num_elements_out_per_io_tile) * target.getTypeSize(elementType) > target.getBytesPerTile()) {
+  const auto bytesPerIoTile = pipelineBuffers * (num_elements_in_per_io_tile + num_elements_out_per_io_tile) *
+                              target.getTypeSize(elementType);
+  if (bytesPerIoTile > target.getBytesPerTile()) {
     throw std::runtime_error("Too many bytes requested per io tile");
   }
 
-  auto io_tensor_in = io_graph.addVariable(
-    elementType,
-    {numTilesForIO, num_elements_in_per_io_tile},
-    "io_tensor_in");
-  for (unsigned tile = 0; tile < numTilesForIO; ++tile) {
-    io_graph.setTileMapping(io_tensor_in[tile], tile);
-  }
+  // Map contiguous chunks of a flat tensor over the IO tiles:
+  auto mapOverIOTiles = [&](poplar::Tensor t, std::size_t elementsPerTile) {
+    for (unsigned tile = 0; tile < numTilesForIO; ++tile) {
+      const auto begin = std::min(t.numElements(), tile * elementsPerTile);
+      const auto end = std::min(t.numElements(), begin + elementsPerTile);
+      io_graph.setTileMapping(t.slice(begin, end), tile);
+    }
+  };
 
-  auto io_tensor_out = io_graph.addVariable(
-      elementType,
-      {numTilesForIO, num_elements_out_per_io_tile},
-      "io_tensor_out");
-  for (unsigned tile = 0; tile < numTilesForIO; ++tile) {
-      io_graph.setTileMapping(io_tensor_out[tile], tile);
+  std::vector<poplar::Tensor> io_tensors_in, io_tensors_out;
+  for (auto b = 0u; b < pipelineBuffers; ++b) {
+    auto io_tensor_in = io_graph.addVariable(
+      elementType, {numTransferInElements}, "io_tensor_in_" + std::to_string(b));
+    mapOverIOTiles(io_tensor_in, num_elements_in_per_io_tile);
+    io_tensors_in.push_back(io_tensor_in);
+
+    auto io_tensor_out = io_graph.addVariable(
+      elementType, {numTransferOutElements}, "io_tensor_out_" + std::to_string(b));
+    mapOverIOTiles(io_tensor_out, num_elements_out_per_io_tile);
+    io_tensors_out.push_back(io_tensor_out);
   }
 
-  return std::make_tuple(io_tensor_in, io_tensor_out);
+  return std::make_tuple(io_tensors_in, io_tensors_out);
 }
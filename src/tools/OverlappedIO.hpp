@@ -33,19 +33,36 @@ public:
 
 private:
 
-  std::tuple<poplar::ComputeSet, poplar::Tensor, poplar::Tensor>
+  poplar::program::Sequence buildPipeline(poplar::Graph& graph, const poplar::Target& target,
+                                          unsigned ioTileCount, ipu_utils::ProgramManager* balancePrograms);
+
+  std::vector<unsigned> getTuningCandidates(const poplar::Target& target);
+  void runIOTileTuner(const poplar::Device& device);
+
+  std::tuple<std::vector<std::vector<poplar::ComputeSet>>, std::vector<poplar::Tensor>, std::vector<poplar::Tensor>>
   buildComputeGraph(poplar::Graph& compute_graph, poplar::Type dtype);
 
-  std::tuple<poplar::Tensor, poplar::Tensor>
+  std::tuple<std::vector<poplar::Tensor>, std::vector<poplar::Tensor>>
   buildIOGraph(poplar::Graph& io_graph, const poplar::Target& target, poplar::Type elementType);
 
+  unsigned requestedIOTiles;
+  bool tuneIOTiles;
+  std::string tuneCandidates;
+  std::size_t steadyStateSteps = 0; // Set in init() (execute() may run without build()).
   unsigned numTilesForIO;
   std::vector<unsigned> ioTiles;
   std::vector<unsigned> computeTiles;
   std::size_t numWorkerContexts;
   std::size_t sizePerWorker;
+  unsigned dummyComputeLoops;
   std::size_t numIterations;
   std::size_t numComputeTiles;
   std::size_t numTransferInElements;
   std::size_t numTransferOutElements;
+  unsigned bufferingDepth;
+  std::size_t pipelineBuffers;
+  std::size_t computeStages;
+  std::string inputCallback;
+  std::string streamMode;
+  bool hugePages;
 };
@@ -2,15 +2,78 @@
 
 #include "RemoteBufferBenchmark.hpp"
 
+#include <remote_buffer_loader.hpp>
+
 #include <popops/codelets.hpp>
-#include <popops/Encoding.hpp>
+#include <popops/DynamicSlice.hpp>
+#include <popops/ElementWise.hpp>
+#include <popops/Zero.hpp>
 
 #include <chrono>
+#include <cstring>
 #include <map>
+#include <numeric>
+#include <random>
 
 RemoteBufferBenchmark::RemoteBufferBenchmark() {}
 RemoteBufferBenchmark::~RemoteBufferBenchmark() {}
 
+void RemoteBufferBenchmark::init(const boost::program_options::variables_map& args) {
+  const std::map<std::string, AccessPattern> patterns = {
+    {"sequential", AccessPattern::Sequential},
+    {"strided", AccessPattern::Strided},
+    {"random", AccessPattern::Random},
+    {"partial", AccessPattern::Partial},
+    {"write", AccessPattern::Write},
+    {"read-then-write", AccessPattern::ReadThenWrite}
+  };
+  if (patterns.count(accessPatternName) == 0) {
+    throw std::runtime_error("Unknown access pattern: '" + accessPatternName +
+                             "' (choose sequential, strided, random, partial, write or read-then-write).");
+  }
+  accessPattern = patterns.at(accessPatternName);
+
+  if (rowsPerCopy == 0) {
+    rowsPerCopy = bufferRepeats;
+  }
+  if (bufferRepeats % rowsPerCopy != 0) {
+    throw std::runtime_error("rows-per-copy must divide the number of rows (repeats).");
+  }
+  if (accessPattern == AccessPattern::Strided && std::gcd(stride, bufferRepeats) != 1) {
+    throw std::runtime_error("The stride must be coprime with the number of rows (repeats) so that "
+                             "the strided access pattern visits every row.");
+  }
+  if (partialElements == 0) {
+    partialElements = bufferElements / 2;
+  }
+  if (accessPattern == AccessPattern::Partial &&
+      (partialElements == 0 || bufferElements % partialElements != 0)) {
+    throw std::runtime_error("partial-elements must divide the row size (elements).");
+  }
+}
+
+std::vector<unsigned> RemoteBufferBenchmark::rowIndices() const {
+  std::vector<unsigned> indices(bufferRepeats);
+  std::iota(indices.begin(), indices.end(), 0u);
+  if (accessPattern == AccessPattern::Strided) {
+    for (auto i = 0u; i < bufferRepeats; ++i) {
+      indices[i] = (i * stride) % bufferRepeats;
+    }
+  } else if (accessPattern == AccessPattern::Random) {
+    std::mt19937 gen(1442);
+    std::uniform_int_distribution<unsigned> dist(0, bufferRepeats - 1);
+    for (auto& i : indices) { i = dist(gen); }
+  } else if (accessPattern == AccessPattern::Partial) {
+    // Partial rows are rows of a buffer that splits each full row into parts:
+    for (auto& i : indices) { i *= bufferElements / partialElements; }
+  }
+  return indices;
+}
+
+std::size_t RemoteBufferBenchmark::deviceRowElements() const {
+  return accessPattern == AccessPattern::Partial ? partialElements : bufferElements;
+}
+
 void RemoteBufferBenchmark::build(poplar::Graph& g, const poplar::Target&) {
   using namespace poplar::program;
 
@@ -27,21 +90,72 @@ void RemoteBufferBenchmark::build(poplar::Graph& g, const poplar::Target&) {
     "remote_buffer", dtype, bufferElements, bufferRepeats,
     rearrangeOnHost, optimiseMemory);
 
-  // Create a tensor to hold contents:
-  auto tensor = g.addVariable(dtype, {bufferRepeats, bufferElements},
+  // The IPU side of the benchmark uses a separate buffer for partial rows
+  // (each full row split into parts) and for the writes in read-then-write mode:
+  auto deviceBuffer = buffer;
+  const auto rowElements = deviceRowElements();
+  if (accessPattern == AccessPattern::Partial) {
+    deviceBuffer = g.addRemoteBuffer("remote_buffer_parts", dtype, rowElements,
+                                     bufferRepeats * (bufferElements / rowElements), rearrangeOnHost, optimiseMemory);
+  }
+  poplar::RemoteBuffer writeBuffer = buffer;
+  if (accessPattern == AccessPattern::ReadThenWrite) {
+    writeBuffer = g.addRemoteBuffer("remote_buffer_out", dtype, bufferElements, bufferRepeats,
+                                    rearrangeOnHost, optimiseMemory);
+  }
+  ipu_utils::logger()->info("Access pattern: {} ({} rows of {} elements per copy)",
+                            accessPatternName, rowsPerCopy, rowElements);
+
+  // Create a tensor to hold contents of one copy:
+  auto tensor = g.addVariable(dtype, {rowsPerCopy, rowElements},
                               poplar::VariableMappingMethod::LINEAR, "ipu_buffer");
+  auto writeTensor = g.addVariable(dtype, {rowsPerCopy, rowElements},
+                                   poplar::VariableMappingMethod::LINEAR, "ipu_write_buffer");
 
-  // Create a tensor to index all repeats of the remote buffer:
+  // Create a tensor to index all repeats of the remote buffer (in the order of the access pattern):
+  const auto numCopies = bufferRepeats / rowsPerCopy;
   Sequence setup;
-  auto indices = g.addVariable(poplar::UNSIGNED_INT, {bufferRepeats},
-                               poplar::VariableMappingMethod::LINEAR, "ipu_buffer");
-  popops::iota(g, indices, 0u, setup, "create_buffer_indices");
+  auto indices = g.addVariable(poplar::UNSIGNED_INT, {numCopies, rowsPerCopy},
+                               poplar::VariableMappingMethod::LINEAR, "ipu_buffer_indices");
+  auto hostIndices = rowIndices();
+  auto indexValues = g.addConstant<unsigned>(poplar::UNSIGNED_INT, {numCopies, rowsPerCopy},
+                                             hostIndices, "buffer_indices");
+  g.setTileMapping(indexValues, g.getTileMapping(indices));
+  setup.add(Copy(indexValues, indices, false, "create_buffer_indices"));
+  if (accessPattern == AccessPattern::Write || accessPattern == AccessPattern::ReadThenWrite) {
+    popops::zero(g, writeTensor, setup, "init_write_buffer");
+  }
   getPrograms().add("setup", setup);
 
-  Sequence ipuReadFromBuffer;
-  ipuReadFromBuffer.add(Copy(buffer, tensor, indices));
+  // Each copy transfers rowsPerCopy rows. Multiple copies per iteration step
+  // through the indices with a counter:
+  Sequence copyRows;
+  auto offsets = indices[0];
+  auto copyIndex = g.addVariable(poplar::UNSIGNED_INT, {1}, "copy_index");
+  g.setTileMapping(copyIndex, 0);
+  if (numCopies > 1) {
+    offsets = popops::dynamicSlice(g, indices, copyIndex, {0}, {1}, copyRows, "slice_indices").flatten();
+    popops::addInPlace(g, copyIndex, 1u, copyRows, "next_copy");
+  }
+  // The read and write of read-then-write are separate copies so run one after the other:
+  if (accessPattern != AccessPattern::Write) {
+    copyRows.add(Copy(deviceBuffer, tensor, offsets));
+  }
+  if (accessPattern == AccessPattern::Write || accessPattern == AccessPattern::ReadThenWrite) {
+    copyRows.add(Copy(writeTensor, writeBuffer, offsets));
+  }
+
+  Sequence ipuBufferTransfers;
+  if (numCopies > 1) {
+    auto zero = g.addConstant(poplar::UNSIGNED_INT, {1}, 0u, "zero");
+    g.setTileMapping(zero, 0);
+    ipuBufferTransfers.add(Copy(zero, copyIndex));
+    ipuBufferTransfers.add(Repeat(numCopies, copyRows));
+  } else {
+    ipuBufferTransfers.add(copyRows);
+  }
 
-  auto loop = poplar::program::Repeat(iterations, ipuReadFromBuffer);
+  auto loop = poplar::program::Repeat(iterations, ipuBufferTransfers);
   getPrograms().add("repeat_loop", loop);
 }
 
@@ -56,46 +170,104 @@ void RemoteBufferBenchmark::execute(poplar::Engine& engine, const poplar::Device
     std::iota(v.begin(), v.end(), 0.f);
   }
 
-  auto startTime = std::chrono::steady_clock::now();
-  for (auto i = 0u; i < bufferRepeats; i += 1) {
-    engine.copyToRemoteBuffer(hostBuffers[i].data(), "remote_buffer", i);
-  }
-  auto endTime = std::chrono::steady_clock::now();
-  auto seconds = std::chrono::duration<double>(endTime - startTime).count();
+  const auto cfg = getRuntimeConfig();
+  auto timing = ipu_utils::timeTrials([&]() {
+    for (auto i = 0u; i < bufferRepeats; i += 1) {
+      engine.copyToRemoteBuffer(hostBuffers[i].data(), "remote_buffer", i);
+    }
+  }, cfg.warmupIterations, cfg.trials);
+  auto seconds = timing.median;
 
   const auto elementBytes = getBufferElementSizeInBytes();
   const double gigaBytesTransferred = 1e-9 * elementBytes * totalBufferSize();
 
   double hostGigaBytesPerSecond = gigaBytesTransferred / seconds;
-  ipu_utils::logger()->info("Host to remote-buffer time: {}", seconds);
+  ipu_utils::logger()->info("Host to remote-buffer time: {}", timing);
   ipu_utils::logger()->info("Host to Remote-buffer bandwidth: {} GB/sec", hostGigaBytesPerSecond);
+  auto& metrics = getResults();
+  metrics.add("host_to_remote_buffer_time", timing);
+  metrics.add("host_to_remote_buffer_bandwidth", hostGigaBytesPerSecond, "GB/s");
+
+  // Compare the row by row loop with the multi-threaded loader reading from
+  // one contiguous (page aligned) table or from a memory mapped file:
+  ipu_utils::RemoteBufferFillOptions fillOptions;
+  fillOptions.threads = fillThreads;
+  fillOptions.rowsPerTask = fillRowsPerTask;
+  const auto rowBytes = elementBytes * bufferElements;
+  ipu_utils::HostBuffer<std::uint8_t> table;
+  if (fillFile.empty()) {
+    table = ipu_utils::HostBuffer<std::uint8_t>(rowBytes * bufferRepeats);
+    for (auto i = 0u; i < bufferRepeats; i += 1) {
+      std::memcpy(table.data() + i * rowBytes, hostBuffers[i].data(), rowBytes);
+    }
+  }
+  auto bulkTiming = ipu_utils::timeTrials([&]() {
+    if (fillFile.empty()) {
+      ipu_utils::fillRemoteBuffer(engine, "remote_buffer", table.data(), bufferRepeats, rowBytes, fillOptions);
+    } else {
+      ipu_utils::fillRemoteBufferFromFile(engine, "remote_buffer", fillFile, bufferRepeats, rowBytes, fillOptions);
+    }
+  }, cfg.warmupIterations, cfg.trials);
+  const double bulkGigaBytesPerSecond = gigaBytesTransferred / bulkTiming.median;
+  ipu_utils::logger()->info("Host to remote-buffer bulk fill ({} threads, source: {}) time: {}",
+                            fillThreads, fillFile.empty() ? "host memory" : fillFile, bulkTiming);
+  ipu_utils::logger()->info("Host to Remote-buffer bulk fill bandwidth: {} GB/sec ({}x row by row)",
+                            bulkGigaBytesPerSecond, bulkGigaBytesPerSecond / hostGigaBytesPerSecond);
+  metrics.add("host_to_remote_buffer_bulk_time", bulkTiming);
+  metrics.add("host_to_remote_buffer_bulk_bandwidth", bulkGigaBytesPerSecond, "GB/s");
+  metrics.add("host_to_remote_buffer_bulk_speedup", bulkGigaBytesPerSecond / hostGigaBytesPerSecond);
 
   // Initialise stuff on IPU:
   const auto& progs = getPrograms();
   progs.run(engine, "setup");
 
-  // Time transfer from remote buffer to IPU:
-  startTime = std::chrono::steady_clock::now();
-  progs.run(engine, "repeat_loop");
-  endTime = std::chrono::steady_clock::now();
+  // Time transfers between the remote buffer and IPU. Bandwidth counts the
+  // bytes transferred in each direction (only the bytes of the rows that were
+  // transferred for partial). For read-then-write the reads and writes run one
+  // after the other so it is the per-direction bandwidth of the round trip:
+  timing = ipu_utils::timeProgram(progs, engine, "repeat_loop", cfg.warmupIterations, cfg.trials);
+  double secondsPerTransfer = timing.median / iterations;
+  const auto transfer = transferDescription();
+  ipu_utils::logger()->info("{} time ({} access): {} ({} iterations per trial: {})",
+                            transfer, accessPatternName, secondsPerTransfer, iterations, timing);
 
-  seconds = std::chrono::duration<double>(endTime - startTime).count();
-  double secondsPerTransfer = seconds / iterations;
-  ipu_utils::logger()->info("Remote-buffer to IPU time: {}", secondsPerTransfer);
-
-  double gigaBytesPerSecond = gigaBytesTransferred / secondsPerTransfer;
-  ipu_utils::logger()->info("Remote-buffer to IPU bandwidth: {} GB/sec", gigaBytesPerSecond);
+  const double deviceGigaBytes = 1e-9 * elementBytes * bufferRepeats * deviceRowElements();
+  double gigaBytesPerSecond = deviceGigaBytes / secondsPerTransfer;
+  ipu_utils::logger()->info("{} bandwidth ({} access, {} byte rows, {} rows per copy): {} GB/sec",
+                            transfer, accessPatternName, elementBytes * deviceRowElements(), rowsPerCopy, gigaBytesPerSecond);
+  const auto metricPrefix = transferMetricPrefix();
+  metrics.add(metricPrefix + "_time", secondsPerTransfer, "s");
+  metrics.add(metricPrefix + "_loop_time", timing);
+  metrics.add(metricPrefix + "_bandwidth", gigaBytesPerSecond, "GB/s");
 
   // Time transfer from remote buffer to host:
-  startTime = std::chrono::steady_clock::now();
-  for (auto i = 0u; i < bufferRepeats; i += 1) {
-    engine.copyFromRemoteBuffer("remote_buffer", hostBuffers[i].data(), i);
-  }
-  endTime = std::chrono::steady_clock::now();
-  seconds = std::chrono::duration<double>(endTime - startTime).count();
+  timing = ipu_utils::timeTrials([&]() {
+    for (auto i = 0u; i < bufferRepeats; i += 1) {
+      engine.copyFromRemoteBuffer("remote_buffer", hostBuffers[i].data(), i);
+    }
+  }, cfg.warmupIterations, cfg.trials);
+  seconds = timing.median;
   hostGigaBytesPerSecond = gigaBytesTransferred / seconds;
-  ipu_utils::logger()->info("Remote-buffer to host time: {}", seconds);
+  ipu_utils::logger()->info("Remote-buffer to host time: {}", timing);
   ipu_utils::logger()->info("Remote-buffer to host bandwidth: {} GB/sec", hostGigaBytesPerSecond);
+  metrics.add("remote_buffer_to_host_time", timing);
+  metrics.add("remote_buffer_to_host_bandwidth", hostGigaBytesPerSecond, "GB/s");
+}
+
+std::string RemoteBufferBenchmark::transferDescription() const {
+  switch (accessPattern) {
+    case AccessPattern::Write: return "IPU to remote-buffer";
+    case AccessPattern::ReadThenWrite: return "Remote-buffer to IPU then IPU to remote-buffer";
+    default: return "Remote-buffer to IPU";
+  }
+}
+
+std::string RemoteBufferBenchmark::transferMetricPrefix() const {
+  switch (accessPattern) {
+    case AccessPattern::Write: return "ipu_to_remote_buffer";
+    case AccessPattern::ReadThenWrite: return "remote_buffer_round_trip";
+    default: return "remote_buffer_to_ipu";
+  }
 }
 
 std::size_t RemoteBufferBenchmark::totalBufferSize() const {
@@ -136,5 +308,29 @@ void RemoteBufferBenchmark::addToolOptions(boost::program_options::options_descr
   ("data-type", po::value<std::string>(&bufferType)->default_value("float"),
    "Element type. 'float' or 'half'."
   )
+  ("fill-threads", po::value<std::size_t>(&fillThreads)->default_value(1),
+   "Number of host threads used by the bulk remote-buffer fill (which is compared against a simple loop). The threads prepare rows in parallel but the copies to the device are serialised."
+  )
+  ("fill-rows-per-task", po::value<std::size_t>(&fillRowsPerTask)->default_value(0),
+   "Number of contiguous rows each bulk fill thread copies before taking more work (0 divides the rows evenly)."
+  )
+  ("fill-file", po::value<std::string>(&fillFile)->default_value(""),
+   "If set the bulk fill reads the rows directly from this file (which is memory mapped) instead of host memory."
+  )
+  ("access-pattern", po::value<std::string>(&accessPatternName)->default_value("sequential"),
+   "Rows the IPU transfers from the remote buffer: 'sequential', 'strided', 'random', 'partial' (part of "
+   "every row), 'write' (IPU to remote buffer) or 'read-then-write' (each copy of rows from the remote buffer "
+   "is followed by a copy of the same rows to a second remote buffer: the bandwidth is per direction)."
+  )
+  ("stride", po::value<std::size_t>(&stride)->default_value(17),
+   "Row stride of the strided access pattern (rows are visited modulo the number of rows, which must be "
+   "coprime with the stride)."
+  )
+  ("rows-per-copy", po::value<std::size_t>(&rowsPerCopy)->default_value(0),
+   "Number of rows transferred by each copy program (0 transfers every row in one copy). Must divide repeats."
+  )
+  ("partial-elements", po::value<std::size_t>(&partialElements)->default_value(0),
+   "Number of elements of each row transferred by the partial access pattern (0 means half a row)."
+  )
   ;
 }
@@ -20,9 +20,25 @@ struct RemoteBufferBenchmark :
 
   // Tool interface:
   void addToolOptions(boost::program_options::options_description& desc) override;
-  void init(const boost::program_options::variables_map& args) override {}
+  void init(const boost::program_options::variables_map& args) override;
 
 private:
+  /// Order in which the IPU transfers rows to/from the remote buffer.
+  enum class AccessPattern {
+    Sequential,   // Every row in order.
+    Strided,      // Every row, visiting rows stride apart modulo the number of rows (the stride and
+                  // number of rows must be coprime).
+    Random,       // Uniformly random rows (with replacement).
+    Partial,      // The first partial-elements of every row.
+    Write,        // Every row in order, from the IPU to the remote buffer.
+    ReadThenWrite // Every row in order: each copy reads its rows then writes them to a second buffer.
+  };
+
+  std::string transferDescription() const;
+  std::string transferMetricPrefix() const; // Names the device transfer results by direction.
+
+  std::vector<unsigned> rowIndices() const;
+  std::size_t deviceRowElements() const;
   std::size_t totalBufferSize() const;
   poplar::Type getBufferType() const;
   std::size_t getBufferElementSizeInBytes() const;
@@ -40,5 +56,13 @@ private:
   std::size_t bufferRepeats;
   std::size_t bufferElements;
   std::size_t iterations;
+  std::size_t fillThreads;
+  std::size_t fillRowsPerTask;
+  std::string fillFile;
   bool rearrangeOnHost;
+  std::string accessPatternName;
+  AccessPattern accessPattern;
+  std::size_t stride;
+  std::size_t rowsPerCopy;
+  std::size_t partialElements;
 };
@@ -1,19 +1,145 @@
 // Copyright (c) 2022 Graphcore Ltd. All rights reserved.
 
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <limits>
 #include <chrono>
 
 #include "SoftwareCacheBenchmark.hpp"
 
+#include <remote_buffer_loader.hpp>
+#include <streams/ring_buffer.hpp>
+
+#include <popops/ElementWise.hpp>
 #include <poprand/codelets.hpp>
 #include <poprand/RandomGen.hpp>
 
+namespace {
+
+// Number of batches of indices the host producer threads can work ahead of the IPU:
+constexpr std::size_t indexBufferSlots = 16;
+
+// Build a program that writes a fresh set of indices in [0, range) to the
+// given tensor every time it runs:
+poplar::program::Sequence buildIndexGenerator(poplar::Graph& graph, poplar::Tensor indices,
+                                              std::size_t range, access_patterns::Pattern pattern,
+                                              unsigned seedModifier, const std::string& name) {
+  using namespace poplar::program;
+  namespace pe = popops::expr;
+  Sequence prog;
+  indices = indices.flatten();
+
+  if (pattern == access_patterns::Pattern::Uniform) {
+    // For integer types the range poprand samples from includes the max value:
+    auto random = poprand::uniform(graph, nullptr, seedModifier, indices, poplar::INT,
+                                   0, range - 1, prog, name + "/uniform");
+    prog.add(Copy(popops::cast(graph, random, poplar::UNSIGNED_INT, prog, name + "/cast"), indices));
+  } else if (pattern == access_patterns::Pattern::Sequential) {
+    const auto count = indices.numElements();
+    std::vector<unsigned> steps(count);
+    std::iota(steps.begin(), steps.end(), 0u);
+    auto iota = graph.addConstant<unsigned>(poplar::UNSIGNED_INT, {count}, steps, name + "/iota");
+    graph.setTileMapping(iota, graph.getTileMapping(indices));
+    auto position = graph.addVariable(poplar::UNSIGNED_INT, {1}, name + "/scan_position");
+    graph.setTileMapping(position, 0);
+    graph.setInitialValue(position, 0u);
+    auto next = popops::map(graph, pe::Rem(pe::Add(pe::_1, pe::_2), pe::Const(unsigned(range))),
+                            {iota, position.broadcast(count, 0)}, prog, name + "/scan");
+    prog.add(Copy(next, indices));
+    popops::mapInPlace(graph, pe::Rem(pe::Add(pe::_1, pe::Const(unsigned(count))), pe::Const(unsigned(range))),
+                       {position}, prog, name + "/advance_scan");
+  } else {
+    throw std::runtime_error("Only uniform and sequential access patterns can be generated on the IPU.");
+  }
+
+  return prog;
+}
+
+poplar::Type parseLineType(const std::string& name) {
+  if (name == "int") { return poplar::INT; }
+  if (name == "float") { return poplar::FLOAT; }
+  if (name == "half") { return poplar::HALF; }
+  if (name == "int8") { return poplar::SIGNED_CHAR; }
+  throw std::runtime_error("Unsupported cache line type: '" + name + "' (choose int, float, half or int8).");
+}
+
+// Write count copies of value to dst in the given element type. Quantised
+// (SIGNED_CHAR) lines are written as the maximum quantised value so that the
+// line's scale must be value / 127:
+void encodeLine(poplar::Type type, const poplar::Target& target,
+                float value, std::size_t count, void* dst) {
+  if (type == poplar::INT) {
+    std::fill_n(static_cast<std::int32_t*>(dst), count, std::int32_t(value));
+  } else if (type == poplar::FLOAT) {
+    std::fill_n(static_cast<float*>(dst), count, value);
+  } else if (type == poplar::HALF) {
+    thread_local std::vector<float> line;
+    line.assign(count, value);
+    poplar::copyFloatToDeviceHalf(target, line.data(), dst, count);
+  } else if (type == poplar::SIGNED_CHAR) {
+    std::fill_n(static_cast<std::int8_t*>(dst), count, value == 0.f ? 0 : 127);
+  } else {
+    throw std::logic_error("Unsupported cache line type.");
+  }
+}
+
+// Convert cache lines read back from the device to float:
+std::vector<float> decodeLines(poplar::Type type, const poplar::Target& target,
+                               const std::vector<std::uint8_t>& bytes) {
+  std::vector<float> values(bytes.size() / target.getTypeSize(type));
+  if (type == poplar::INT) {
+    auto src = reinterpret_cast<const std::int32_t*>(bytes.data());
+    std::copy(src, src + values.size(), values.begin());
+  } else if (type == poplar::FLOAT) {
+    std::memcpy(values.data(), bytes.data(), bytes.size());
+  } else if (type == poplar::HALF) {
+    poplar::copyDeviceHalfToFloat(target, bytes.data(), values.data(), values.size());
+  } else {
+    throw std::logic_error("Unsupported cache line type.");
+  }
+  return values;
+}
+
+// Log and record how well a host index producer kept up with the IPU:
+void reportProducer(const std::string& name, const streams::RingBufferCallback<std::uint32_t>* callback,
+                    ipu_utils::ResultsRecorder& metrics) {
+  if (callback == nullptr) {
+    return;
+  }
+  const auto stats = callback->getStats();
+  ipu_utils::logger()->info("Index producer '{}': {} fetches, {} waited for the producer ({} prefetches found no data ready)",
+                            name, stats.fetchCalls, stats.fetchWaits, stats.prefetchMisses);
+  metrics.add(name + "_producer_waits", stats.fetchWaits);
+}
+
+} // end anonymous namespace
+
 void SoftwareCacheBenchmark::init(const boost::program_options::variables_map& args) {
+  codeletPath = args["codelet-path"].as<std::string>();
+  dataType = parseLineType(dataTypeName);
+  storageType = storageTypeName.empty() ? dataType : parseLineType(storageTypeName);
+  if (dataType == poplar::SIGNED_CHAR) {
+    throw std::runtime_error("int8 is only supported as a storage-type.");
+  }
+  if (storageType == poplar::SIGNED_CHAR && !fillFile.empty()) {
+    throw std::runtime_error("An int8 remote buffer can not be filled from a file (it has no line scales).");
+  }
+  if (requestCount == 0) {
+    requestCount = fetchCount;
+  }
+  accessPattern = access_patterns::parsePattern(accessPatternName);
+  if (accessPattern == access_patterns::Pattern::Trace && traceFile.empty()) {
+    throw std::runtime_error("The trace access pattern needs a trace-file.");
+  }
+  if (generateOnIpu && accessPattern != access_patterns::Pattern::Uniform &&
+      accessPattern != access_patterns::Pattern::Sequential) {
+    throw std::runtime_error("Only uniform and sequential access patterns can be generated on the IPU.");
+  }
   cache.reset(
     new SoftwareCache(
-      "on_chip_cache", poplar::INT,
+      "on_chip_cache", dataType, storageType,
       cacheableSetSize, residentSetSize, lineSize, fetchCount)
   );
 }
@@ -26,12 +152,42 @@ void SoftwareCacheBenchmark::build(poplar::Graph& graph, const poplar::Target&)
   // Build the graph for the cache:
   bool optimiseMemoryUse = !optimiseCycles;
   ipu_utils::logger()->info("Optimise memory use: {}", optimiseMemoryUse);
-  cache->build(graph, optimiseMemoryUse);
+  cache->build(graph, optimiseMemoryUse, fetchChunkSize, fetchIOTiles);
+
+  // Build the directory that decides which lines to fetch on the IPU:
+  graph.addCodelets(codeletPath + "/SoftwareCache/directory.cpp");
+  const auto directoryTile = graph.getTarget().getNumTiles() - 1;
+  cache->buildDirectory(graph, requestCount, associativity, directoryTile);
+
+  // Fresh indices for every fetch and lookup either stream from the host or are generated on the IPU:
+  Sequence fetchIndexProg = cache->offsetStreamSequence;
+  Sequence requestProg = cache->requestStreamSequence;
+  if (generateOnIpu) {
+    poprand::addCodelets(graph);
+    auto seedTensor = graph.addConstant<unsigned>(
+      poplar::UNSIGNED_INT, {2}, {unsigned(seed), unsigned(seed >> 32)}, "seed");
+    graph.setTileMapping(seedTensor, 0);
+    Sequence seedProg;
+    poprand::setSeed(graph, seedTensor, 0, seedProg, "set_seed");
+    getPrograms().add("seed_rng", seedProg);
+
+    // Lines are fetched and requested with the chosen pattern but fetched lines
+    // are always scattered to uniformly random cache slots:
+    fetchIndexProg = buildIndexGenerator(graph, cache->remoteFetchOffsets, cacheableSetSize,
+                                         accessPattern, 0, "generate_fetch_offsets");
+    fetchIndexProg.add(buildIndexGenerator(graph, cache->cacheScatterOffsets, residentSetSize,
+                                           access_patterns::Pattern::Uniform, 1, "generate_scatter_offsets"));
+    requestProg = buildIndexGenerator(graph, cache->requestedLines, cacheableSetSize,
+                                      accessPattern, 2, "generate_requests");
+  }
 
   // Register programs:
   getPrograms().add("write_indices", cache->offsetStreamSequence);
   getPrograms().add("cache_fetch", cache->cacheFetchProg);
+  getPrograms().add("cache_update", Sequence{fetchIndexProg, cache->cacheFetchProg});
   getPrograms().add("copy_cache_to_host", cache->cacheReadProg);
+  getPrograms().add("cache_lookup", Sequence{requestProg, cache->cacheLookupProg});
+  getPrograms().add("read_directory", cache->directoryReadProg);
 }
 
 void SoftwareCacheBenchmark::execute(poplar::Engine& engine, const poplar::Device& device) {
@@ -41,62 +197,166 @@ void SoftwareCacheBenchmark::execute(poplar::Engine& engine, const poplar::Devic
 
   ipu_utils::logger()->info("Execution starts");
 
+  // Bytes transferred for each line (including its scale if it is quantised):
+  const auto& target = device.getTarget();
+  const auto rowBytes = lineSize * target.getTypeSize(storageType);
+  const auto lineBytes = rowBytes + (cache->quantised() ? sizeof(float) : 0);
+
+  // Value stored in every element of each row (unless loaded from a file). Values
+  // wrap so that they have an exact representation in half precision:
+  const bool usesHalf = dataType == poplar::HALF || storageType == poplar::HALF;
+  const std::size_t valueModulus = usesHalf ? 2048 : (1 << 24);
+  auto rowValue = [&](std::size_t row) { return float(row % valueModulus); };
+
   // Fill the entire remote buffer with data:
+  ipu_utils::RemoteBufferFillOptions fillOptions;
+  fillOptions.threads = fillThreads;
   auto fillStartTime = std::chrono::steady_clock::now();
-  std::vector<std::int32_t> featureVector(lineSize, 0);
-  for (std::size_t i = 0; i < cache->cacheableSetSize; ++i) {
-    std::fill(featureVector.begin(), featureVector.end(), i);
-    engine.copyToRemoteBuffer(featureVector.data(), cache->getRemoteBufferName(), i);
+  if (fillFile.empty()) {
+    ipu_utils::fillRemoteBuffer(engine, cache->getRemoteBufferName(), cacheableSetSize, rowBytes,
+      [&](std::size_t row, void* scratch) {
+        encodeLine(storageType, target, rowValue(row), lineSize, scratch);
+        return scratch;
+      }, fillOptions);
+    if (cache->quantised()) {
+      ipu_utils::fillRemoteBuffer(engine, cache->getRemoteScaleBufferName(), cacheableSetSize, sizeof(float),
+        [&](std::size_t row, void* scratch) {
+          *static_cast<float*>(scratch) = rowValue(row) / 127.f;
+          return scratch;
+        }, fillOptions);
+    }
+  } else {
+    ipu_utils::fillRemoteBufferFromFile(engine, cache->getRemoteBufferName(), fillFile,
+                                        cacheableSetSize, rowBytes, fillOptions);
   }
   auto fillEndTime = std::chrono::steady_clock::now();
   auto seconds = std::chrono::duration<double>(fillEndTime - fillStartTime).count();
-  auto gigaBytesPerSec = (1e-9 / seconds) * lineSize * cacheableSetSize * sizeof(float);
+  auto gigaBytesPerSec = (1e-9 / seconds) * lineBytes * cacheableSetSize;
   ipu_utils::logger()->info("Remote-buffer rows: {}", cacheableSetSize);
-  ipu_utils::logger()->info("Remote-buffer fill time (host to remote-buffer): {} secs rate: {} GB/sec", seconds, gigaBytesPerSec);
-
-  // Make a list of indices of the remote buffer to fetch. Gen unique
-  // random set of random indices to fetch:
-  std::vector<std::uint32_t> remoteBufferIndices(cacheableSetSize);
-  std::mt19937 g(seed);
-  std::iota(remoteBufferIndices.begin(), remoteBufferIndices.end(), 0);
-  std::shuffle(remoteBufferIndices.begin(), remoteBufferIndices.end(), g);
-  remoteBufferIndices.resize(fetchCount);
+  ipu_utils::logger()->info("Remote-buffer fill time (host to remote-buffer, {} threads): {} secs rate: {} GB/sec",
+                            fillThreads, seconds, gigaBytesPerSec);
+  auto& metrics = getResults();
+  metrics.add("remote_buffer_fill_time", seconds, "s");
+  metrics.add("remote_buffer_fill_bandwidth", gigaBytesPerSec, "GB/s");
 
-  // List of locations in the cache for the fetched lines. Again use a random
-  // permutation:
+  // List of locations in the cache for the fetched lines. Use a random
+  // permutation so that lines fetched together never overwrite each other:
   std::vector<std::uint32_t> cacheDestinationIndices(residentSetSize);
+  std::mt19937 g(seed);
   std::iota(cacheDestinationIndices.begin(), cacheDestinationIndices.end(), 0);
   std::shuffle(cacheDestinationIndices.begin(), cacheDestinationIndices.end(), g);
   cacheDestinationIndices.resize(fetchCount);
 
   // Buffer to read back the cache at end:
-  std::vector<std::int32_t> cacheContents(residentSetSize * lineSize);
+  std::vector<std::uint8_t> cacheContents(residentSetSize * lineSize * target.getTypeSize(dataType));
+
+  // Indices of the remote buffer lines to fetch: these are only used by the
+  // write_indices program when the indices are generated on the IPU.
+  std::vector<std::uint32_t> remoteBufferIndices(fetchCount, 0);
 
-  // Connect the streams to the buffers we just created:
-  cache->connectStreams(engine, remoteBufferIndices, cacheDestinationIndices, cacheContents);
+  // Requests for the directory (also receives the last batch requested when the directory is read back):
+  std::vector<std::uint32_t> requests(requestCount);
+  std::vector<std::uint32_t> requestSlots(requestCount);
+  std::vector<std::uint32_t> directoryCounts(3, 0);
 
-  // Set cache indices form the host:
-  // TODO: generate random cache fetch indices on IPU.
+  // Unless the indices are generated on the IPU, producer threads generate
+  // a fresh batch of indices for every fetch and lookup. The callbacks are
+  // owned by the engine so keep pointers to read their stats:
   const auto& progs = getPrograms();
-  progs.run(engine, "write_indices");
+  streams::RingBufferCallback<std::uint32_t>* fetchProducer = nullptr;
+  streams::RingBufferCallback<std::uint32_t>* requestProducer = nullptr;
+  if (generateOnIpu) {
+    ipu_utils::logger()->info("Generating {} indices on the IPU", accessPatternName);
+    cache->connectStreams(engine, remoteBufferIndices, cacheDestinationIndices, cacheContents);
+    cache->connectDirectoryStreams(engine, requests, requestSlots, directoryCounts);
+    progs.run(engine, "seed_rng");
+  } else {
+    ipu_utils::logger()->info("Generating {} indices on the host", accessPatternName);
+    auto makeProducer = [&](std::size_t count, std::uint64_t producerSeed) {
+      auto generator = std::make_shared<access_patterns::Generator>(
+        accessPattern, cacheableSetSize, producerSeed, zipfSkew, traceFile);
+      return std::make_unique<streams::RingBufferCallback<std::uint32_t>>(
+        indexBufferSlots, count,
+        [generator](std::uint32_t* slot, std::size_t size, std::size_t) { generator->fill(slot, size); });
+    };
+    auto fetchCallback = makeProducer(fetchCount, seed);
+    fetchProducer = fetchCallback.get();
+    cache->connectStreams(engine, std::move(fetchCallback), cacheDestinationIndices, cacheContents);
+    auto requestCallback = makeProducer(requestCount, seed + 1);
+    requestProducer = requestCallback.get();
+    cache->connectDirectoryStreams(engine, std::move(requestCallback), requests, requestSlots, directoryCounts);
+  }
 
-  // Repeatedly fetch data into the cache:
+  // Repeatedly fetch fresh data into the cache:
   ipu_utils::logger()->info("Running {} iterations of cache fetches", iterations);
-  auto cacheFetchStartTime = std::chrono::steady_clock::now();
-  for (auto i = 0u; i < iterations; ++i) {
-    progs.run(engine, "cache_fetch");
-  }
-  auto cacheFetchEndTime = std::chrono::steady_clock::now();
-  seconds = std::chrono::duration<double>(cacheFetchEndTime - cacheFetchStartTime).count();
-  gigaBytesPerSec = (1e-9 / seconds) * lineSize * fetchCount * iterations * sizeof(float);
+  const auto cfg = getRuntimeConfig();
+  const auto timing = ipu_utils::timeTrials([&]() {
+    for (auto i = 0u; i < iterations; ++i) {
+      progs.run(engine, "cache_update");
+    }
+  }, cfg.warmupIterations, cfg.trials);
+  seconds = timing.median;
+  gigaBytesPerSec = (1e-9 / seconds) * lineBytes * fetchCount * iterations;
   ipu_utils::logger()->info("Cache fetch time (remote-buffer to IPU): {} secs rate: {} GB/sec", seconds, gigaBytesPerSec);
+  metrics.add("cache_fetch_time", timing);
+  metrics.add("cache_fetch_bandwidth", gigaBytesPerSec, "GB/s");
+  reportProducer("fetch_index", fetchProducer, metrics);
 
-  if (cacheContents.size() < 100) {
+  if (residentSetSize * lineSize < 100) {
     progs.run(engine, "copy_cache_to_host");
-    ipu_utils::logger()->info("Cache state:\n{}", cacheContents);
+    ipu_utils::logger()->info("Cache state:\n{}", decodeLines(dataType, target, cacheContents));
   } else {
-    ipu_utils::logger()->info("Supressed output: too large ({} elements).", cacheContents.size());
+    ipu_utils::logger()->info("Supressed output: too large ({} elements).", residentSetSize * lineSize);
+  }
+
+  // Now let the on chip directory decide what to fetch for a fresh batch of requests on every lookup:
+  ipu_utils::logger()->info("Running {} iterations of directory lookups ({} requests, {}-way)",
+                            iterations, requestCount, associativity);
+  const auto lookupTiming = ipu_utils::timeTrials([&]() {
+    for (auto i = 0u; i < iterations; ++i) {
+      progs.run(engine, "cache_lookup");
+    }
+  }, cfg.warmupIterations, cfg.trials);
+  reportProducer("request", requestProducer, metrics);
+
+  // Check that every serviced request from the final batch found its line in the slot
+  // the directory reported (remote row i is filled with the value i unless it was loaded
+  // from a file):
+  progs.run(engine, "read_directory");
+  progs.run(engine, "copy_cache_to_host");
+  // Lines that were compressed are allowed a small relative error:
+  const auto cacheValues = decodeLines(dataType, target, cacheContents);
+  const float relativeTolerance = cache->compressed() ? 2e-3f : 0.f;
+  std::size_t errors = 0;
+  for (auto r = 0u; r < requestCount && fillFile.empty(); ++r) {
+    const auto slot = requestSlots[r];
+    if (slot == SoftwareCache::invalidEntry) {
+      continue;
+    }
+    const auto expected = rowValue(requests[r]);
+    if (std::abs(cacheValues[slot * lineSize] - expected) > relativeTolerance * expected) {
+      errors += 1;
+    }
+  }
+  if (errors) {
+    ipu_utils::logger()->error("Cache directory error: {} requests were not found in their reported slot.", errors);
   }
+
+  const double hits = directoryCounts[0];
+  const double misses = directoryCounts[1];
+  const double dropped = directoryCounts[2];
+  const double lookups = hits + misses;
+  const double hitRate = lookups > 0 ? hits / lookups : 0.0;
+  const double dropRate = lookups > 0 ? dropped / lookups : 0.0;
+  const double servicedMissesPerLookup = lookups > 0 ? (misses - dropped) / lookups * requestCount : 0.0;
+  gigaBytesPerSec = (1e-9 / lookupTiming.median) * lineBytes * servicedMissesPerLookup * iterations;
+  ipu_utils::logger()->info("Cache lookup time: {} secs hit rate: {} drop rate: {} miss fetch rate: {} GB/sec",
+                            lookupTiming.median, hitRate, dropRate, gigaBytesPerSec);
+  metrics.add("cache_lookup_time", lookupTiming);
+  metrics.add("cache_hit_rate", hitRate);
+  metrics.add("cache_drop_rate", dropRate);
+  metrics.add("cache_miss_bandwidth", gigaBytesPerSec, "GB/s");
+  metrics.add("cache_directory_errors", errors);
 }
 
 void SoftwareCacheBenchmark::addToolOptions(boost::program_options::options_description& desc) {
@@ -111,15 +371,59 @@ void SoftwareCacheBenchmark::addToolOptions(boost::program_options::options_desc
   ("line-size", po::value<std::size_t>(&lineSize)->default_value(1024),
    "Number of elements in a cache line."
   )
+  ("data-type", po::value<std::string>(&dataTypeName)->default_value("int"),
+   "Element type of lines in the on chip cache: 'int', 'float' or 'half'."
+  )
+  ("storage-type", po::value<std::string>(&storageTypeName)->default_value(""),
+   "Element type of lines stored in the remote buffer (default: same as data-type). Lines are decompressed "
+   "on fetch: 'half' halves the remote buffer size and fetch bandwidth for float caches and 'int8' stores "
+   "8-bit values with a float scale per line. A half data-type also doubles the lines that fit on chip."
+  )
   ("fetch-count", po::value<std::size_t>(&fetchCount)->required(),
    "Number of lines to fetch from remote buffer in a single cache update."
   )
+  ("fetch-chunk-size", po::value<std::size_t>(&fetchChunkSize)->default_value(0),
+   "Number of lines transferred by each remote buffer copy (0 means fetch-count). Larger fetches are "
+   "split into chunks (this bounds the exchange code and fetch buffer memory): fetch-count must be a "
+   "multiple of this."
+  )
+  ("fetch-io-tiles", po::value<unsigned>(&fetchIOTiles)->default_value(0),
+   "Number of tiles reserved for reading chunks from the remote buffer. If zero the chunks are fetched one "
+   "after the other. Otherwise the chunk reads are double buffered on the IO tiles so they overlap the "
+   "scatter of the previous chunk into the cache (at least the minimum number of IO tiles is used)."
+  )
+  ("fill-threads", po::value<std::size_t>(&fillThreads)->default_value(1),
+   "Number of host threads used to fill the remote buffer. The threads prepare rows in parallel but the copies to the device are serialised."
+  )
+  ("fill-file", po::value<std::string>(&fillFile)->default_value(""),
+   "If set fill the remote buffer directly from this file (memory mapped) which must hold remote-buffer-size "
+   "rows of line-size elements of the storage-type. Otherwise every element of row i is set to i."
+  )
   ("iterations", po::value<std::size_t>(&iterations)->default_value(1000),
    "Number of pull-to-cache iterations."
   )
   ("seed", po::value<std::size_t>(&seed)->default_value(10142),
    "Seed used to generate random indices."
   )
+  ("request-count", po::value<std::size_t>(&requestCount)->default_value(0),
+   "Number of lines requested in each directory lookup (0 means the same as fetch-count)."
+  )
+  ("associativity", po::value<std::size_t>(&associativity)->default_value(8),
+   "Number of ways in each set of the on chip cache directory (resident-set-size must be a multiple of this)."
+  )
+  ("access-pattern", po::value<std::string>(&accessPatternName)->default_value("uniform"),
+   "Distribution of the lines fetched and requested: 'uniform', 'zipf', 'sequential' or 'trace'. "
+   "A fresh batch of indices is generated for every iteration."
+  )
+  ("zipf-skew", po::value<double>(&zipfSkew)->default_value(1.0),
+   "Exponent of the Zipf distribution (larger values concentrate accesses on fewer lines)."
+  )
+  ("trace-file", po::value<std::string>(&traceFile)->default_value(""),
+   "Text file of whitespace separated line indices to replay (in a loop) for the trace access pattern."
+  )
+  ("generate-on-ipu", po::bool_switch(&generateOnIpu)->default_value(false),
+   "Generate the indices on the IPU instead of streaming them from host threads (uniform and sequential patterns only)."
+  )
   ("optimise-cycles", po::bool_switch(&optimiseCycles)->default_value(false))
   ;
 }
@@ -6,15 +6,29 @@
 #include "io_utils.hpp"
 #include "tool_registry.hpp"
 
+#include <memory/access_patterns.hpp>
 #include <memory/gather.hpp>
 #include <memory/scatter.hpp>
+#include <pipeline/pipeline.hpp>
 
 #include <memory>
+#include <numeric>
+
+#include <gcl/TileAllocation.hpp>
+#include <poplar/StreamCallback.hpp>
+#include <popops/Cast.hpp>
+#include <popops/ElementWise.hpp>
 
 #include <boost/program_options.hpp>
 
 /// A cache provides a local table of variables that can be filled from
 /// a larger table of variables stored in a remote buffer (i.e. DRAM).
+///
+/// Lines can be stored in the remote buffer in a compressed form which
+/// is decompressed to the cache's element type on fetch. Supported storage
+/// types are HALF (for FLOAT caches) and SIGNED_CHAR: an 8-bit quantised form
+/// where each line also has a FLOAT scale (stored in a second remote buffer)
+/// and element j of line i decompresses to lines[i][j] * scales[i].
 struct SoftwareCache {
   SoftwareCache(std::string cacheName,
                 poplar::Type type,            // Element type of cache lines.
@@ -22,88 +36,409 @@ struct SoftwareCache {
                 std::size_t maxCached,        // Number of cache lines held on chip.
                 std::size_t lineSize,         // Number of elements in each cache line.
                 std::size_t remoteFetchCount) // Number of lines fetched in each cache update.
+  : SoftwareCache(cacheName, type, type, numLinesOffChip, maxCached, lineSize, remoteFetchCount)
+  {}
+
+  SoftwareCache(std::string cacheName,
+                poplar::Type type,            // Element type of cache lines.
+                poplar::Type remoteType,      // Element type of lines stored in the remote buffer.
+                std::size_t numLinesOffChip,  // Total number of cacheable lines in remote buffer.
+                std::size_t maxCached,        // Number of cache lines held on chip.
+                std::size_t lineSize,         // Number of elements in each cache line.
+                std::size_t remoteFetchCount) // Number of lines fetched in each cache update.
   :
     name(cacheName),
     dataType(type),
+    storageType(remoteType),
     cacheableSetSize(numLinesOffChip),
     totalCacheLines(maxCached),
     cacheLineSize(lineSize),
     fetchCount(remoteFetchCount),
     residentSet(cacheName + "/resident_set"),
     remoteFetchOffsets(cacheName + "/fetch_offsets"),
-    cacheScatterOffsets(cacheName + "/scatter_offsets")
+    cacheScatterOffsets(cacheName + "/scatter_offsets"),
+    requestedLines(cacheName + "/requests"),
+    requestSlots(cacheName + "/request_slots"),
+    directoryCounts(cacheName + "/directory_counts")
   {}
 
+  /// Value used in the directory to mark empty slots and unserviced requests.
+  static constexpr std::uint32_t invalidEntry = 0xffffffff;
+
   std::string getRemoteBufferName() const { return name + "/remote_feature_buffer"; }
+  std::string getRemoteScaleBufferName() const { return name + "/remote_scale_buffer"; }
+
+  /// True if lines are decompressed on fetch.
+  bool compressed() const { return storageType != dataType; }
+
+  /// True if lines are stored as 8-bit integers with a scale per line.
+  bool quantised() const { return storageType == poplar::SIGNED_CHAR; }
 
-  void build(poplar::Graph& graph, bool optimiseCopyMemoryUse = true) {
+  /// Build the cache. The fetch of fetchCount lines is split into chunks of
+  /// chunkSize lines (0 means a single chunk), so the amount of exchange code
+  /// (and fetch buffer memory) depends on the chunk size but not on the total
+  /// number of lines fetched.
+  ///
+  /// If ioTileCount is zero the chunks are read and scattered into the cache one
+  /// after the other by a single loop body. Otherwise (and if there is more than
+  /// one chunk) that many tiles are reserved for IO and the fetch is software
+  /// pipelined in the same way as OverlappedIO: the remote buffer read of each
+  /// chunk into a (double buffered) fetch buffer on the IO tiles overlaps the
+  /// scatter of the previous chunk on the compute tiles, which hold the cache.
+  void build(poplar::Graph& graph, bool optimiseCopyMemoryUse = true, std::size_t chunkSize = 0,
+             unsigned ioTileCount = 0) {
     using namespace poplar::program;
 
     ipu_utils::logger()->info("Cache '{}': Building cache of {} lines of size {}.", name, totalCacheLines, cacheLineSize);
 
+    fetchChunkSize = chunkSize == 0 ? fetchCount : chunkSize;
+    if (fetchCount % fetchChunkSize != 0) {
+      throw std::runtime_error("Fetch count must be a multiple of the fetch chunk size.");
+    }
+    const auto numChunks = fetchCount / fetchChunkSize;
+    if (compressed() && dataType != poplar::FLOAT && dataType != poplar::HALF) {
+      throw std::runtime_error("Compressed cache lines can only be decompressed to FLOAT or HALF.");
+    }
+    if (compressed() && !quantised() && storageType != poplar::HALF) {
+      throw std::runtime_error("Cache lines can only be compressed to HALF or SIGNED_CHAR.");
+    }
+
+    // Reads and scatters can only overlap if they run on disjoint sets of tiles:
+    const bool pipelined = numChunks > 1 && ioTileCount > 0;
+    const auto totalTiles = graph.getTarget().getNumTiles();
+    const auto numIOTiles = pipelined ? std::max(gcl::getMinIoTiles(graph), ioTileCount) : 0u;
+    std::vector<unsigned> computeTiles(totalTiles);
+    std::iota(computeTiles.begin(), computeTiles.end(), 0u);
+    std::vector<unsigned> ioTiles = computeTiles;
+    if (pipelined) {
+      ioTiles = gcl::perIPUTiles(graph, 0, numIOTiles);
+      computeTiles = gcl::perIPUTiles(graph, numIOTiles, totalTiles - numIOTiles);
+      ipu_utils::logger()->info("Cache '{}': Fetching through {} IO tiles.", name, numIOTiles);
+    }
+    auto computeGraph = graph.createVirtualGraph(computeTiles);
+    auto ioGraph = graph.createVirtualGraph(ioTiles);
+
     // Create remote buffer for the feature store:
     ipu_utils::logger()->info("Cache '{}': Building remote buffer with {} rows/lines", name, cacheableSetSize);
-    remoteFeatures = graph.addRemoteBuffer(getRemoteBufferName(), dataType, cacheLineSize, cacheableSetSize);
+    remoteFeatures = graph.addRemoteBuffer(getRemoteBufferName(), storageType, cacheLineSize, cacheableSetSize);
+    if (quantised()) {
+      remoteScales = graph.addRemoteBuffer(getRemoteScaleBufferName(), poplar::FLOAT, 1, cacheableSetSize);
+    }
 
-    // Create variables needed for the cache:
-    residentSet = popops::createSliceableTensor(graph, dataType, {totalCacheLines, cacheLineSize}, {0}, {1}, {}, {}, name + "/resident_set");
+    // Create variables needed for the cache (on the compute tiles):
+    residentSet = popops::createSliceableTensor(computeGraph, dataType, {totalCacheLines, cacheLineSize}, {0}, {1}, {}, {}, name + "/resident_set");
     cacheReadProg.add(residentSet.buildRead(graph, optimiseCopyMemoryUse));
 
-    remoteFetchOffsets = graph.addVariable(poplar::UNSIGNED_INT, {fetchCount}, poplar::VariableMappingMethod::LINEAR);
+    remoteFetchOffsets = ioGraph.addVariable(poplar::UNSIGNED_INT, {fetchCount}, poplar::VariableMappingMethod::LINEAR);
     offsetStreamSequence.add(remoteFetchOffsets.buildWrite(graph, optimiseCopyMemoryUse));
 
-    scatter::MultiUpdate scatterToCache(name + "/scatter_to_cache", residentSet, fetchCount, false);
-    scatterToCache.plan(graph);
+    scatter::MultiUpdate scatterToCache(name + "/scatter_to_cache", residentSet, fetchChunkSize, false);
+    scatterToCache.plan(computeGraph);
 
-    // Create a temporary tensor for holding the IPU side cache.
-    auto fetchBuffer = scatterToCache.createSource(graph);
-    cacheScatterOffsets = scatterToCache.createIndices(graph);
+    if (numChunks == 1) {
+      cacheScatterOffsets = scatterToCache.createIndices(computeGraph);
+    } else {
+      cacheScatterOffsets = computeGraph.addVariable(poplar::UNSIGNED_INT, {fetchCount}, poplar::VariableMappingMethod::LINEAR);
+    }
     offsetStreamSequence.add(cacheScatterOffsets.buildWrite(graph, optimiseCopyMemoryUse));
 
-    const std::vector<std::size_t> fetchShape = {fetchCount, cacheLineSize};
+    // Each buffer slot has a chunk sized fetch buffer and scatter indices. Compressed lines
+    // are fetched into a buffer of the storage type (laid out like the fetch buffer) and
+    // quantised lines also need a buffer for their scales. When pipelined the remote buffer
+    // is read into buffers of the same shapes on the IO tiles:
+    const std::size_t numSlots = pipelined ? 2 : 1;
+    const std::vector<std::size_t> chunkShape = {fetchChunkSize, cacheLineSize};
+    struct FetchSlot {
+      poplar::Tensor lines;         // Lines to scatter (of the cache's type).
+      poplar::Tensor compressed;    // Lines of the storage type (if compressed).
+      poplar::Tensor scales;        // Line scales (if quantised).
+      poplar::Tensor indices;       // Scatter indices.
+      poplar::Tensor ioLines;       // Remote buffer read destinations on the IO tiles (if pipelined).
+      poplar::Tensor ioScales;
+    };
+    std::vector<FetchSlot> slots(numSlots);
+    for (auto& slot : slots) {
+      slot.lines = scatterToCache.createSource(computeGraph);
+      slot.indices = numChunks == 1 ? cacheScatterOffsets.get() : scatterToCache.createIndices(computeGraph);
+      if (compressed()) {
+        slot.compressed = computeGraph.clone(storageType, slot.lines, name + "/compressed_fetch_buffer");
+      }
+      if (quantised()) {
+        slot.scales = computeGraph.addVariable(poplar::FLOAT, {fetchChunkSize, 1}, poplar::VariableMappingMethod::LINEAR,
+                                               name + "/scale_fetch_buffer");
+      }
+      if (pipelined) {
+        slot.ioLines = ioGraph.addVariable(storageType, chunkShape, poplar::VariableMappingMethod::LINEAR,
+                                           name + "/io_fetch_buffer");
+        if (quantised()) {
+          slot.ioScales = ioGraph.addVariable(poplar::FLOAT, {fetchChunkSize, 1}, poplar::VariableMappingMethod::LINEAR,
+                                              name + "/io_scale_fetch_buffer");
+        }
+      }
+    }
+
+    // With more than one chunk the reads and scatters each keep a count of chunks
+    // processed (on their own tiles) and use it to dynamically slice their offsets:
+    auto readChunk = ioGraph.addVariable(poplar::UNSIGNED_INT, {1}, name + "/read_chunk");
+    auto scatterChunk = computeGraph.addVariable(poplar::UNSIGNED_INT, {1}, name + "/scatter_chunk");
+    ioGraph.setTileMapping(readChunk, 0);
+    computeGraph.setTileMapping(scatterChunk, 0);
+    auto sliceChunk = [&](poplar::Graph& g, poplar::Tensor offsets, poplar::Tensor counter,
+                          Sequence& prog, const std::string& debugName) {
+      if (numChunks == 1) {
+        return offsets;
+      }
+      auto chunkOffsets = popops::dynamicSlice(g, offsets.reshape({numChunks, fetchChunkSize}),
+                                               counter, {0}, {1}, prog, debugName);
+      popops::addInPlace(g, counter, 1u, prog, debugName + "/next_chunk");
+      return chunkOffsets.flatten();
+    };
+
+    ipu_utils::logger()->info("Cache '{}': Building cache fetch program (fetches {} lines in {} chunks of {} lines)",
+                              name, fetchCount, numChunks, fetchChunkSize);
+
+    // Read a chunk from the remote buffer (into the IO tiles' buffer if pipelined):
+    auto readChunkProg = [&](FetchSlot& slot) {
+      Sequence prog;
+      auto offsets = sliceChunk(ioGraph, remoteFetchOffsets.get(), readChunk, prog, name + "/slice_fetch_offsets");
+      auto destination = pipelined ? slot.ioLines : compressed() ? slot.compressed : slot.lines;
+      prog.add(Copy(remoteFeatures, destination.reshape(chunkShape), offsets, name + "/copy_host_features_to_cache"));
+      if (quantised()) {
+        prog.add(Copy(remoteScales, pipelined ? slot.ioScales : slot.scales, offsets, name + "/copy_host_scales_to_cache"));
+      }
+      return prog;
+    };
+
+    // Exchange a chunk from the IO tiles to the compute tiles:
+    auto transferChunkProg = [&](FetchSlot& slot) {
+      const bool doNotOutline = true;
+      Sequence prog;
+      auto destination = compressed() ? slot.compressed : slot.lines;
+      prog.add(Copy(slot.ioLines.flatten(), destination.flatten(), doNotOutline));
+      if (quantised()) {
+        prog.add(Copy(slot.ioScales, slot.scales, doNotOutline));
+      }
+      return prog;
+    };
+
+    // Scatter a chunk from the fetch buffer into the cache:
+    auto scatterChunkProg = [&](FetchSlot& slot) {
+      Sequence prog;
+      auto offsets = sliceChunk(computeGraph, cacheScatterOffsets.get(), scatterChunk, prog, name + "/slice_scatter_offsets");
+      if (numChunks != 1) {
+        prog.add(Copy(offsets, slot.indices.flatten()));
+      }
+      if (quantised()) {
+        namespace pe = popops::expr;
+        popops::mapWithOutput(computeGraph, pe::Mul(pe::Cast(pe::_1, dataType), pe::Cast(pe::_2, dataType)),
+                              {slot.compressed.reshape(chunkShape), slot.scales.broadcast(cacheLineSize, 1)},
+                              slot.lines.reshape(chunkShape), prog, name + "/dequantise");
+      } else if (compressed()) {
+        prog.add(popops::cast(computeGraph, slot.compressed, slot.lines, name + "/decompress"));
+      }
+      scatterToCache.createProgram(computeGraph, slot.lines, slot.indices, prog);
+      return prog;
+    };
 
-    // The fetch program will read fromt the remote buffer into the
-    // fetch buffer and then scatter from the fetch buffer into the cache:
-    ipu_utils::logger()->info("Cache '{}': Building cache fetch program (fetches {} lines)", name, fetchCount);
     cacheFetchProg = Sequence();
-    cacheFetchProg.add(Copy(remoteFeatures, fetchBuffer.reshape(fetchShape), remoteFetchOffsets, name + "/copy_host_features_to_cache"));
+    if (numChunks != 1) {
+      auto zero = graph.addConstant(poplar::UNSIGNED_INT, {1}, 0u, name + "/zero");
+      graph.setTileMapping(zero, 0);
+      cacheFetchProg.add(Copy(zero, readChunk));
+      cacheFetchProg.add(Copy(zero, scatterChunk));
+    }
+    if (pipelined) {
+      // Phase 0 stages (reads on the IO tiles and scatters on the compute tiles)
+      // overlap. The phase 1 stage exchanges between the two sets of tiles:
+      pipeline::PipelineBuilder fetchPipeline(numSlots);
+      fetchPipeline.addStage("remote_read", 0, [&](std::size_t s) { return readChunkProg(slots[s]); });
+      fetchPipeline.addStage("io_to_compute", 1, [&](std::size_t s) { return transferChunkProg(slots[s]); });
+      fetchPipeline.addStage("scatter", 0, [&](std::size_t s) { return scatterChunkProg(slots[s]); });
+      ipu_utils::logger()->debug("Cache '{}': Fetch schedule:\n{}", name, fetchPipeline.describe(numChunks));
+      cacheFetchProg.add(fetchPipeline.build(numChunks));
+    } else {
+      Sequence fetchChunk;
+      fetchChunk.add(readChunkProg(slots.front()));
+      fetchChunk.add(scatterChunkProg(slots.front()));
+      cacheFetchProg.add(numChunks == 1 ? Program(fetchChunk) : Program(Repeat(numChunks, fetchChunk)));
+    }
     cacheFetchProg.add(WriteUndef(remoteFetchOffsets, name + "/unlive_feature_offsets"));
-
-    ipu_utils::logger()->info("Cache '{}': Building update (scatter {} lines from fetchbuffer into residentSet).", name, fetchCount);
-    scatterToCache.createProgram(graph, fetchBuffer, cacheScatterOffsets, cacheFetchProg);
-    cacheFetchProg.add(WriteUndef(fetchBuffer, name + "/unlive_fetch_buffer"));
-    cacheFetchProg.add(WriteUndef(cacheScatterOffsets, name + "/unlive_fetch_buffer_indices"));
+    for (const auto& slot : slots) {
+      cacheFetchProg.add(WriteUndef(slot.lines, name + "/unlive_fetch_buffer"));
+      cacheFetchProg.add(WriteUndef(slot.indices, name + "/unlive_fetch_buffer_indices"));
+      if (compressed()) {
+        cacheFetchProg.add(WriteUndef(slot.compressed, name + "/unlive_compressed_fetch_buffer"));
+      }
+      if (quantised()) {
+        cacheFetchProg.add(WriteUndef(slot.scales, name + "/unlive_scale_fetch_buffer"));
+      }
+      if (pipelined) {
+        cacheFetchProg.add(WriteUndef(slot.ioLines, name + "/unlive_io_fetch_buffer"));
+        if (quantised()) {
+          cacheFetchProg.add(WriteUndef(slot.ioScales, name + "/unlive_io_scale_fetch_buffer"));
+        }
+      }
+    }
+    if (numChunks != 1) {
+      cacheFetchProg.add(WriteUndef(cacheScatterOffsets, name + "/unlive_scatter_offsets"));
+    }
 
     ipu_utils::logger()->info("Done building cache");
   }
 
+  /// Build an on chip tag directory so that the cache decides for itself which
+  /// lines to fetch. Must be called after build() and the codelets in
+  /// SoftwareCache/directory.cpp must have been added to the graph.
+  ///
+  /// The directory is set associative with the given number of ways and uses
+  /// LRU replacement. For a batch of requested line indices it computes the
+  /// hits, chooses victim slots for the misses and writes the fetch list to
+  /// remoteFetchOffsets and cacheScatterOffsets. At most fetchCount misses are
+  /// serviced per batch: the rest are dropped (and reported as such).
+  /// The directory runs as a single vertex on the specified tile.
+  void buildDirectory(poplar::Graph& graph, std::size_t requestCount,
+                      std::size_t associativity, unsigned tile) {
+    using namespace poplar::program;
+
+    if (associativity == 0 || totalCacheLines % associativity != 0) {
+      throw std::runtime_error("Number of cache lines must be a multiple of the associativity.");
+    }
+    ways = associativity;
+    const auto numSets = totalCacheLines / ways;
+    ipu_utils::logger()->info("Cache '{}': Building {}-way directory with {} sets on tile {}.", name, ways, numSets, tile);
+
+    const auto u32 = poplar::UNSIGNED_INT;
+    auto tags = graph.addVariable(u32, {totalCacheLines}, name + "/directory/tags");
+    auto lastUsed = graph.addVariable(u32, {totalCacheLines}, name + "/directory/last_used");
+    auto batch = graph.addVariable(u32, {}, name + "/directory/batch");
+    requestedLines.buildTensor(graph, u32, {requestCount});
+    requestSlots.buildTensor(graph, u32, {requestCount});
+    directoryCounts.buildTensor(graph, u32, {3});
+    auto fetchLines = graph.addVariable(u32, {fetchCount}, name + "/directory/fetch_lines");
+    auto fetchSlots = graph.addVariable(u32, {fetchCount}, name + "/directory/fetch_slots");
+
+    for (auto t : {tags, lastUsed, batch, requestedLines.get(), requestSlots.get(),
+                   directoryCounts.get(), fetchLines, fetchSlots}) {
+      graph.setTileMapping(t, tile);
+    }
+    graph.setInitialValue(tags, std::vector<std::uint32_t>(totalCacheLines, invalidEntry));
+    graph.setInitialValue(lastUsed, std::vector<std::uint32_t>(totalCacheLines, 0));
+    graph.setInitialValue(batch, 0u);
+    graph.setInitialValue(directoryCounts.get(), std::vector<std::uint32_t>(3, 0));
+
+    auto cs = graph.addComputeSet(name + "/directory_update");
+    auto v = graph.addVertex(cs, "CacheDirectoryUpdate");
+    graph.setTileMapping(v, tile);
+    graph.setPerfEstimate(v, 20 * requestCount * ways);
+    graph.connect(v["requests"], requestedLines.get());
+    graph.connect(v["tags"], tags);
+    graph.connect(v["lastUsed"], lastUsed);
+    graph.connect(v["batch"], batch);
+    graph.connect(v["counts"], directoryCounts.get());
+    graph.connect(v["slots"], requestSlots.get());
+    graph.connect(v["fetchLines"], fetchLines);
+    graph.connect(v["fetchSlots"], fetchSlots);
+    graph.setInitialValue(v["ways"], (unsigned)ways);
+
+    requestStreamSequence.add(requestedLines.buildWrite(graph, true));
+
+    // Update the directory then distribute its fetch list to the tensors
+    // used by the fetch program:
+    cacheLookupProg = Sequence();
+    cacheLookupProg.add(Execute(cs));
+    cacheLookupProg.add(Copy(fetchLines, remoteFetchOffsets.get()));
+    cacheLookupProg.add(Copy(fetchSlots, cacheScatterOffsets.get().flatten()));
+    cacheLookupProg.add(cacheFetchProg);
+
+    directoryReadProg.add(requestedLines.buildRead(graph, true));
+    directoryReadProg.add(requestSlots.buildRead(graph, true));
+    directoryReadProg.add(directoryCounts.buildRead(graph, true));
+  }
+
+  template <class T>
   void connectStreams(
     poplar::Engine& e,
     std::vector<std::uint32_t>& remoteIndices,
     std::vector<std::uint32_t>& localIndices,
-    std::vector<std::int32_t>& cacheData
+    std::vector<T>& cacheData
   ) {
     ipu_utils::connectStream(e, remoteFetchOffsets.getWriteHandle(), remoteIndices);
     ipu_utils::connectStream(e, cacheScatterOffsets.getWriteHandle(), localIndices);
     ipu_utils::connectStream(e, residentSet.getReadHandle(), cacheData);
   }
 
+  /// Connect the streams with a callback that supplies fresh remote indices for every fetch.
+  template <class T>
+  void connectStreams(
+    poplar::Engine& e,
+    std::unique_ptr<poplar::StreamCallback> remoteIndices,
+    std::vector<std::uint32_t>& localIndices,
+    std::vector<T>& cacheData
+  ) {
+    e.connectStreamToCallback(remoteFetchOffsets.getWriteHandle(), std::move(remoteIndices));
+    ipu_utils::connectStream(e, cacheScatterOffsets.getWriteHandle(), localIndices);
+    ipu_utils::connectStream(e, residentSet.getReadHandle(), cacheData);
+  }
+
+  /// Connect the directory's streams: requests are the line indices to look up,
+  /// then when the directory is read back requests receives the last batch of
+  /// lines looked up, slots receives the cache slot of each of those requests,
+  /// and counts receives the running totals of hits, misses, and dropped
+  /// requests (in that order).
+  void connectDirectoryStreams(
+    poplar::Engine& e,
+    std::vector<std::uint32_t>& requests,
+    std::vector<std::uint32_t>& slots,
+    std::vector<std::uint32_t>& counts
+  ) {
+    ipu_utils::connectStream(e, requestedLines.getWriteHandle(), requests);
+    connectDirectoryReadStreams(e, requests, slots, counts);
+  }
+
+  /// Connect the directory's streams with a callback that supplies fresh requests for every lookup.
+  void connectDirectoryStreams(
+    poplar::Engine& e,
+    std::unique_ptr<poplar::StreamCallback> requestCallback,
+    std::vector<std::uint32_t>& lastRequests,
+    std::vector<std::uint32_t>& slots,
+    std::vector<std::uint32_t>& counts
+  ) {
+    e.connectStreamToCallback(requestedLines.getWriteHandle(), std::move(requestCallback));
+    connectDirectoryReadStreams(e, lastRequests, slots, counts);
+  }
+
+  void connectDirectoryReadStreams(
+    poplar::Engine& e,
+    std::vector<std::uint32_t>& requests,
+    std::vector<std::uint32_t>& slots,
+    std::vector<std::uint32_t>& counts
+  ) {
+    ipu_utils::connectStream(e, requestedLines.getReadHandle(), requests);
+    ipu_utils::connectStream(e, requestSlots.getReadHandle(), slots);
+    ipu_utils::connectStream(e, directoryCounts.getReadHandle(), counts);
+  }
+
   const std::string name;
-  poplar::Type dataType;
+  poplar::Type dataType;              // Element type of the lines in the cache.
+  poplar::Type storageType;           // Element type of the lines in the remote buffer.
   const std::size_t cacheableSetSize; // Total number of lines stored in the remote buffer.
                                       // Only a subset can be on chip at once.
   const std::size_t totalCacheLines;  // Number of cache lines on chip.
   const std::size_t cacheLineSize;    // Number of elements on each cache line.
-  const std::size_t fetchCount;       // Number of lines that can be fetched from the
-                                      // remote buffer in one copy. (If this is too big it results
-                                      // in excessive internal exchange code so large fetches should
-                                      // be broken down into a series of smaller fetches).
+  const std::size_t fetchCount;       // Number of lines fetched from the remote buffer in each cache
+                                      // update. (If this is too big for one copy it results in
+                                      // excessive internal exchange code so large fetches should be
+                                      // broken into chunks: see build()).
+  std::size_t fetchChunkSize = 0;     // Number of lines fetched by each remote buffer copy.
 
   // Remote buffer where all the cacheable data is stored:
   poplar::RemoteBuffer remoteFeatures;
 
+  // Remote buffer for the scale of each line (only when lines are quantised):
+  poplar::RemoteBuffer remoteScales;
+
   // Tensor that holds the on chip cached data. (Actually a multi-set in
-  // general since nothing enforces it as a set).
+  // general unless the directory is used to decide the cache updates).
   ipu_utils::StreamableTensor residentSet;
 
   // Tensor that describes which feature indices to fetch from the remote buffer into the on
@@ -124,6 +459,28 @@ struct SoftwareCache {
 
   // Program to read back the entire cache to the host (mainly intended for debugging):
   poplar::program::Sequence cacheReadProg;
+
+  // Directory state (only valid after buildDirectory()):
+  std::size_t ways = 0;
+
+  // Batch of remote buffer line indices to look up in the directory.
+  ipu_utils::StreamableTensor requestedLines;
+
+  // Cache slot holding each requested line after the lookup (or invalidEntry).
+  ipu_utils::StreamableTensor requestSlots;
+
+  // Running totals of directory hits, misses and dropped requests.
+  ipu_utils::StreamableTensor directoryCounts;
+
+  // Program that streams a batch of requests from the host.
+  poplar::program::Sequence requestStreamSequence;
+
+  // Program that looks up the requested lines in the directory and then
+  // fetches the misses from the remote buffer into their victim slots.
+  poplar::program::Sequence cacheLookupProg;
+
+  // Program that reads the request slots and directory counts to the host.
+  poplar::program::Sequence directoryReadProg;
 };
 
 struct SoftwareCacheBenchmark :
@@ -144,11 +501,27 @@ private:
   std::unique_ptr<SoftwareCache> cache;
   ipu_utils::RuntimeConfig runConfig;
   ipu_utils::ProgramManager programs;
+  std::string dataTypeName;
+  std::string storageTypeName;
+  poplar::Type dataType;
+  poplar::Type storageType;
   std::size_t residentSetSize;
   std::size_t cacheableSetSize;
   std::size_t lineSize;
   std::size_t fetchCount;
+  std::size_t fetchChunkSize;
+  unsigned fetchIOTiles;
   std::size_t iterations;
+  std::size_t fillThreads;
+  std::string fillFile;
   std::size_t seed;
+  std::size_t requestCount;
+  std::size_t associativity;
+  std::string codeletPath;
+  std::string accessPatternName;
+  access_patterns::Pattern accessPattern;
+  double zipfSkew;
+  std::string traceFile;
+  bool generateOnIpu;
   bool optimiseCycles;
 };